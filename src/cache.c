@@ -0,0 +1,263 @@
+#include "cache.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC 0x50524f42u
+#define CACHE_VERSION 1u
+// Slots looked at for a key before the oldest of them is evicted
+#define CACHE_PROBE_LEN 8
+
+typedef struct cache_file
+{
+  uint32_t magic;
+  uint32_t version;
+  probe_cache_entry_t entries[CACHE_ENTRIES];
+} cache_file_t;
+
+static int cache_fd = -1;
+static cache_file_t* cache = NULL;
+static uint32_t cache_ttl = DEFAULT_CACHE_TTL;
+
+static int64_t
+wall_time()
+{
+  return (int64_t)time(NULL);
+}
+
+// FNV-1a
+static uint64_t
+key_hash(const char* key)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  while (*key != '\0') {
+    hash ^= (uint8_t)*key++;
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+static void
+make_key(char* key, const char* host, in_port_t port)
+{
+  snprintf(key, CACHE_KEY_LEN, "%s:%u", host, port);
+}
+
+// Entry of `key`, or the slot to take for it when `create` is set. Must be
+// called with the file lock held
+static probe_cache_entry_t*
+find_entry(const char* key, bool create)
+{
+  uint64_t hash = key_hash(key);
+  probe_cache_entry_t* victim = NULL;
+
+  for (size_t i = 0; i < CACHE_PROBE_LEN; ++i) {
+    probe_cache_entry_t* entry = &cache->entries[(hash + i) % CACHE_ENTRIES];
+
+    if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+      return entry;
+    }
+
+    if (victim == NULL || entry->updated < victim->updated) {
+      victim = entry;
+    }
+  }
+
+  if (!create) {
+    return NULL;
+  }
+
+  memset(victim, 0, sizeof(probe_cache_entry_t));
+  victim->hash = hash;
+  victim->last_good = NO_LAST_GOOD;
+  strncpy(victim->key, key, CACHE_KEY_LEN - 1);
+
+  return victim;
+}
+
+bool
+probe_cache_open(const char* path, uint32_t ttl)
+{
+  struct stat st;
+  void* addr;
+
+  probe_cache_close();
+
+  cache_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+  if (cache_fd == -1) {
+    return false;
+  }
+
+  flock(cache_fd, LOCK_EX);
+
+  // Fresh or incompatible file is reset under the lock, so concurrent
+  // invocations never see a half initialized one
+  if (fstat(cache_fd, &st) != 0 ||
+      ((size_t)st.st_size != sizeof(cache_file_t) &&
+       ftruncate(cache_fd, sizeof(cache_file_t)) != 0)) {
+    flock(cache_fd, LOCK_UN);
+    probe_cache_close();
+    return false;
+  }
+
+  addr = mmap(NULL,
+              sizeof(cache_file_t),
+              PROT_READ | PROT_WRITE,
+              MAP_SHARED,
+              cache_fd,
+              0);
+
+  if (addr == MAP_FAILED) {
+    flock(cache_fd, LOCK_UN);
+    probe_cache_close();
+    return false;
+  }
+
+  cache = addr;
+
+  if (cache->magic != CACHE_MAGIC || cache->version != CACHE_VERSION) {
+    memset(cache, 0, sizeof(cache_file_t));
+    cache->magic = CACHE_MAGIC;
+    cache->version = CACHE_VERSION;
+  }
+
+  flock(cache_fd, LOCK_UN);
+  cache_ttl = ttl;
+
+  return true;
+}
+
+void
+probe_cache_close()
+{
+  if (cache != NULL) {
+    munmap(cache, sizeof(cache_file_t));
+    cache = NULL;
+  }
+
+  if (cache_fd != -1) {
+    close(cache_fd);
+    cache_fd = -1;
+  }
+}
+
+bool
+probe_cache_lookup(const char* host,
+                   in_port_t port,
+                   probe_cache_entry_t* entry)
+{
+  char key[CACHE_KEY_LEN];
+  probe_cache_entry_t* found;
+
+  if (cache == NULL) {
+    return false;
+  }
+
+  make_key(key, host, port);
+
+  flock(cache_fd, LOCK_SH);
+  found = find_entry(key, false);
+
+  if (found != NULL) {
+    *entry = *found;
+  }
+
+  flock(cache_fd, LOCK_UN);
+
+  return found != NULL;
+}
+
+bool
+probe_cache_fresh(const probe_cache_entry_t* entry)
+{
+  return entry->addr_count > 0 && entry->expires > wall_time();
+}
+
+void
+probe_cache_store_addrs(const char* host,
+                        in_port_t port,
+                        const struct in_addr* addrs,
+                        size_t count)
+{
+  char key[CACHE_KEY_LEN];
+  probe_cache_entry_t* entry;
+  struct in_addr last_good;
+  bool had_last_good;
+
+  if (cache == NULL) {
+    return;
+  }
+
+  if (count > CACHE_MAX_ADDRS) {
+    count = CACHE_MAX_ADDRS;
+  }
+
+  make_key(key, host, port);
+
+  flock(cache_fd, LOCK_EX);
+  entry = find_entry(key, true);
+  had_last_good = entry->last_good < entry->addr_count;
+
+  if (had_last_good) {
+    last_good = entry->addrs[entry->last_good];
+  }
+
+  memcpy(entry->addrs, addrs, count * sizeof(struct in_addr));
+  entry->addr_count = (uint8_t)count;
+  entry->last_good = NO_LAST_GOOD;
+  entry->updated = wall_time();
+  entry->expires = entry->updated + cache_ttl;
+
+  // Keep the known good address when it is still among the resolved ones
+  for (size_t i = 0; had_last_good && i < count; ++i) {
+    if (addrs[i].s_addr == last_good.s_addr) {
+      entry->last_good = (uint8_t)i;
+    }
+  }
+
+  flock(cache_fd, LOCK_UN);
+}
+
+void
+probe_cache_store_result(const char* host,
+                         in_port_t port,
+                         struct in_addr addr,
+                         SERVICE_STATE state,
+                         uint32_t latency_us)
+{
+  char key[CACHE_KEY_LEN];
+  probe_cache_entry_t* entry;
+
+  if (cache == NULL) {
+    return;
+  }
+
+  make_key(key, host, port);
+
+  flock(cache_fd, LOCK_EX);
+  entry = find_entry(key, true);
+  entry->updated = wall_time();
+
+  if (state == AVAILABLE) {
+    entry->failure_streak = 0;
+    entry->latency_us = latency_us;
+
+    for (size_t i = 0; i < entry->addr_count; ++i) {
+      if (entry->addrs[i].s_addr == addr.s_addr) {
+        entry->last_good = (uint8_t)i;
+      }
+    }
+  } else {
+    entry->failure_streak++;
+  }
+
+  flock(cache_fd, LOCK_UN);
+}
@@ -0,0 +1,62 @@
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+#include "probe.h"
+
+#define CACHE_ENTRIES 256
+#define CACHE_MAX_ADDRS 8
+#define CACHE_KEY_LEN 272
+#define DEFAULT_CACHE_TTL 30
+#define NO_LAST_GOOD UINT8_MAX
+
+// One target (host & port) remembered between invocations
+typedef struct probe_cache_entry
+{
+  uint64_t hash;
+  char key[CACHE_KEY_LEN];
+  // Wall clock seconds, shared by every process using the file
+  int64_t expires;
+  int64_t updated;
+  struct in_addr addrs[CACHE_MAX_ADDRS];
+  uint8_t addr_count;
+  // Index in `addrs` of the last address accepted connection
+  uint8_t last_good;
+  uint32_t latency_us;
+  uint32_t failure_streak;
+} probe_cache_entry_t;
+
+// Maps the cache file (created when missing) shared between invocations.
+// Resolved addresses are trusted for `ttl` seconds. Only the blocking
+// `host_*_probe_r` probes use it, `flock` doesn't guard threads of a process,
+// so `probe_target_init` & the engine never touch it
+bool
+probe_cache_open(const char* path, uint32_t ttl);
+
+void
+probe_cache_close();
+
+// Copies the entry of `host` & `port`, false when there is none
+bool
+probe_cache_lookup(const char* host,
+                   in_port_t port,
+                   probe_cache_entry_t* entry);
+
+// Whether resolved addresses of the entry can still be used
+bool
+probe_cache_fresh(const probe_cache_entry_t* entry);
+
+void
+probe_cache_store_addrs(const char* host,
+                        in_port_t port,
+                        const struct in_addr* addrs,
+                        size_t count);
+
+// `addr` is the address probed last, `latency_us` the successful attempt time
+void
+probe_cache_store_result(const char* host,
+                         in_port_t port,
+                         struct in_addr addr,
+                         SERVICE_STATE state,
+                         uint32_t latency_us);
+
+#endif
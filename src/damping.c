@@ -0,0 +1,125 @@
+#include "damping.h"
+#include <math.h>
+#include <string.h>
+
+#define DEFAULT_HALF_LIFE_MS 30000
+#define DEFAULT_SUPPRESS 2000
+#define DEFAULT_REUSE 750
+
+static void
+record(probe_damper_t* damper, const probe_result_t* result, uint64_t now_ms)
+{
+  size_t tail = (damper->history_head + damper->history_count) %
+                DAMPING_HISTORY;
+  uint64_t total_us = result->timings.total_ns / 1000;
+
+  damper->history[tail].at_ms = now_ms;
+  damper->history[tail].total_us =
+    total_us > UINT32_MAX ? UINT32_MAX : (uint32_t)total_us;
+  damper->history[tail].state = result->state;
+
+  // Full buffer drops the oldest one
+  if (damper->history_count == DAMPING_HISTORY) {
+    damper->history_head = (damper->history_head + 1) % DAMPING_HISTORY;
+  } else {
+    damper->history_count++;
+  }
+}
+
+void
+probe_damping_conf_init(probe_damping_conf_t* conf)
+{
+  conf->down_after = 1;
+  conf->up_after = 1;
+  conf->half_life_ms = DEFAULT_HALF_LIFE_MS;
+  conf->suppress = DEFAULT_SUPPRESS;
+  conf->reuse = DEFAULT_REUSE;
+}
+
+void
+probe_damper_init(probe_damper_t* damper)
+{
+  memset(damper, 0, sizeof(probe_damper_t));
+}
+
+double
+probe_damper_penalty(const probe_damper_t* damper,
+                     const probe_damping_conf_t* conf,
+                     uint64_t now_ms)
+{
+  if (conf->half_life_ms == 0 || damper->penalty == 0) {
+    return 0;
+  }
+
+  return damper->penalty * exp2(-(double)(now_ms - damper->penalty_ms) /
+                                conf->half_life_ms);
+}
+
+bool
+probe_damper_update(probe_damper_t* damper,
+                    const probe_damping_conf_t* conf,
+                    const probe_result_t* result,
+                    uint64_t now_ms)
+{
+  DAMPER_STATE seen = result->state == AVAILABLE ? DAMPER_UP : DAMPER_DOWN;
+  uint32_t needed = seen == DAMPER_UP ? conf->up_after : conf->down_after;
+
+  record(damper, result, now_ms);
+  damper->penalty = probe_damper_penalty(damper, conf, now_ms);
+  damper->penalty_ms = now_ms;
+
+  // The first verdict is taken as is, there is nothing to flap from
+  if (damper->state == DAMPER_UNKNOWN) {
+    damper->state = seen;
+  } else if (seen == damper->state) {
+    damper->streak = 0;
+  } else if (++damper->streak >= (needed != 0 ? needed : 1)) {
+    damper->state = seen;
+    damper->streak = 0;
+
+    if (conf->half_life_ms != 0) {
+      damper->penalty += DAMPING_PENALTY;
+    }
+  }
+
+  if (damper->penalty >= conf->suppress && conf->half_life_ms != 0) {
+    damper->suppressed = true;
+  } else if (damper->penalty < conf->reuse) {
+    damper->suppressed = false;
+  }
+
+  // A flapping target is held down till reuse, like a withdrawn route
+  if (damper->suppressed) {
+    if (damper->reported == DAMPER_DOWN) {
+      return false;
+    }
+
+    damper->reported = DAMPER_DOWN;
+
+    return true;
+  }
+
+  if (damper->state == damper->reported) {
+    return false;
+  }
+
+  damper->reported = damper->state;
+
+  return true;
+}
+
+size_t
+probe_damper_history(const probe_damper_t* damper,
+                     probe_history_entry_t* entries,
+                     size_t max)
+{
+  size_t count = damper->history_count < max ? damper->history_count : max;
+
+  for (size_t i = 0; i < count; ++i) {
+    size_t newest = damper->history_head + damper->history_count - 1 - i;
+
+    entries[i] = damper->history[newest % DAMPING_HISTORY];
+  }
+
+  return count;
+}
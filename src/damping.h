@@ -0,0 +1,86 @@
+#ifndef PROBE_DAMPING_H
+#define PROBE_DAMPING_H
+
+// Turns a stream of verdicts of one target into up & down transitions:
+// hysteresis filters single blips, flap damping holds down a target that
+// keeps toggling anyway. Fixed size, meant to be kept next to the target
+
+#include "probe.h"
+
+// Added on every transition, decays by half each `half_life_ms`
+#define DAMPING_PENALTY 1000
+#define DAMPING_HISTORY 16
+
+typedef struct probe_damping_conf
+{
+  // Consecutive failures to go down & successes to come up, 1 when 0
+  uint32_t down_after;
+  uint32_t up_after;
+  // 0 disables flap damping
+  uint32_t half_life_ms;
+  // From the moment the penalty reaches `suppress` the target is reported
+  // down and comes back up only once it decays below `reuse`
+  uint32_t suppress;
+  uint32_t reuse;
+} probe_damping_conf_t;
+
+typedef enum DAMPER_STATE
+{
+  // No verdict yet
+  DAMPER_UNKNOWN,
+  DAMPER_UP,
+  DAMPER_DOWN,
+} DAMPER_STATE;
+
+typedef struct probe_history_entry
+{
+  uint64_t at_ms;
+  uint32_t total_us;
+  SERVICE_STATE state;
+} probe_history_entry_t;
+
+typedef struct probe_damper
+{
+  // State after hysteresis & the last one reported
+  DAMPER_STATE state;
+  DAMPER_STATE reported;
+  uint32_t streak;
+  bool suppressed;
+  double penalty;
+  uint64_t penalty_ms;
+  // Ring buffer of recent verdicts, `history_count` of them are valid
+  probe_history_entry_t history[DAMPING_HISTORY];
+  size_t history_head;
+  size_t history_count;
+} probe_damper_t;
+
+// Suppress at 2 & reuse under 0.75 penalties with a 30 seconds half life,
+// single verdicts switch the state
+void
+probe_damping_conf_init(probe_damping_conf_t* conf);
+
+void
+probe_damper_init(probe_damper_t* damper);
+
+// Feeds the verdict of `result` at monotonic `now_ms`. Returns true when the
+// reported state changed, `damper->reported` is the new one
+bool
+probe_damper_update(probe_damper_t* damper,
+                    const probe_damping_conf_t* conf,
+                    const probe_result_t* result,
+                    uint64_t now_ms);
+
+// Penalty decayed till `now_ms`
+double
+probe_damper_penalty(const probe_damper_t* damper,
+                     const probe_damping_conf_t* conf,
+                     uint64_t now_ms);
+
+// Copies up to `max` recent verdicts into `entries`, the newest first.
+// Returns the number copied
+size_t
+probe_damper_history(const probe_damper_t* damper,
+                     probe_history_entry_t* entries,
+                     size_t max);
+
+#endif
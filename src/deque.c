@@ -0,0 +1,133 @@
+#include "deque.h"
+#include <stdlib.h>
+
+#define CACHE_LINE 64
+
+// `top` and `bottom` are on their own cache lines, thieves hammer the first
+// one while the owner keeps writing the second
+struct probe_deque
+{
+  int64_t top __attribute__((aligned(CACHE_LINE)));
+  int64_t bottom __attribute__((aligned(CACHE_LINE)));
+  uint32_t* ids __attribute__((aligned(CACHE_LINE)));
+  int64_t mask;
+};
+
+probe_deque_t*
+probe_deque_create(size_t capacity)
+{
+  probe_deque_t* deque;
+  size_t size = 1;
+
+  if (posix_memalign((void**)&deque, CACHE_LINE, sizeof(probe_deque_t)) != 0) {
+    return NULL;
+  }
+
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  deque->top = 0;
+  deque->bottom = 0;
+  deque->mask = (int64_t)size - 1;
+  deque->ids = calloc(size, sizeof(uint32_t));
+
+  if (deque->ids == NULL) {
+    free(deque);
+    return NULL;
+  }
+
+  return deque;
+}
+
+void
+probe_deque_destroy(probe_deque_t* deque)
+{
+  if (deque == NULL) {
+    return;
+  }
+
+  free(deque->ids);
+  free(deque);
+}
+
+bool
+probe_deque_push(probe_deque_t* deque, uint32_t id)
+{
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+  if (bottom - top > deque->mask) {
+    return false;
+  }
+
+  __atomic_store_n(&deque->ids[bottom & deque->mask], id, __ATOMIC_RELAXED);
+  // The id has to be visible before thieves can see the new bottom
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+  return true;
+}
+
+DEQUE_STATE
+probe_deque_take(probe_deque_t* deque, uint32_t* id)
+{
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  int64_t top;
+  DEQUE_STATE state = DEQUE_OK;
+
+  // Reserve the bottom id first, then check if a thief got there already
+  __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+  if (top > bottom) {
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return DEQUE_EMPTY;
+  }
+
+  *id = __atomic_load_n(&deque->ids[bottom & deque->mask], __ATOMIC_RELAXED);
+
+  // The last id, race thieves for it
+  if (top == bottom) {
+    if (!__atomic_compare_exchange_n(&deque->top,
+                                     &top,
+                                     top + 1,
+                                     false,
+                                     __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED)) {
+      state = DEQUE_EMPTY;
+    }
+
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+
+  return state;
+}
+
+DEQUE_STATE
+probe_deque_steal(probe_deque_t* deque, uint32_t* id)
+{
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  int64_t bottom;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+  if (top >= bottom) {
+    return DEQUE_EMPTY;
+  }
+
+  *id = __atomic_load_n(&deque->ids[top & deque->mask], __ATOMIC_RELAXED);
+
+  if (!__atomic_compare_exchange_n(&deque->top,
+                                   &top,
+                                   top + 1,
+                                   false,
+                                   __ATOMIC_SEQ_CST,
+                                   __ATOMIC_RELAXED)) {
+    return DEQUE_ABORT;
+  }
+
+  return DEQUE_OK;
+}
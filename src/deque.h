@@ -0,0 +1,39 @@
+#ifndef PROBE_DEQUE_H
+#define PROBE_DEQUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock free work stealing deque of ids (Chase-Lev). Only the owner thread
+// pushes and takes at the bottom, any thread can steal from the top
+typedef struct probe_deque probe_deque_t;
+
+typedef enum DEQUE_STATE
+{
+  DEQUE_OK,
+  DEQUE_EMPTY,
+  // Lost the race to another thief, worth retrying
+  DEQUE_ABORT,
+} DEQUE_STATE;
+
+// Holds up to `capacity` ids, rounded up to a power of two
+probe_deque_t*
+probe_deque_create(size_t capacity);
+
+void
+probe_deque_destroy(probe_deque_t* deque);
+
+// Owner only. Returns false when the deque is full
+bool
+probe_deque_push(probe_deque_t* deque, uint32_t id);
+
+// Owner only, the most recently pushed id
+DEQUE_STATE
+probe_deque_take(probe_deque_t* deque, uint32_t* id);
+
+// Any thread, the least recently pushed id
+DEQUE_STATE
+probe_deque_steal(probe_deque_t* deque, uint32_t* id);
+
+#endif
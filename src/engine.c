@@ -0,0 +1,877 @@
+#include "engine.h"
+#include "grpc.h"
+#include "internal.h"
+#include "limit.h"
+#include "tls.h"
+#include "wheel.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define EVENTS_BATCH 64
+#define NSS_BUF_LEN 4096
+
+typedef enum CONN_STATE
+{
+  CONN_FREE,
+  CONN_CONNECTING,
+  CONN_BACKOFF,
+  // Waiting for a token or a destination slot of the limiter
+  CONN_PACED,
+  CONN_HANDSHAKE,
+  // Health check call, see `probe_engine_conf_t`
+  CONN_RPC,
+  // Verdict is known, TLS 1.3 session ticket is still on its way
+  CONN_TICKET,
+  CONN_DONE,
+} CONN_STATE;
+
+typedef struct probe_conn
+{
+  probe_target_t* target;
+  CONN_STATE state;
+  socket_t sock;
+  // Holds limiter slots of the destination
+  bool limited;
+  probe_tls_t* tls;
+  probe_grpc_t* grpc;
+  size_t attempt;
+  uint64_t started;
+  // Start of the current phase
+  uint64_t ts;
+} probe_conn_t;
+
+// Connection deadlines live in the timing wheel, free and finished
+// connections in stacks of ids, so nothing scales with the capacity
+struct probe_engine
+{
+  int epfd;
+  probe_engine_conf_t conf;
+  probe_conn_t* conns;
+  size_t capacity;
+  size_t active;
+  uint32_t* free_ids;
+  size_t free_count;
+  uint32_t* done_ids;
+  size_t done_count;
+  // Woken by the limiter, to be started on this run
+  uint32_t* ready_ids;
+  size_t ready_count;
+  probe_wheel_t* wheel;
+  probe_limiter_t* limiter;
+};
+
+static uint32_t
+conn_id(probe_engine_t* engine, probe_conn_t* conn)
+{
+  return (uint32_t)(conn - engine->conns);
+}
+
+// The start is rounded up, a deadline never fires before `wait_ms` passed
+static void
+conn_deadline(probe_engine_t* engine, probe_conn_t* conn, uint64_t wait_ms)
+{
+  probe_wheel_schedule(engine->wheel,
+                       conn_id(engine, conn),
+                       (conn->ts + NS_IN_MS - 1) / NS_IN_MS + wait_ms);
+}
+
+static uint64_t
+conn_timeout(probe_engine_t* engine, probe_conn_t* conn)
+{
+  return conn->target->connect_timeout_ms != 0
+           ? conn->target->connect_timeout_ms
+           : engine->conf.connect_timeout_ms;
+}
+
+// Switches the registered socket to `events`
+static bool
+conn_poll(probe_engine_t* engine, probe_conn_t* conn, uint32_t events)
+{
+  struct epoll_event event = { .events = events, .data.ptr = conn };
+
+  // Connects done right away were never registered
+  return epoll_ctl(engine->epfd, EPOLL_CTL_MOD, conn->sock, &event) == 0 ||
+         (errno == ENOENT &&
+          epoll_ctl(engine->epfd, EPOLL_CTL_ADD, conn->sock, &event) == 0);
+}
+
+static void
+conn_close(probe_conn_t* conn)
+{
+  uint64_t ts = probe_now_ns();
+
+  probe_tls_free(conn->tls);
+  conn->tls = NULL;
+  probe_grpc_free(conn->grpc);
+  conn->grpc = NULL;
+  close(conn->sock);
+  conn->sock = -1;
+  probe_phase_end(&conn->target->result, PHASE_CLOSE, conn->attempt, ts, 0);
+}
+
+static void
+conn_verdict(probe_conn_t* conn, SERVICE_STATE state)
+{
+  probe_result_t* result = &conn->target->result;
+
+  result->state = state;
+  result->timings.total_ns = probe_now_ns() - conn->started;
+}
+
+// Target is handed back on the next flush, its verdict is already set
+static void
+conn_release(probe_engine_t* engine, probe_conn_t* conn)
+{
+  if (conn->sock != -1) {
+    conn_close(conn);
+  }
+
+  conn->state = CONN_DONE;
+  probe_wheel_cancel(engine->wheel, conn_id(engine, conn));
+  engine->done_ids[engine->done_count++] = conn_id(engine, conn);
+}
+
+static void
+conn_complete(probe_engine_t* engine, probe_conn_t* conn, SERVICE_STATE state)
+{
+  conn_verdict(conn, state);
+  conn_release(engine, conn);
+}
+
+static void
+on_wake(uint32_t id, void* data)
+{
+  probe_engine_t* engine = data;
+
+  engine->ready_ids[engine->ready_count++] = id;
+}
+
+static void
+conn_unlimit(probe_engine_t* engine, probe_conn_t* conn, bool failed)
+{
+  if (conn->limited) {
+    conn->limited = false;
+    probe_limiter_release(engine->limiter,
+                          &conn->target->addr,
+                          failed,
+                          probe_now_ns(),
+                          on_wake,
+                          engine);
+  }
+}
+
+static void
+attempt_failed(probe_engine_t* engine, probe_conn_t* conn, int error)
+{
+  probe_result_t* result = &conn->target->result;
+
+  conn_unlimit(engine, conn, true);
+
+  if (conn->state == CONN_CONNECTING) {
+    conn->ts =
+      probe_phase_end(result, PHASE_CONNECT, conn->attempt, conn->ts, error);
+  }
+
+  if (conn->sock != -1) {
+    conn_close(conn);
+  }
+
+  if (++conn->attempt < engine->conf.retry_count) {
+    conn->state = CONN_BACKOFF;
+    conn->ts = probe_now_ns();
+    conn_deadline(engine, conn, engine->conf.backoff_ms);
+  } else {
+    conn_complete(engine, conn, UNAVAILABLE);
+  }
+}
+
+// Handshake failures aren't retried, the verdict is final
+static void
+handshake_done(probe_engine_t* engine, probe_conn_t* conn, TLS_STEP step)
+{
+  probe_result_t* result = &conn->target->result;
+  uint64_t ts = probe_phase_end(result,
+                                PHASE_HANDSHAKE,
+                                conn->attempt,
+                                conn->ts,
+                                step == TLS_DONE ? 0 : (int)step);
+  uint64_t handshake_ms = (ts - conn->ts) / NS_IN_MS;
+
+  conn_unlimit(engine, conn, false);
+  conn_verdict(conn, probe_tls_verdict(conn->tls, step, &result->tls));
+
+  // The ticket is sent about a round trip after the handshake, which took
+  // at least one
+  if (step == TLS_DONE && probe_tls_wait_ticket(conn->tls) &&
+      conn_poll(engine, conn, EPOLLIN)) {
+    conn->state = CONN_TICKET;
+    conn->ts = ts;
+    conn_deadline(engine, conn, handshake_ms + 1);
+    return;
+  }
+
+  conn_release(engine, conn);
+}
+
+static void
+handshake_step(probe_engine_t* engine, probe_conn_t* conn)
+{
+  TLS_STEP step = probe_tls_handshake(conn->tls);
+
+  if ((step == TLS_WANT_READ || step == TLS_WANT_WRITE) &&
+      conn_poll(engine, conn, step == TLS_WANT_READ ? EPOLLIN : EPOLLOUT)) {
+    return;
+  }
+
+  handshake_done(engine, conn, step);
+}
+
+static void
+handshake_start(probe_engine_t* engine, probe_conn_t* conn)
+{
+  const char* server_name = engine->conf.tls_server_name != NULL
+                              ? engine->conf.tls_server_name
+                              : conn->target->server_name;
+
+  conn->state = CONN_HANDSHAKE;
+  conn->tls = probe_tls_new(conn->sock, server_name, &conn->target->addr);
+
+  if (conn->tls == NULL) {
+    handshake_done(engine, conn, TLS_FAILED);
+    return;
+  }
+
+  conn_deadline(engine, conn, conn_timeout(engine, conn));
+  handshake_step(engine, conn);
+}
+
+static void
+rpc_done(probe_engine_t* engine, probe_conn_t* conn, GRPC_STEP step)
+{
+  probe_result_t* result = &conn->target->result;
+
+  conn->ts = probe_phase_end(result,
+                             PHASE_RPC,
+                             conn->attempt,
+                             conn->ts,
+                             step == GRPC_DONE ? 0 : (int)step);
+  conn_unlimit(engine, conn, false);
+  conn_verdict(conn, probe_grpc_verdict(conn->grpc, step, &result->grpc));
+  conn_release(engine, conn);
+}
+
+static void
+rpc_step(probe_engine_t* engine, probe_conn_t* conn)
+{
+  GRPC_STEP step = probe_grpc_receive(conn->grpc, conn->sock);
+
+  if (step != GRPC_MORE) {
+    rpc_done(engine, conn, step);
+  }
+}
+
+// The whole call fits the socket buffer, so it is sent at once
+static void
+rpc_start(probe_engine_t* engine, probe_conn_t* conn)
+{
+  GRPC_STEP step = GRPC_FAILED;
+
+  conn->state = CONN_RPC;
+  conn->grpc = probe_grpc_new(conn->target->server_name,
+                              (struct sockaddr*)&conn->target->addr,
+                              engine->conf.grpc_service);
+
+  if (conn->grpc != NULL) {
+    step = probe_grpc_start(conn->grpc, conn->sock);
+  }
+
+  if (step != GRPC_MORE || !conn_poll(engine, conn, EPOLLIN)) {
+    rpc_done(engine, conn, step);
+    return;
+  }
+
+  conn_deadline(engine, conn, conn_timeout(engine, conn));
+}
+
+static void
+attempt_succeeded(probe_engine_t* engine, probe_conn_t* conn)
+{
+  probe_result_t* result = &conn->target->result;
+
+  conn->ts = probe_phase_end(result, PHASE_CONNECT, conn->attempt, conn->ts, 0);
+
+  if (engine->conf.tcp_info && conn->target->addr.ss_family != AF_UNIX) {
+    probe_read_tcp_info(conn->sock, &result->tcp_info);
+  }
+
+  // Destination slot is kept till the call or the handshake is over
+  if (engine->conf.grpc) {
+    rpc_start(engine, conn);
+    return;
+  }
+
+  if (engine->conf.tls) {
+    handshake_start(engine, conn);
+    return;
+  }
+
+  conn_unlimit(engine, conn, false);
+  conn_close(conn);
+  conn_complete(engine, conn, AVAILABLE);
+}
+
+// False when the attempt has to wait, `conn->ts` keeps the wait start
+static bool
+attempt_limit(probe_engine_t* engine, probe_conn_t* conn)
+{
+  uint64_t retry_ns;
+
+  switch (probe_limiter_acquire(engine->limiter,
+                                conn_id(engine, conn),
+                                &conn->target->addr,
+                                probe_now_ns(),
+                                &retry_ns)) {
+    case LIMIT_PASS: {
+      conn->limited = true;
+      return true;
+    }
+    case LIMIT_PACED: {
+      probe_wheel_schedule(engine->wheel,
+                           conn_id(engine, conn),
+                           (retry_ns + NS_IN_MS - 1) / NS_IN_MS);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  conn->state = CONN_PACED;
+
+  return false;
+}
+
+static void
+attempt_start(probe_engine_t* engine, probe_conn_t* conn)
+{
+  probe_target_t* target = conn->target;
+  struct epoll_event event = { .events = EPOLLOUT, .data.ptr = conn };
+  int conn_res;
+
+  if (conn->state == CONN_BACKOFF) {
+    conn->ts = probe_phase_end(
+      &target->result, PHASE_BACKOFF, conn->attempt - 1, conn->ts, 0);
+  }
+
+  if (engine->limiter != NULL && !attempt_limit(engine, conn)) {
+    return;
+  }
+
+  if (conn->state == CONN_PACED) {
+    probe_phase_end(
+      &target->result, PHASE_PACING, conn->attempt, conn->ts, 0);
+  }
+
+  conn->ts = probe_now_ns();
+  conn->sock =
+    socket(target->addr.ss_family,
+           (target->type != 0 ? target->type : SOCK_STREAM) | SOCK_NONBLOCK |
+             SOCK_CLOEXEC,
+           target->addr.ss_family == AF_UNIX ? 0 : IPPROTO_TCP);
+  conn->ts = probe_phase_end(&target->result,
+                             PHASE_SOCKET_CREATION,
+                             conn->attempt,
+                             conn->ts,
+                             conn->sock == -1 ? errno : 0);
+  conn->state = CONN_CONNECTING;
+
+  if (conn->sock == -1) {
+    attempt_failed(engine, conn, errno);
+    return;
+  }
+
+  // Unix sockets connect at once or fail with `EAGAIN` on a full backlog
+  conn_res =
+    connect(conn->sock, (struct sockaddr*)&target->addr, target->addrlen);
+
+  if (conn_res == 0) {
+    attempt_succeeded(engine, conn);
+  } else if (errno != EINPROGRESS) {
+    attempt_failed(engine, conn, errno);
+  } else if (epoll_ctl(engine->epfd, EPOLL_CTL_ADD, conn->sock, &event) != 0) {
+    attempt_failed(engine, conn, errno);
+  } else {
+    conn_deadline(engine, conn, conn_timeout(engine, conn));
+  }
+}
+
+// Milliseconds till the closest deadline, but not more than `timeout_ms`
+static int
+wait_time(probe_engine_t* engine, uint64_t now, int timeout_ms)
+{
+  int64_t wait_ms = probe_wheel_next(engine->wheel, now / NS_IN_MS);
+
+  if (wait_ms < 0 || (timeout_ms >= 0 && wait_ms > timeout_ms)) {
+    return timeout_ms;
+  }
+
+  return wait_ms > INT32_MAX ? INT32_MAX : (int)wait_ms;
+}
+
+static void
+on_deadline(uint32_t id, void* data)
+{
+  probe_engine_t* engine = data;
+  probe_conn_t* conn = &engine->conns[id];
+
+  switch (conn->state) {
+    case CONN_CONNECTING: {
+      attempt_failed(engine, conn, ETIMEDOUT);
+      break;
+    }
+    case CONN_BACKOFF:
+    case CONN_PACED: {
+      attempt_start(engine, conn);
+      break;
+    }
+    case CONN_HANDSHAKE: {
+      handshake_done(engine, conn, TLS_WANT_READ);
+      break;
+    }
+    case CONN_TICKET: {
+      conn_release(engine, conn);
+      break;
+    }
+    case CONN_RPC: {
+      rpc_done(engine, conn, GRPC_MORE);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+}
+
+// Attempts woken by the limiter, starting one may wake others
+static void
+start_ready(probe_engine_t* engine)
+{
+  while (engine->ready_count > 0) {
+    uint32_t id = engine->ready_ids[--engine->ready_count];
+
+    attempt_start(engine, &engine->conns[id]);
+  }
+}
+
+static size_t
+flush(probe_engine_t* engine, probe_done_fn done, void* data)
+{
+  size_t completed = 0;
+
+  // `done` may submit again, which can finish right away
+  while (engine->done_count > 0) {
+    uint32_t id = engine->done_ids[--engine->done_count];
+    probe_conn_t* conn = &engine->conns[id];
+
+    conn->state = CONN_FREE;
+    engine->free_ids[engine->free_count++] = id;
+    engine->active--;
+    completed++;
+
+    if (done != NULL) {
+      done(conn->target, data);
+    }
+  }
+
+  return completed;
+}
+
+SERVICE_STATE
+probe_target_init(probe_target_t* target,
+                  char* host,
+                  char* service,
+                  char* protocol)
+{
+  probe_result_t* result = &target->result;
+  struct sockaddr_in* sockaddr = (struct sockaddr_in*)&target->addr;
+  struct sockaddr_in6* sockaddr6 = (struct sockaddr_in6*)&target->addr;
+  struct protoent proto_buf, *proto;
+  struct servent serv_buf, *serv_ent;
+  struct hostent host_buf, *host_ent;
+  struct in_addr addr;
+  // Reentrant lookups, targets may be initialized by several threads
+  char buf[NSS_BUF_LEN];
+  int h_err = 0;
+  char* end;
+  uint64_t ts;
+
+  memset(target, 0, sizeof(probe_target_t));
+
+  if (protocol == NULL) {
+    protocol = DEFAULT_SERVICE_PROTOCOL;
+  }
+
+  ts = probe_now_ns();
+  getprotobyname_r(protocol, &proto_buf, buf, sizeof(buf), &proto);
+  probe_phase_end(result, PHASE_PROTOCOL_LOOKUP, 0, ts, proto == NULL);
+
+  // Only stream connects are done by the engine
+  if (proto == NULL || proto->p_proto != IPPROTO_TCP) {
+    return result->state = UNKNOWN_PROTOCOL;
+  }
+
+  unsigned long port = strtoul(service, &end, 10);
+
+  if (*service == '\0' || *end != '\0') {
+    ts = probe_now_ns();
+    getservbyname_r(service, protocol, &serv_buf, buf, sizeof(buf), &serv_ent);
+    probe_phase_end(result, PHASE_SERVICE_LOOKUP, 0, ts, serv_ent == NULL);
+
+    if (serv_ent == NULL) {
+      return result->state = UNKNOWN_SERVICE;
+    }
+
+    sockaddr->sin_port = serv_ent->s_port;
+  } else if (port == 0 || port > UINT16_MAX) {
+    return result->state = UNKNOWN_SERVICE;
+  } else {
+    sockaddr->sin_port = htons((in_port_t)port);
+  }
+
+  // Port offset is the same in both families
+  if (inet_pton(AF_INET6, host, &sockaddr6->sin6_addr) == 1) {
+    sockaddr6->sin6_family = AF_INET6;
+    target->addrlen = sizeof(struct sockaddr_in6);
+
+    return result->state = CANCELLED;
+  }
+
+  if (inet_aton(host, &addr) == 0) {
+    ts = probe_now_ns();
+    gethostbyname_r(host, &host_buf, buf, sizeof(buf), &host_ent, &h_err);
+    probe_phase_end(
+      result, PHASE_HOST_RESOLUTION, 0, ts, host_ent == NULL ? h_err : 0);
+
+    if (host_ent == NULL || host_ent->h_addrtype != AF_INET) {
+      return result->state = UNKNOWN_HOST;
+    }
+
+    addr = *(struct in_addr*)host_ent->h_addr;
+    target->server_name = host;
+  }
+
+  sockaddr->sin_family = AF_INET;
+  sockaddr->sin_addr = addr;
+  target->addrlen = sizeof(struct sockaddr_in);
+
+  return result->state = CANCELLED;
+}
+
+SERVICE_STATE
+probe_target_init_unix(probe_target_t* target, const char* path, int type)
+{
+  memset(target, 0, sizeof(probe_target_t));
+
+  if (type != SOCK_STREAM && type != SOCK_SEQPACKET) {
+    return target->result.state = UNKNOWN_PROTOCOL;
+  }
+
+  if (!probe_unix_addr(path, &target->addr, &target->addrlen)) {
+    return target->result.state = INVALID_PATH;
+  }
+
+  target->type = type;
+
+  return target->result.state = CANCELLED;
+}
+
+void
+probe_engine_conf_init(probe_engine_conf_t* conf)
+{
+  const probe_conf_t* probe_conf = probe_current_config();
+
+  conf->retry_count = probe_conf->retry_count;
+  conf->tcp_info = probe_conf->tcp_info;
+  conf->backoff_ms = probe_conf->timeout * 1000;
+  // Blocking connect has no deadline of its own, keep at least the default
+  conf->connect_timeout_ms =
+    (probe_conf->timeout != 0 ? probe_conf->timeout : DEFAULT_TIMEOUT) * 1000;
+  conf->rate = probe_conf->rate;
+  conf->burst = probe_conf->burst;
+  conf->per_host = probe_conf->per_host;
+  conf->per_subnet = probe_conf->per_subnet;
+  conf->adaptive = conf->per_host != 0 || conf->per_subnet != 0;
+  conf->tls = probe_conf->tls;
+  conf->tls_server_name = probe_conf->tls_server_name;
+  conf->grpc = probe_conf->grpc;
+  conf->grpc_service = probe_conf->grpc_service;
+}
+
+probe_engine_t*
+probe_engine_create(size_t capacity, const probe_engine_conf_t* conf)
+{
+  probe_engine_t* engine = calloc(1, sizeof(probe_engine_t));
+
+  if (engine == NULL) {
+    return NULL;
+  }
+
+  engine->conns = calloc(capacity, sizeof(probe_conn_t));
+  engine->free_ids = calloc(capacity, sizeof(uint32_t));
+  engine->done_ids = calloc(capacity, sizeof(uint32_t));
+  engine->ready_ids = calloc(capacity, sizeof(uint32_t));
+  engine->wheel = probe_wheel_create(capacity, probe_now_ns() / NS_IN_MS);
+  engine->limiter = probe_limiter_create(capacity, conf);
+  engine->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (engine->conns == NULL || engine->free_ids == NULL ||
+      engine->done_ids == NULL || engine->ready_ids == NULL ||
+      engine->wheel == NULL || engine->epfd == -1 ||
+      (engine->limiter == NULL &&
+       (conf->rate != 0 || conf->per_host != 0 || conf->per_subnet != 0))) {
+    engine->capacity = 0;
+    probe_engine_destroy(engine);
+    return NULL;
+  }
+
+  engine->conf = *conf;
+  engine->capacity = capacity;
+
+  // Lowest ids on top of the stack
+  for (size_t i = 0; i < capacity; ++i) {
+    engine->free_ids[i] = (uint32_t)(capacity - i - 1);
+  }
+
+  engine->free_count = capacity;
+
+  return engine;
+}
+
+void
+probe_engine_destroy(probe_engine_t* engine)
+{
+  if (engine == NULL) {
+    return;
+  }
+
+  probe_engine_cancel(engine);
+
+  if (engine->epfd != -1) {
+    close(engine->epfd);
+  }
+
+  probe_limiter_destroy(engine->limiter);
+  probe_wheel_destroy(engine->wheel);
+  free(engine->ready_ids);
+  free(engine->done_ids);
+  free(engine->free_ids);
+  free(engine->conns);
+  free(engine);
+}
+
+bool
+probe_engine_submit(probe_engine_t* engine, probe_target_t* target)
+{
+  probe_conn_t* conn;
+
+  if (engine->free_count == 0) {
+    return false;
+  }
+
+  conn = &engine->conns[engine->free_ids[--engine->free_count]];
+  memset(conn, 0, sizeof(probe_conn_t));
+  conn->target = target;
+  conn->sock = -1;
+  conn->started = conn->ts = probe_now_ns();
+  engine->active++;
+
+  // Lookups are done once, everything else is per run
+  memset(&target->result.timings.attempt_ns,
+         0,
+         sizeof(target->result.timings.attempt_ns));
+  memset(&target->result.tcp_info, 0, sizeof(probe_tcp_info_t));
+  memset(&target->result.tls, 0, sizeof(probe_tls_info_t));
+  memset(&target->result.grpc, 0, sizeof(probe_grpc_info_t));
+  target->result.timings.attempts = 0;
+
+  for (PROBE_PHASE phase = PHASE_SOCKET_CREATION; phase < PHASE_COUNT;
+       ++phase) {
+    target->result.timings.phase_ns[phase] = 0;
+  }
+
+  if (engine->conf.retry_count == 0) {
+    conn_complete(engine, conn, UNAVAILABLE);
+  } else {
+    attempt_start(engine, conn);
+  }
+
+  return true;
+}
+
+size_t
+probe_engine_run(probe_engine_t* engine,
+                 int timeout_ms,
+                 probe_done_fn done,
+                 void* data)
+{
+  struct epoll_event events[EVENTS_BATCH];
+  size_t completed;
+  int n;
+
+  start_ready(engine);
+  completed = flush(engine, done, data);
+
+  if (engine->active == 0) {
+    return completed;
+  }
+
+  // `done` may have woken someone through a failed resubmit
+  if (completed != 0 || engine->ready_count != 0) {
+    timeout_ms = 0;
+  }
+
+  n = epoll_wait(engine->epfd,
+                 events,
+                 EVENTS_BATCH,
+                 wait_time(engine, probe_now_ns(), timeout_ms));
+
+  if (n == -1 && errno != EINTR) {
+    perror("Events wait in `probe_engine_run` call");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < n; ++i) {
+    probe_conn_t* conn = events[i].data.ptr;
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    if (conn->state == CONN_HANDSHAKE) {
+      handshake_step(engine, conn);
+      continue;
+    }
+
+    if (conn->state == CONN_RPC) {
+      rpc_step(engine, conn);
+      continue;
+    }
+
+    if (conn->state == CONN_TICKET) {
+      if (!probe_tls_wait_ticket(conn->tls)) {
+        conn_release(engine, conn);
+      }
+
+      continue;
+    }
+
+    if (conn->state != CONN_CONNECTING) {
+      continue;
+    }
+
+    if (getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+      error = errno;
+    }
+
+    if (error == 0) {
+      attempt_succeeded(engine, conn);
+    } else {
+      attempt_failed(engine, conn, error);
+    }
+  }
+
+  probe_wheel_advance(
+    engine->wheel, probe_now_ns() / NS_IN_MS, on_deadline, engine);
+  start_ready(engine);
+
+  return completed + flush(engine, done, data);
+}
+
+size_t
+probe_engine_active(probe_engine_t* engine)
+{
+  return engine->active;
+}
+
+void
+probe_engine_cancel(probe_engine_t* engine)
+{
+  for (size_t i = 0; i < engine->capacity; ++i) {
+    probe_conn_t* conn = &engine->conns[i];
+
+    if (conn->state == CONN_CONNECTING || conn->state == CONN_BACKOFF ||
+        conn->state == CONN_PACED || conn->state == CONN_HANDSHAKE ||
+        conn->state == CONN_RPC) {
+      conn->limited = false;
+      conn_complete(engine, conn, CANCELLED);
+    } else if (conn->state == CONN_TICKET) {
+      conn_release(engine, conn);
+    }
+  }
+
+  engine->ready_count = 0;
+
+  if (engine->limiter != NULL) {
+    probe_limiter_reset(engine->limiter);
+  }
+
+  // Finished ones keep their verdict, but nobody is told anymore
+  flush(engine, NULL, NULL);
+}
+
+typedef struct quorum
+{
+  size_t available;
+  size_t unavailable;
+} quorum_t;
+
+static void
+quorum_done(probe_target_t* target, void* data)
+{
+  quorum_t* quorum = data;
+
+  if (target->result.state == AVAILABLE) {
+    quorum->available++;
+  } else {
+    quorum->unavailable++;
+  }
+}
+
+bool
+probe_quorum(probe_target_t* targets, size_t count, size_t required)
+{
+  probe_engine_conf_t conf;
+  probe_engine_t* engine;
+  quorum_t quorum = { 0, 0 };
+
+  probe_engine_conf_init(&conf);
+  engine = probe_engine_create(count, &conf);
+
+  if (engine == NULL) {
+    perror("Engine creation in `probe_quorum` call");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    if (targets[i].result.state != CANCELLED) {
+      quorum.unavailable++;
+    } else {
+      probe_engine_submit(engine, &targets[i]);
+    }
+  }
+
+  // Decided as soon as the rest can't change the outcome
+  while (quorum.available < required &&
+         count - quorum.unavailable >= required &&
+         probe_engine_active(engine) > 0) {
+    probe_engine_run(engine, -1, quorum_done, &quorum);
+  }
+
+  probe_engine_destroy(engine);
+
+  return quorum.available >= required;
+}
@@ -0,0 +1,111 @@
+#ifndef PROBE_ENGINE_H
+#define PROBE_ENGINE_H
+
+#include "probe.h"
+#include <sys/socket.h>
+
+typedef struct probe_target
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  // Socket type, `SOCK_STREAM` when 0. Unix sockets may be `SOCK_SEQPACKET`
+  int type;
+  // Overrides `probe_engine_conf_t` one when not 0
+  uint32_t connect_timeout_ms;
+  // TLS server name, NULL to skip the name check
+  const char* server_name;
+  probe_result_t result;
+  void* data;
+} probe_target_t;
+
+typedef struct probe_engine_conf
+{
+  size_t retry_count;
+  // Deadline of a single connect attempt
+  uint64_t connect_timeout_ms;
+  // Pause between a failed attempt and the next one
+  uint64_t backoff_ms;
+  // Capture `TCP_INFO` of successful connects
+  bool tcp_info;
+  // Connect attempts per second & how many of them can go at once, 0 for no
+  // limit
+  uint32_t rate;
+  uint32_t burst;
+  // Attempts in flight to one address & to one /24 (/64 for IPv6), 0 for no
+  // limit. Waiting for the limits is accounted to `PHASE_PACING`
+  uint32_t per_host;
+  uint32_t per_subnet;
+  // Halve the caps of a busy destination on every failed attempt, grow them
+  // back by one on success
+  bool adaptive;
+  // Handshake after connect, the connect timeout applies to it as well.
+  // Sessions are resumed by the next probe of the same target
+  bool tls;
+  // Overrides the target one when not NULL
+  const char* tls_server_name;
+  // gRPC health check call after connect instead of the handshake, under the
+  // connect timeout as well
+  bool grpc;
+  const char* grpc_service;
+} probe_engine_conf_t;
+
+typedef struct probe_engine probe_engine_t;
+
+typedef void (*probe_done_fn)(probe_target_t* target, void* data);
+
+// Resolves `host` & `service` (name or port number), safe to call from
+// several threads. On success the target state is `CANCELLED` until it is
+// probed. A host name is kept as the TLS server name, so it has to outlive
+// the target
+SERVICE_STATE
+probe_target_init(probe_target_t* target,
+                  char* host,
+                  char* service,
+                  char* protocol);
+
+// Unix domain socket at `path`, `@name` for the abstract namespace, of
+// `SOCK_STREAM` or `SOCK_SEQPACKET` `type`. The state is `CANCELLED` until
+// it is probed
+SERVICE_STATE
+probe_target_init_unix(probe_target_t* target, const char* path, int type);
+
+// Engine configuration equivalent to the current `probe_config`
+void
+probe_engine_conf_init(probe_engine_conf_t* conf);
+
+// Non blocking engine probing up to `capacity` targets at once. An engine
+// is not thread safe, but engines share nothing, so every thread can run
+// its own
+probe_engine_t*
+probe_engine_create(size_t capacity, const probe_engine_conf_t* conf);
+
+void
+probe_engine_destroy(probe_engine_t* engine);
+
+// Returns false when the engine is full
+bool
+probe_engine_submit(probe_engine_t* engine, probe_target_t* target);
+
+// Waits up to `timeout_ms` (-1 for no limit) for progress and calls `done`
+// for every target with a verdict. Returns the number of finished targets
+size_t
+probe_engine_run(probe_engine_t* engine,
+                 int timeout_ms,
+                 probe_done_fn done,
+                 void* data);
+
+size_t
+probe_engine_active(probe_engine_t* engine);
+
+// Stops probing of all active targets, their state becomes `CANCELLED`
+void
+probe_engine_cancel(probe_engine_t* engine);
+
+// Probes all `targets` concurrently until at least `required` of them are
+// available or that can't happen anymore. Targets failed on
+// `probe_target_init` count as unavailable. Lookups are done by the caller
+// beforehand, initializing the targets from several threads overlaps them
+bool
+probe_quorum(probe_target_t* targets, size_t count, size_t required);
+
+#endif
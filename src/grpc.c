@@ -0,0 +1,884 @@
+#include "grpc.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_FRAME_HEADER_LEN 9
+#define H2_STREAM 1
+
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_CONTINUATION 0x9
+
+#define H2_END_STREAM 0x1
+#define H2_ACK 0x1
+#define H2_END_HEADERS 0x4
+#define H2_PADDED 0x8
+#define H2_PRIORITY 0x20
+
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+
+// Static table indexes of RFC 7541 Appendix A
+#define HPACK_METHOD_POST 3
+#define HPACK_PATH 4
+#define HPACK_AUTHORITY 1
+#define HPACK_SCHEME_HTTP 6
+#define HPACK_STATUS_FIRST 8
+#define HPACK_STATUS_LAST 14
+#define HPACK_CONTENT_TYPE 31
+
+#define HUFFMAN_MAX_LEN 30
+// Placeholder of a symbol the decoder doesn't know
+#define HUFFMAN_UNKNOWN '\x7f'
+
+#define GRPC_PATH "/grpc.health.v1.Health/Check"
+#define GRPC_NAME_MAX 255
+#define GRPC_REQUEST_LEN 1024
+#define GRPC_FRAME_LEN 1024
+#define GRPC_BLOCK_LEN 2048
+#define GRPC_RESPONSE_LEN 64
+#define GRPC_REPLY_LEN 256
+#define GRPC_HEADER_NAME_LEN 32
+
+struct probe_grpc
+{
+  uint8_t request[GRPC_REQUEST_LEN];
+  size_t request_len;
+  // Frame being received, only the payload of the frames the call cares
+  // about is kept
+  uint8_t head[H2_FRAME_HEADER_LEN];
+  size_t head_len;
+  uint32_t frame_len;
+  uint8_t type;
+  uint8_t flags;
+  uint32_t stream;
+  uint8_t payload[GRPC_FRAME_LEN];
+  size_t payload_len;
+  bool settled;
+  // Header block split over CONTINUATION frames
+  uint8_t block[GRPC_BLOCK_LEN];
+  size_t block_len;
+  bool end_stream;
+  uint8_t response[GRPC_RESPONSE_LEN];
+  size_t response_len;
+  // SETTINGS & PING acknowledgements to send
+  uint8_t reply[GRPC_REPLY_LEN];
+  size_t reply_len;
+  probe_grpc_info_t info;
+};
+
+// No dynamic table, so response headers decode without state
+static const uint8_t settings[] = {
+  0, H2_SETTINGS_HEADER_TABLE_SIZE, 0, 0, 0, 0,
+  0, H2_SETTINGS_ENABLE_PUSH,       0, 0, 0, 0,
+};
+
+static const char* status_values[] = { "200", "204", "206", "304",
+                                       "400", "404", "500" };
+
+static const char* serving_names[] = { "UNKNOWN",
+                                       "SERVING",
+                                       "NOT_SERVING",
+                                       "SERVICE_UNKNOWN" };
+
+// Canonical Huffman code of RFC 7541 Appendix B as the symbols of every
+// code length in the order of their codes. Only printable ASCII is known,
+// gRPC headers carry nothing else (`grpc-message` is percent-encoded)
+static const char* huffman_symbols[HUFFMAN_MAX_LEN + 1] = {
+  [5] = "012aceiost",
+  [6] = " %-./3456789=A_bdfghlmnpru",
+  [7] = ":BCDEFGHIJKLMNOPQRSTUVWYjkqvwxyz",
+  [8] = "&*,;XZ",
+  [10] = "!\"()?",
+  [11] = "'+|",
+  [12] = "#>",
+  [13] = "\x7f$@[]~",
+  [14] = "^}",
+  [15] = "<`{",
+  [19] = "\\",
+};
+
+static uint32_t
+read_u32(const uint8_t* p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+static uint8_t*
+put_frame_header(uint8_t* p,
+                 size_t len,
+                 uint8_t type,
+                 uint8_t flags,
+                 uint32_t stream)
+{
+  p[0] = (uint8_t)(len >> 16);
+  p[1] = (uint8_t)(len >> 8);
+  p[2] = (uint8_t)len;
+  p[3] = type;
+  p[4] = flags;
+  p[5] = (uint8_t)(stream >> 24);
+  p[6] = (uint8_t)(stream >> 16);
+  p[7] = (uint8_t)(stream >> 8);
+  p[8] = (uint8_t)stream;
+
+  return p + H2_FRAME_HEADER_LEN;
+}
+
+// HPACK integer with a `prefix` bits long first part
+static uint8_t*
+put_int(uint8_t* p, uint8_t first, unsigned prefix, size_t value)
+{
+  size_t max = (1u << prefix) - 1;
+
+  if (value < max) {
+    *p++ = first | (uint8_t)value;
+    return p;
+  }
+
+  *p++ = first | (uint8_t)max;
+
+  for (value -= max; value >= 0x80; value >>= 7) {
+    *p++ = (uint8_t)(value | 0x80);
+  }
+
+  *p++ = (uint8_t)value;
+
+  return p;
+}
+
+// Protobuf base 128 varint, unlike HPACK integers it has no prefix
+static uint8_t*
+put_varint(uint8_t* p, size_t value)
+{
+  for (; value >= 0x80; value >>= 7) {
+    *p++ = (uint8_t)(value | 0x80);
+  }
+
+  *p++ = (uint8_t)value;
+
+  return p;
+}
+
+static size_t
+varint_len(size_t value)
+{
+  size_t len = 1;
+
+  for (; value >= 0x80; value >>= 7) {
+    len++;
+  }
+
+  return len;
+}
+
+// Plain string, the request is too small for Huffman to matter
+static uint8_t*
+put_string(uint8_t* p, const char* string, size_t len)
+{
+  p = put_int(p, 0, 7, len);
+  memcpy(p, string, len);
+
+  return p + len;
+}
+
+// Literal without indexing, `name` is a static table index
+static uint8_t*
+put_header(uint8_t* p, unsigned name, const char* value)
+{
+  return put_string(put_int(p, 0, 4, name), value, strlen(value));
+}
+
+static void
+build_request(probe_grpc_t* grpc, const char* authority, const char* service)
+{
+  size_t service_len = strlen(service);
+  uint8_t* p = grpc->request;
+  uint8_t *frame, *block;
+
+  memcpy(p, H2_PREFACE, sizeof(H2_PREFACE) - 1);
+  p += sizeof(H2_PREFACE) - 1;
+
+  p = put_frame_header(p, sizeof(settings), H2_SETTINGS, 0, 0);
+  memcpy(p, settings, sizeof(settings));
+  p += sizeof(settings);
+
+  frame = p;
+  block = p = frame + H2_FRAME_HEADER_LEN;
+  *p++ = 0x80 | HPACK_METHOD_POST;
+  *p++ = 0x80 | HPACK_SCHEME_HTTP;
+  p = put_header(p, HPACK_PATH, GRPC_PATH);
+  p = put_header(p, HPACK_AUTHORITY, authority);
+  p = put_header(p, HPACK_CONTENT_TYPE, "application/grpc");
+  *p++ = 0;
+  p = put_string(p, "te", 2);
+  p = put_string(p, "trailers", 8);
+  put_frame_header(
+    frame, (size_t)(p - block), H2_HEADERS, H2_END_HEADERS, H2_STREAM);
+
+  // Length-prefixed `HealthCheckRequest`, its only field is `service = 1`
+  size_t message_len =
+    service_len != 0 ? 1 + varint_len(service_len) + service_len : 0;
+
+  p = put_frame_header(p, 5 + message_len, H2_DATA, H2_END_STREAM, H2_STREAM);
+  *p++ = 0;
+  *p++ = (uint8_t)(message_len >> 24);
+  *p++ = (uint8_t)(message_len >> 16);
+  *p++ = (uint8_t)(message_len >> 8);
+  *p++ = (uint8_t)message_len;
+
+  if (service_len != 0) {
+    *p++ = 0x0a;
+    p = put_varint(p, service_len);
+    memcpy(p, service, service_len);
+    p += service_len;
+  }
+
+  grpc->request_len = (size_t)(p - grpc->request);
+}
+
+static GRPC_STEP
+fail(probe_grpc_t* grpc, const char* format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(grpc->info.message, GRPC_MESSAGE_LEN, format, args);
+  va_end(args);
+
+  return GRPC_FAILED;
+}
+
+static void
+reply(probe_grpc_t* grpc, uint8_t type, const uint8_t* payload, size_t len)
+{
+  // Acknowledgements are a courtesy, the call doesn't wait for them
+  if (grpc->reply_len + H2_FRAME_HEADER_LEN + len > GRPC_REPLY_LEN) {
+    return;
+  }
+
+  put_frame_header(grpc->reply + grpc->reply_len, len, type, H2_ACK, 0);
+  grpc->reply_len += H2_FRAME_HEADER_LEN;
+  memcpy(grpc->reply + grpc->reply_len, payload, len);
+  grpc->reply_len += len;
+}
+
+static bool
+hpack_int(const uint8_t** p, const uint8_t* end, unsigned prefix, size_t* value)
+{
+  size_t max = (1u << prefix) - 1;
+  unsigned shift = 0;
+
+  if (*p == end) {
+    return false;
+  }
+
+  *value = *(*p)++ & max;
+
+  if (*value < max) {
+    return true;
+  }
+
+  do {
+    if (*p == end || shift > 21) {
+      return false;
+    }
+
+    *value += (size_t)(**p & 0x7f) << shift;
+    shift += 7;
+  } while (*(*p)++ & 0x80);
+
+  return true;
+}
+
+// Unknown symbols & broken padding leave an empty string
+static void
+huffman_decode(const uint8_t* in, size_t len, char* out, size_t out_len)
+{
+  uint32_t code = 0, first = 0;
+  unsigned length = 0;
+  size_t written = 0;
+
+  for (size_t i = 0; i < len * 8; ++i) {
+    const char* symbols;
+
+    code = code << 1 | ((in[i / 8] >> (7 - i % 8)) & 1);
+    symbols = huffman_symbols[length];
+    first = (first + (symbols != NULL ? strlen(symbols) : 0)) << 1;
+    length++;
+    symbols = huffman_symbols[length];
+
+    if (symbols != NULL && code - first < strlen(symbols)) {
+      if (symbols[code - first] == HUFFMAN_UNKNOWN) {
+        break;
+      }
+
+      if (written + 1 < out_len) {
+        out[written++] = symbols[code - first];
+      }
+
+      code = first = length = 0;
+    } else if (length == HUFFMAN_MAX_LEN) {
+      break;
+    }
+  }
+
+  // Padding is the most significant bits of EOS, all ones
+  if (length > 7 || code != (1u << length) - 1) {
+    written = 0;
+  }
+
+  out[written] = '\0';
+}
+
+static bool
+hpack_string(const uint8_t** p, const uint8_t* end, char* out, size_t out_len)
+{
+  bool huffman;
+  size_t len;
+
+  if (*p == end) {
+    return false;
+  }
+
+  huffman = **p & 0x80;
+
+  if (!hpack_int(p, end, 7, &len) || len > (size_t)(end - *p)) {
+    return false;
+  }
+
+  if (huffman) {
+    huffman_decode(*p, len, out, out_len);
+  } else {
+    size_t copied = len < out_len - 1 ? len : out_len - 1;
+
+    memcpy(out, *p, copied);
+    out[copied] = '\0';
+  }
+
+  *p += len;
+
+  return true;
+}
+
+static void
+on_header(probe_grpc_t* grpc, const char* name, const char* value)
+{
+  if (strcmp(name, ":status") == 0) {
+    grpc->info.http_status = (uint32_t)strtoul(value, NULL, 10);
+  } else if (strcmp(name, "grpc-status") == 0) {
+    grpc->info.grpc_status = (int32_t)strtol(value, NULL, 10);
+  } else if (strcmp(name, "grpc-message") == 0) {
+    snprintf(grpc->info.message, GRPC_MESSAGE_LEN, "%s", value);
+  }
+}
+
+// Only the headers with a static table name or a literal one are of
+// interest, the dynamic table is disabled by our SETTINGS
+static bool
+decode_block(probe_grpc_t* grpc)
+{
+  const uint8_t* p = grpc->block;
+  const uint8_t* end = p + grpc->block_len;
+  char name[GRPC_HEADER_NAME_LEN], value[GRPC_MESSAGE_LEN];
+  size_t index;
+
+  while (p < end) {
+    if (*p & 0x80) {
+      if (!hpack_int(&p, end, 7, &index)) {
+        return false;
+      }
+
+      if (index >= HPACK_STATUS_FIRST && index <= HPACK_STATUS_LAST) {
+        on_header(grpc, ":status", status_values[index - HPACK_STATUS_FIRST]);
+      }
+
+      continue;
+    }
+
+    // Dynamic table size update
+    if ((*p & 0xe0) == 0x20) {
+      if (!hpack_int(&p, end, 5, &index)) {
+        return false;
+      }
+
+      continue;
+    }
+
+    if (!hpack_int(&p, end, *p & 0x40 ? 6 : 4, &index)) {
+      return false;
+    }
+
+    if (index == 0) {
+      if (!hpack_string(&p, end, name, sizeof(name))) {
+        return false;
+      }
+    } else {
+      snprintf(name,
+               sizeof(name),
+               "%s",
+               index >= HPACK_STATUS_FIRST && index <= HPACK_STATUS_LAST
+                 ? ":status"
+                 : "");
+    }
+
+    if (!hpack_string(&p, end, value, sizeof(value))) {
+      return false;
+    }
+
+    on_header(grpc, name, value);
+  }
+
+  return true;
+}
+
+// Payload without padding & priority
+static bool
+frame_content(probe_grpc_t* grpc, const uint8_t** content, size_t* len)
+{
+  size_t skip = 0, pad = 0;
+
+  if (grpc->flags & H2_PADDED) {
+    if (grpc->frame_len < 1) {
+      return false;
+    }
+
+    pad = grpc->payload[0];
+    skip = 1;
+  }
+
+  if (grpc->type == H2_HEADERS && grpc->flags & H2_PRIORITY) {
+    skip += 5;
+  }
+
+  if (skip + pad > grpc->frame_len) {
+    return false;
+  }
+
+  *content = grpc->payload + skip;
+  *len = grpc->frame_len - skip - pad;
+
+  return true;
+}
+
+static GRPC_STEP
+on_headers(probe_grpc_t* grpc)
+{
+  const uint8_t* content;
+  size_t len;
+
+  if (grpc->type == H2_HEADERS) {
+    grpc->block_len = 0;
+    grpc->end_stream = grpc->flags & H2_END_STREAM;
+  }
+
+  if (!frame_content(grpc, &content, &len)) {
+    return fail(grpc, "malformed HEADERS frame");
+  }
+
+  if (grpc->block_len + len > GRPC_BLOCK_LEN) {
+    return fail(grpc, "response headers are too large");
+  }
+
+  memcpy(grpc->block + grpc->block_len, content, len);
+  grpc->block_len += len;
+
+  if (!(grpc->flags & H2_END_HEADERS)) {
+    return GRPC_MORE;
+  }
+
+  if (!decode_block(grpc)) {
+    return fail(grpc, "malformed response headers");
+  }
+
+  return grpc->end_stream ? GRPC_DONE : GRPC_MORE;
+}
+
+static GRPC_STEP
+on_data(probe_grpc_t* grpc)
+{
+  const uint8_t* content;
+  size_t len;
+
+  if (!frame_content(grpc, &content, &len)) {
+    return fail(grpc, "malformed DATA frame");
+  }
+
+  if (grpc->response_len + len > GRPC_RESPONSE_LEN) {
+    return fail(grpc, "response is too large");
+  }
+
+  memcpy(grpc->response + grpc->response_len, content, len);
+  grpc->response_len += len;
+
+  return grpc->flags & H2_END_STREAM ? GRPC_DONE : GRPC_MORE;
+}
+
+static GRPC_STEP
+on_frame(probe_grpc_t* grpc)
+{
+  bool own = grpc->stream == H2_STREAM;
+
+  switch (grpc->type) {
+    case H2_SETTINGS: {
+      if (!(grpc->flags & H2_ACK)) {
+        reply(grpc, H2_SETTINGS, NULL, 0);
+      }
+
+      return GRPC_MORE;
+    }
+    case H2_PING: {
+      if (!(grpc->flags & H2_ACK) && grpc->frame_len == 8) {
+        reply(grpc, H2_PING, grpc->payload, 8);
+      }
+
+      return GRPC_MORE;
+    }
+    case H2_GOAWAY: {
+      return fail(grpc,
+                  "connection is refused, error %u",
+                  grpc->frame_len >= 8 ? read_u32(grpc->payload + 4) : 0);
+    }
+    case H2_RST_STREAM: {
+      return own ? fail(grpc,
+                        "call is reset, error %u",
+                        grpc->frame_len >= 4 ? read_u32(grpc->payload) : 0)
+                 : GRPC_MORE;
+    }
+    case H2_HEADERS:
+    case H2_CONTINUATION: {
+      return own ? on_headers(grpc) : GRPC_MORE;
+    }
+    case H2_DATA: {
+      return own ? on_data(grpc) : GRPC_MORE;
+    }
+    default: {
+      return GRPC_MORE;
+    }
+  }
+}
+
+static bool
+frame_kept(uint8_t type)
+{
+  return type == H2_HEADERS || type == H2_CONTINUATION || type == H2_DATA ||
+         type == H2_PING || type == H2_GOAWAY || type == H2_RST_STREAM;
+}
+
+// Frames may arrive split at any byte
+static GRPC_STEP
+feed(probe_grpc_t* grpc, const uint8_t* data, size_t len)
+{
+  while (len > 0) {
+    size_t n;
+
+    if (grpc->head_len < H2_FRAME_HEADER_LEN) {
+      n = H2_FRAME_HEADER_LEN - grpc->head_len;
+      n = n < len ? n : len;
+      memcpy(grpc->head + grpc->head_len, data, n);
+      grpc->head_len += n;
+      data += n;
+      len -= n;
+
+      if (grpc->head_len < H2_FRAME_HEADER_LEN) {
+        break;
+      }
+
+      grpc->frame_len = read_u32(grpc->head) >> 8;
+      grpc->type = grpc->head[3];
+      grpc->flags = grpc->head[4];
+      grpc->stream = read_u32(grpc->head + 5) & 0x7fffffff;
+      grpc->payload_len = 0;
+
+      // Server preface starts with SETTINGS
+      if (!grpc->settled && grpc->type != H2_SETTINGS) {
+        return fail(grpc, "not an HTTP/2 server");
+      }
+
+      grpc->settled = true;
+
+      if (frame_kept(grpc->type) && grpc->frame_len > GRPC_FRAME_LEN) {
+        return fail(grpc, "frame is too large");
+      }
+    }
+
+    n = grpc->frame_len - grpc->payload_len;
+    n = n < len ? n : len;
+
+    if (frame_kept(grpc->type)) {
+      memcpy(grpc->payload + grpc->payload_len, data, n);
+    }
+
+    grpc->payload_len += n;
+    data += n;
+    len -= n;
+
+    if (grpc->payload_len == grpc->frame_len) {
+      GRPC_STEP step = on_frame(grpc);
+
+      grpc->head_len = 0;
+
+      if (step != GRPC_MORE) {
+        return step;
+      }
+    }
+  }
+
+  return GRPC_MORE;
+}
+
+static bool
+send_all(socket_t sock, const uint8_t* data, size_t len)
+{
+  while (len > 0) {
+    ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (sent <= 0) {
+      return false;
+    }
+
+    data += sent;
+    len -= (size_t)sent;
+  }
+
+  return true;
+}
+
+static bool
+read_varint(const uint8_t** p, const uint8_t* end, uint64_t* value)
+{
+  *value = 0;
+
+  for (unsigned shift = 0; *p < end && shift < 64; shift += 7) {
+    uint8_t byte = *(*p)++;
+
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Length-prefixed `HealthCheckResponse`, -1 when malformed
+static int32_t
+serving_status(const uint8_t* response, size_t len)
+{
+  const uint8_t *p = response + 5, *end = response + len;
+  uint64_t key, value;
+  int32_t status = GRPC_UNKNOWN;
+
+  // Compressed messages aren't accepted, so never sent
+  if (len < 5 || response[0] != 0 || read_u32(response + 1) != len - 5) {
+    return -1;
+  }
+
+  while (p < end) {
+    if (!read_varint(&p, end, &key)) {
+      return -1;
+    }
+
+    switch (key & 7) {
+      case 0: {
+        if (!read_varint(&p, end, &value)) {
+          return -1;
+        }
+
+        if (key >> 3 == 1) {
+          status = (int32_t)value;
+        }
+
+        break;
+      }
+      case 1: {
+        value = 8;
+        break;
+      }
+      case 2: {
+        if (!read_varint(&p, end, &value)) {
+          return -1;
+        }
+
+        break;
+      }
+      case 5: {
+        value = 4;
+        break;
+      }
+      default: {
+        return -1;
+      }
+    }
+
+    if ((key & 7) != 0) {
+      if (value > (uint64_t)(end - p)) {
+        return -1;
+      }
+
+      p += value;
+    }
+  }
+
+  return status;
+}
+
+probe_grpc_t*
+probe_grpc_new(const char* authority,
+               const struct sockaddr* peer,
+               const char* service)
+{
+  char addr[INET6_ADDRSTRLEN + 8];
+  probe_grpc_t* grpc;
+
+  if (authority == NULL) {
+    const struct sockaddr_in* in = (const struct sockaddr_in*)peer;
+    const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)peer;
+    char ip[INET6_ADDRSTRLEN];
+
+    // What gRPC clients send over Unix sockets
+    if (peer->sa_family == AF_UNIX) {
+      snprintf(addr, sizeof(addr), "localhost");
+    } else if (peer->sa_family == AF_INET6) {
+      inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+      snprintf(addr, sizeof(addr), "[%s]:%u", ip, ntohs(in6->sin6_port));
+    } else {
+      inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+      snprintf(addr, sizeof(addr), "%s:%u", ip, ntohs(in->sin_port));
+    }
+
+    authority = addr;
+  }
+
+  if (service == NULL) {
+    service = "";
+  }
+
+  if (strlen(authority) > GRPC_NAME_MAX || strlen(service) > GRPC_NAME_MAX ||
+      (grpc = calloc(1, sizeof(probe_grpc_t))) == NULL) {
+    return NULL;
+  }
+
+  grpc->info.grpc_status = -1;
+  grpc->info.serving_status = -1;
+  build_request(grpc, authority, service);
+
+  return grpc;
+}
+
+GRPC_STEP
+probe_grpc_start(probe_grpc_t* grpc, socket_t sock)
+{
+  if (!send_all(sock, grpc->request, grpc->request_len)) {
+    return fail(grpc, "call can't be sent");
+  }
+
+  return GRPC_MORE;
+}
+
+GRPC_STEP
+probe_grpc_receive(probe_grpc_t* grpc, socket_t sock)
+{
+  uint8_t buf[GRPC_FRAME_LEN];
+  GRPC_STEP step = GRPC_MORE;
+
+  while (step == GRPC_MORE) {
+    ssize_t received = recv(sock, buf, sizeof(buf), 0);
+
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+
+    if (received <= 0) {
+      return fail(grpc, "connection is closed before the response");
+    }
+
+    step = feed(grpc, buf, (size_t)received);
+
+    if (grpc->reply_len > 0) {
+      send_all(sock, grpc->reply, grpc->reply_len);
+      grpc->reply_len = 0;
+    }
+  }
+
+  return step;
+}
+
+SERVICE_STATE
+probe_grpc_verdict(probe_grpc_t* grpc, GRPC_STEP step, probe_grpc_info_t* info)
+{
+  if (grpc == NULL) {
+    memset(info, 0, sizeof(probe_grpc_info_t));
+    info->grpc_status = info->serving_status = -1;
+    snprintf(info->message, GRPC_MESSAGE_LEN, "call doesn't fit a request");
+    return NOT_SERVING;
+  }
+
+  *info = grpc->info;
+
+  if (step == GRPC_MORE) {
+    snprintf(info->message, GRPC_MESSAGE_LEN, "health check timed out");
+  }
+
+  if (step != GRPC_DONE) {
+    return NOT_SERVING;
+  }
+
+  info->valid = true;
+  info->serving_status =
+    grpc->response_len != 0
+      ? serving_status(grpc->response, grpc->response_len)
+      : -1;
+
+  if (info->grpc_status != 0) {
+    // Trailers-only response of a failed call keeps its `grpc-message`
+    if (info->message[0] == '\0' && info->grpc_status < 0) {
+      snprintf(info->message,
+               GRPC_MESSAGE_LEN,
+               "no gRPC status, HTTP status %u",
+               info->http_status);
+    } else if (info->message[0] == '\0') {
+      snprintf(
+        info->message, GRPC_MESSAGE_LEN, "gRPC status %d", info->grpc_status);
+    }
+
+    return NOT_SERVING;
+  }
+
+  if (info->serving_status >= GRPC_UNKNOWN &&
+      info->serving_status <= GRPC_SERVICE_UNKNOWN) {
+    snprintf(info->message,
+             GRPC_MESSAGE_LEN,
+             "%s",
+             serving_names[info->serving_status]);
+  } else {
+    snprintf(info->message, GRPC_MESSAGE_LEN, "malformed response");
+  }
+
+  return info->serving_status == GRPC_SERVING ? AVAILABLE : NOT_SERVING;
+}
+
+void
+probe_grpc_free(probe_grpc_t* grpc)
+{
+  free(grpc);
+}
@@ -0,0 +1,45 @@
+#ifndef PROBE_GRPC_H
+#define PROBE_GRPC_H
+
+// Just enough HTTP/2 for one unary `grpc.health.v1.Health/Check` call over
+// a connected socket, memory is fixed per call
+
+#include "probe.h"
+#include <sys/socket.h>
+
+typedef struct probe_grpc probe_grpc_t;
+
+typedef enum GRPC_STEP
+{
+  // Response isn't complete yet
+  GRPC_MORE,
+  GRPC_DONE,
+  GRPC_FAILED,
+} GRPC_STEP;
+
+// `authority` defaults to the `peer` address when NULL. Returns NULL when
+// the names don't fit the request
+probe_grpc_t*
+probe_grpc_new(const char* authority,
+               const struct sockaddr* peer,
+               const char* service);
+
+// Sends the connection preface & the call, a non blocking socket has room
+// for it right after connect
+GRPC_STEP
+probe_grpc_start(probe_grpc_t* grpc, socket_t sock);
+
+// Reads what has arrived, blocking sockets till the response is complete
+// or the receive timeout. Answers the server SETTINGS & PING on the way
+GRPC_STEP
+probe_grpc_receive(probe_grpc_t* grpc, socket_t sock);
+
+// Fills `info` after the last `step`, `grpc` may be NULL when creation
+// failed. Returns the probe verdict
+SERVICE_STATE
+probe_grpc_verdict(probe_grpc_t* grpc, GRPC_STEP step, probe_grpc_info_t* info);
+
+void
+probe_grpc_free(probe_grpc_t* grpc);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef PROBE_INTERNAL_H
+#define PROBE_INTERNAL_H
+
+// Helpers shared between library translation units, not a public API
+
+#include "probe.h"
+#include <sys/socket.h>
+
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define NS_IN_MS 1000000ull
+
+uint64_t
+probe_now_ns();
+
+// Accounts the time passed since `start` to `phase` and returns the current
+// timestamp, so consecutive phases can be chained without extra clock reads
+uint64_t
+probe_phase_end(probe_result_t* result,
+                PROBE_PHASE phase,
+                size_t attempt,
+                uint64_t start,
+                int error);
+
+void
+probe_read_tcp_info(socket_t sock, probe_tcp_info_t* info);
+
+const probe_conf_t*
+probe_current_config();
+
+// Unix socket address of `path`, a leading `@` is the abstract namespace.
+// False when the path is empty or too long
+bool
+probe_unix_addr(const char* path,
+                struct sockaddr_storage* addr,
+                socklen_t* addrlen);
+
+#endif
@@ -0,0 +1,496 @@
+#include "limit.h"
+#include "internal.h"
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+
+#define NS_IN_S 1000000000ull
+#define NIL UINT32_MAX
+// Narrowed caps grow back by one a second on top of the successes
+#define RECOVERY_NS NS_IN_S
+
+typedef struct limit_key
+{
+  uint64_t hi;
+  uint64_t lo;
+} limit_key_t;
+
+// A destination with attempts in flight or queued, idle ones are removed
+// unless their cap is still narrowed
+typedef struct limit_entry
+{
+  limit_key_t key;
+  bool used;
+  // Its key is in the kept ring
+  bool kept;
+  uint32_t inflight;
+  // Adaptive cap, never above the configured one
+  uint32_t limit;
+  // Last change of the cap, the recovery counts from it
+  uint64_t changed_ns;
+  uint32_t head;
+  uint32_t tail;
+} limit_entry_t;
+
+// Open addressing with linear probing, at most one entry per attempt and as
+// many kept ones keep the load under a half
+typedef struct limit_table
+{
+  limit_entry_t* entries;
+  size_t mask;
+  uint32_t cap;
+  // Keys of the idle narrowed entries oldest first, the oldest one is
+  // forgotten to make room
+  limit_key_t* kept;
+  size_t kept_first;
+  size_t kept_count;
+  size_t kept_max;
+} limit_table_t;
+
+struct probe_limiter
+{
+  // GCRA: theoretical arrival time of the next attempt
+  uint64_t tat;
+  uint64_t interval_ns;
+  uint64_t tolerance_ns;
+  bool adaptive;
+  limit_table_t hosts;
+  limit_table_t subnets;
+  // Queue links of the ids
+  uint32_t* next;
+  size_t capacity;
+};
+
+static uint64_t
+hash_key(limit_key_t key)
+{
+  uint64_t x = key.hi * 0x9e3779b97f4a7c15ull ^ key.lo;
+
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+
+  return x;
+}
+
+static void
+addr_keys(const struct sockaddr_storage* addr,
+          limit_key_t* host,
+          limit_key_t* subnet)
+{
+  if (addr->ss_family == AF_INET6) {
+    const uint8_t* bytes = ((struct sockaddr_in6*)addr)->sin6_addr.s6_addr;
+
+    memcpy(&host->hi, bytes, sizeof(uint64_t));
+    memcpy(&host->lo, bytes + sizeof(uint64_t), sizeof(uint64_t));
+    subnet->hi = host->hi;
+    subnet->lo = 0;
+  } else if (addr->ss_family == AF_UNIX) {
+    // Every socket is a subnet of its own, paths are told apart by FNV-1a
+    const struct sockaddr_un* un = (const struct sockaddr_un*)addr;
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < sizeof(un->sun_path); ++i) {
+      hash = (hash ^ (uint8_t)un->sun_path[i]) * 0x100000001b3ull;
+    }
+
+    host->hi = subnet->hi = hash;
+    host->lo = subnet->lo = AF_UNIX;
+  } else {
+    uint32_t ip = ntohl(((struct sockaddr_in*)addr)->sin_addr.s_addr);
+
+    host->hi = subnet->hi = 0;
+    host->lo = ip;
+    subnet->lo = ip & 0xffffff00u;
+  }
+}
+
+static bool
+table_init(limit_table_t* table, size_t capacity, uint32_t cap, bool adaptive)
+{
+  size_t size = 2;
+
+  table->cap = cap;
+
+  if (cap == 0) {
+    return true;
+  }
+
+  if (adaptive) {
+    table->kept_max = capacity;
+    table->kept = calloc(capacity, sizeof(limit_key_t));
+
+    if (table->kept == NULL) {
+      return false;
+    }
+  }
+
+  while (size < (capacity + table->kept_max) * 2) {
+    size <<= 1;
+  }
+
+  table->mask = size - 1;
+  table->entries = calloc(size, sizeof(limit_entry_t));
+
+  return table->entries != NULL;
+}
+
+static limit_entry_t*
+table_find(limit_table_t* table, limit_key_t key)
+{
+  size_t i = hash_key(key) & table->mask;
+
+  for (; table->entries[i].used; i = (i + 1) & table->mask) {
+    limit_entry_t* entry = &table->entries[i];
+
+    if (entry->key.hi == key.hi && entry->key.lo == key.lo) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+// Existing entry of `key` or a new one with the configured cap
+static limit_entry_t*
+table_get(limit_table_t* table, limit_key_t key)
+{
+  size_t i = hash_key(key) & table->mask;
+
+  for (;; i = (i + 1) & table->mask) {
+    limit_entry_t* entry = &table->entries[i];
+
+    if (!entry->used) {
+      entry->used = true;
+      entry->kept = false;
+      entry->key = key;
+      entry->inflight = 0;
+      entry->limit = table->cap;
+      entry->changed_ns = 0;
+      entry->head = entry->tail = NIL;
+
+      return entry;
+    }
+
+    if (entry->key.hi == key.hi && entry->key.lo == key.lo) {
+      return entry;
+    }
+  }
+}
+
+// Backward shift deletion keeps the probe sequences intact without
+// tombstones
+static void
+table_remove(limit_table_t* table, limit_entry_t* entry)
+{
+  size_t hole = (size_t)(entry - table->entries);
+
+  for (size_t i = (hole + 1) & table->mask; table->entries[i].used;
+       i = (i + 1) & table->mask) {
+    size_t home = hash_key(table->entries[i].key) & table->mask;
+
+    // Moves back unless its home is cyclically within `(hole, i]`
+    if (((i - home) & table->mask) >= ((i - hole) & table->mask)) {
+      table->entries[hole] = table->entries[i];
+      hole = i;
+    }
+  }
+
+  table->entries[hole].used = false;
+}
+
+// Kept idle entry of `key` with its narrowed cap, pointers into the table
+// are invalid afterwards
+static void
+table_keep(limit_table_t* table, limit_key_t key)
+{
+  limit_entry_t* entry;
+
+  if (table->kept_count == table->kept_max) {
+    limit_entry_t* oldest = table_find(table, table->kept[table->kept_first]);
+
+    table->kept_first = (table->kept_first + 1) % table->kept_max;
+    table->kept_count--;
+
+    // Busy ones are kept again when idle
+    if (oldest != NULL && oldest->kept) {
+      oldest->kept = false;
+
+      if (oldest->inflight == 0 && oldest->head == NIL) {
+        table_remove(table, oldest);
+      }
+    }
+  }
+
+  entry = table_find(table, key);
+  entry->kept = true;
+  table->kept[(table->kept_first + table->kept_count++) % table->kept_max] =
+    key;
+}
+
+// Idle entries are removed, narrowed ones are kept till they recover
+static void
+table_idle(limit_table_t* table, limit_entry_t* entry)
+{
+  if (entry->inflight != 0 || entry->head != NIL) {
+    return;
+  }
+
+  if (entry->limit >= table->cap) {
+    table_remove(table, entry);
+  } else if (!entry->kept) {
+    table_keep(table, entry->key);
+  }
+}
+
+static void
+table_recover(limit_table_t* table, limit_entry_t* entry, uint64_t now_ns)
+{
+  uint64_t steps;
+
+  if (entry->limit >= table->cap || now_ns < entry->changed_ns) {
+    return;
+  }
+
+  steps = (now_ns - entry->changed_ns) / RECOVERY_NS;
+
+  if (steps >= table->cap - entry->limit) {
+    entry->limit = table->cap;
+  } else {
+    entry->limit += (uint32_t)steps;
+    entry->changed_ns += steps * RECOVERY_NS;
+  }
+}
+
+static void
+enqueue(probe_limiter_t* limiter, limit_entry_t* entry, uint32_t id)
+{
+  limiter->next[id] = NIL;
+
+  if (entry->tail == NIL) {
+    entry->head = id;
+  } else {
+    limiter->next[entry->tail] = id;
+  }
+
+  entry->tail = id;
+}
+
+static void
+table_release(probe_limiter_t* limiter,
+              limit_table_t* table,
+              limit_key_t key,
+              bool failed,
+              uint64_t now_ns,
+              probe_timer_fn wake,
+              void* data)
+{
+  limit_entry_t* entry;
+  uint32_t room;
+
+  if (table->cap == 0) {
+    return;
+  }
+
+  entry = table_get(table, key);
+  entry->inflight--;
+
+  // Multiplicative decrease, additive increase
+  if (limiter->adaptive && failed) {
+    table_recover(table, entry, now_ns);
+    entry->limit = entry->limit > 1 ? entry->limit / 2 : 1;
+    entry->changed_ns = now_ns;
+  } else if (limiter->adaptive && entry->limit < table->cap) {
+    table_recover(table, entry, now_ns);
+    entry->limit += entry->limit < table->cap ? 1 : 0;
+    entry->changed_ns = now_ns;
+  }
+
+  // A raised cap lets in several ids at once. Woken ids acquire again later,
+  // so they are counted against the free room here
+  room = entry->inflight < entry->limit ? entry->limit - entry->inflight : 0;
+
+  if (entry->head == NIL || room == 0) {
+    table_idle(table, entry);
+    return;
+  }
+
+  while (entry->head != NIL && room-- > 0) {
+    uint32_t id = entry->head;
+
+    entry->head = limiter->next[id];
+
+    if (entry->head == NIL) {
+      entry->tail = NIL;
+    }
+
+    wake(id, data);
+  }
+}
+
+probe_limiter_t*
+probe_limiter_create(size_t capacity, const probe_engine_conf_t* conf)
+{
+  probe_limiter_t* limiter;
+
+  if (conf->rate == 0 && conf->per_host == 0 && conf->per_subnet == 0) {
+    return NULL;
+  }
+
+  limiter = calloc(1, sizeof(probe_limiter_t));
+
+  if (limiter == NULL) {
+    return NULL;
+  }
+
+  limiter->capacity = capacity;
+  limiter->adaptive = conf->adaptive;
+  limiter->next = calloc(capacity, sizeof(uint32_t));
+
+  if (conf->rate != 0) {
+    limiter->interval_ns = NS_IN_S / conf->rate;
+    limiter->tolerance_ns =
+      limiter->interval_ns * (conf->burst > 1 ? conf->burst - 1 : 0);
+  }
+
+  if (limiter->next == NULL ||
+      !table_init(&limiter->hosts, capacity, conf->per_host, conf->adaptive) ||
+      !table_init(
+        &limiter->subnets, capacity, conf->per_subnet, conf->adaptive)) {
+    probe_limiter_destroy(limiter);
+    return NULL;
+  }
+
+  return limiter;
+}
+
+void
+probe_limiter_destroy(probe_limiter_t* limiter)
+{
+  if (limiter == NULL) {
+    return;
+  }
+
+  free(limiter->subnets.kept);
+  free(limiter->subnets.entries);
+  free(limiter->hosts.kept);
+  free(limiter->hosts.entries);
+  free(limiter->next);
+  free(limiter);
+}
+
+LIMIT_STATE
+probe_limiter_acquire(probe_limiter_t* limiter,
+                      uint32_t id,
+                      const struct sockaddr_storage* addr,
+                      uint64_t now_ns,
+                      uint64_t* retry_ns)
+{
+  limit_entry_t *host = NULL, *subnet = NULL;
+  limit_key_t host_key, subnet_key;
+
+  addr_keys(addr, &host_key, &subnet_key);
+
+  if (limiter->hosts.cap != 0) {
+    host = table_get(&limiter->hosts, host_key);
+    table_recover(&limiter->hosts, host, now_ns);
+
+    if (host->inflight >= host->limit) {
+      enqueue(limiter, host, id);
+      return LIMIT_QUEUED;
+    }
+  }
+
+  if (limiter->subnets.cap != 0) {
+    subnet = table_get(&limiter->subnets, subnet_key);
+    table_recover(&limiter->subnets, subnet, now_ns);
+
+    if (subnet->inflight >= subnet->limit) {
+      // Tables are separate, `host` is still valid
+      if (host != NULL) {
+        table_idle(&limiter->hosts, host);
+      }
+
+      enqueue(limiter, subnet, id);
+      return LIMIT_QUEUED;
+    }
+  }
+
+  if (limiter->interval_ns != 0) {
+    uint64_t tat = limiter->tat > now_ns ? limiter->tat : now_ns;
+
+    if (tat > now_ns + limiter->tolerance_ns) {
+      *retry_ns = tat - limiter->tolerance_ns;
+
+      // Entries created above must not stay idle
+      if (subnet != NULL) {
+        table_idle(&limiter->subnets, subnet);
+      }
+
+      if (host != NULL) {
+        table_idle(&limiter->hosts, host);
+      }
+
+      return LIMIT_PACED;
+    }
+
+    limiter->tat = tat + limiter->interval_ns;
+  }
+
+  if (host != NULL) {
+    host->inflight++;
+  }
+
+  if (subnet != NULL) {
+    subnet->inflight++;
+  }
+
+  return LIMIT_PASS;
+}
+
+void
+probe_limiter_release(probe_limiter_t* limiter,
+                      const struct sockaddr_storage* addr,
+                      bool failed,
+                      uint64_t now_ns,
+                      probe_timer_fn wake,
+                      void* data)
+{
+  limit_key_t host_key, subnet_key;
+
+  addr_keys(addr, &host_key, &subnet_key);
+  table_release(
+    limiter, &limiter->hosts, host_key, failed, now_ns, wake, data);
+  table_release(
+    limiter, &limiter->subnets, subnet_key, failed, now_ns, wake, data);
+}
+
+uint64_t
+probe_limiter_hash(const probe_engine_conf_t* conf,
+                   const struct sockaddr_storage* addr)
+{
+  limit_key_t host_key, subnet_key;
+
+  addr_keys(addr, &host_key, &subnet_key);
+
+  return hash_key(conf->per_subnet != 0 ? subnet_key : host_key);
+}
+
+void
+probe_limiter_reset(probe_limiter_t* limiter)
+{
+  if (limiter->hosts.cap != 0) {
+    memset(limiter->hosts.entries,
+           0,
+           (limiter->hosts.mask + 1) * sizeof(limit_entry_t));
+    limiter->hosts.kept_count = 0;
+  }
+
+  if (limiter->subnets.cap != 0) {
+    memset(limiter->subnets.entries,
+           0,
+           (limiter->subnets.mask + 1) * sizeof(limit_entry_t));
+    limiter->subnets.kept_count = 0;
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef PROBE_LIMIT_H
+#define PROBE_LIMIT_H
+
+#include "engine.h"
+#include "wheel.h"
+
+// Connect attempt limits of an engine: a token bucket for the attempt rate
+// and caps of attempts in flight to one address & one /24 (/64 for IPv6).
+// Attempts are identified by `[0, capacity)` ids like the wheel timers
+typedef struct probe_limiter probe_limiter_t;
+
+typedef enum LIMIT_STATE
+{
+  LIMIT_PASS,
+  // Destination is busy, the id is handed back by `probe_limiter_release`
+  LIMIT_QUEUED,
+  // Out of tokens, retry later
+  LIMIT_PACED,
+} LIMIT_STATE;
+
+// NULL when `conf` has no limits
+probe_limiter_t*
+probe_limiter_create(size_t capacity, const probe_engine_conf_t* conf);
+
+void
+probe_limiter_destroy(probe_limiter_t* limiter);
+
+// Takes the slots of `addr` on pass. When paced `retry_ns` is the time a
+// token becomes available
+LIMIT_STATE
+probe_limiter_acquire(probe_limiter_t* limiter,
+                      uint32_t id,
+                      const struct sockaddr_storage* addr,
+                      uint64_t now_ns,
+                      uint64_t* retry_ns);
+
+// Frees the slots of `addr`, `failed` attempts narrow the destination caps
+// when adaptive. Narrowed caps outlive the attempts and grow back by one on
+// success & every second. Queued ids that may try again are passed to `wake`
+void
+probe_limiter_release(probe_limiter_t* limiter,
+                      const struct sockaddr_storage* addr,
+                      bool failed,
+                      uint64_t now_ns,
+                      probe_timer_fn wake,
+                      void* data);
+
+// Hash of the destination of `addr` the caps of `conf` are counted on: its
+// /24 (/64) when subnets are capped, the address otherwise
+uint64_t
+probe_limiter_hash(const probe_engine_conf_t* conf,
+                   const struct sockaddr_storage* addr);
+
+// Forgets every slot & queued id
+void
+probe_limiter_reset(probe_limiter_t* limiter);
+
+#endif
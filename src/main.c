@@ -1,12 +1,31 @@
+#include "cache.h"
+#include "damping.h"
+#include "engine.h"
 #include "probe.h"
+#include "scheduler.h"
+#include "sweep.h"
+#include "table.h"
+#include "wait.h"
+#include <arpa/inet.h>
 #include <getopt.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <regex.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 #define MAX_OPT_LEN_LIM 255
+#define MAX_ACTIVE_PROBES 1024
+// Lookups of the targets run at once
+#define MAX_RESOLVERS 64
+// Same order of range targets on every run
+#define RANGE_SEED 0
+#define UNIX_PREFIX "unix:"
 
 regex_t regex;
 char* ip_re =
@@ -14,10 +33,22 @@ char* ip_re =
   "01]?[0-9][0-9]?)\\.(25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\\.(25[0-"
   "5]|2[0-4][0-9]|[01]?[0-9][0-9]?)$";
 
-char host_or_ip[MAX_OPT_LEN_LIM], service[MAX_OPT_LEN_LIM];
+char host_or_ip[MAX_OPT_LEN_LIM], service[MAX_OPT_LEN_LIM],
+  require[MAX_OPT_LEN_LIM], cache_path[MAX_OPT_LEN_LIM],
+  server_name[MAX_OPT_LEN_LIM], ca_file[MAX_OPT_LEN_LIM],
+  grpc_service[MAX_OPT_LEN_LIM], targets_path[MAX_OPT_LEN_LIM];
 in_port_t port;
 size_t retry = DEFAULT_RETRY_COUNT, timeout = DEFAULT_TIMEOUT;
+uint32_t interval, jitter, rate, per_host, per_subnet, expiry_days;
+uint64_t wait_timeout;
+bool timings, tcp_info, tls, grpc, seqpacket, wait_mode, events;
+probe_damping_conf_t damping;
+// Set by `SIGUSR1`, recent verdicts are printed on the next check
+volatile sig_atomic_t history_requested;
+// Run once every target is available, see `--wait`
+char** command;
 SERVICE_STATE service_state;
+probe_result_t result;
 
 static char* help_msg =
   "Simplest possible solution to check service availability.\n\n"
@@ -29,31 +60,911 @@ static char* help_msg =
   "`timeout` tells.\n"
   "On success probe will return `0` and `1` on failure.\n\n"
   "Don't use the `0.0.0.0` address.\n\n"
-  "Usage: probe [OPTIONS] [HOST]\n\n"
-  "\tHOST - host to connect to\n\n"
+  "Usage: probe [OPTIONS] [HOST]\n"
+  "       probe [OPTIONS] [HOST:PORT|HOST:SERVICE]...\n"
+  "       probe [OPTIONS] [ADDRESS/PREFIX:PORTS]...\n"
+  "       probe [OPTIONS] [unix:PATH|unix:@NAME]...\n"
+  "       probe --file=PATH [OPTIONS] [TARGET]...\n"
+  "       probe --wait=MS [OPTIONS] [TARGET]... [-- COMMAND [ARGS]...]\n\n"
+  "\tHOST - host to connect to\n"
+  "\tHOST:PORT, HOST:SERVICE - dependencies probed concurrently, `--port` or "
+  "`--service` is used when omitted\n"
+  "\tADDRESS/PREFIX:PORTS - every address of the subnet (`[IPV6]/PREFIX` "
+  "for IPv6) & ports like `80,443,8000-8100` swept in a random order\n"
+  "\tunix:PATH, unix:@NAME - Unix domain socket, `@` for the abstract "
+  "namespace\n\n"
   "Options:\n"
   "\t-s, --service\t\t - service to connect to\n"
   "\t-p, --port\t\t - port to connect to\n"
   "\t-r, --retry\t\t - retry count\n"
   "\t-t, --timeout\t\t - timeout between retryings\n"
+  "\t-T, --timings\t\t - print time spent in every probe phase\n"
+  "\t-i, --tcp-info\t\t - print kernel TCP info of the connection\n"
+  "\t-q, --require\t\t - dependencies to be available: `all` (default), "
+  "`any` or `K/N`\n"
+  "\t-c, --cache\t\t - file to keep resolved addresses & last good one in "
+  "between runs, single target only\n"
+  "\t-I, --interval\t\t - probe continuously every that many milliseconds\n"
+  "\t-j, --jitter\t\t - random delay up to that many milliseconds added to "
+  "the interval\n"
+  "\t-R, --rate\t\t - connect attempts per second of concurrent probing\n"
+  "\t-H, --per-host\t\t - connect attempts in flight to one address\n"
+  "\t-S, --per-subnet\t - connect attempts in flight to one /24 (/64 for "
+  "IPv6)\n"
+  "\t-L, --tls\t\t - complete TLS handshake & verify the certificate\n"
+  "\t-N, --server-name\t - TLS server name, the host by default\n"
+  "\t-A, --ca-file\t\t - CA certificates to verify with instead of the "
+  "system ones\n"
+  "\t-D, --expiry-days\t - fail when the certificate expires sooner\n"
+  "\t-g, --grpc\t\t - gRPC health check over cleartext HTTP/2, available "
+  "when SERVING\n"
+  "\t-G, --grpc-service\t - service to check, the whole server by default\n"
+  "\t-P, --seqpacket\t\t - connect to Unix sockets as `SOCK_SEQPACKET`\n"
+  "\t-w, --wait\t\t - retry targets till all are available, up to that "
+  "many milliseconds (0 for no limit), then run the command after `--`\n"
+  "\t-E, --events\t\t - print state changes of `--interval` probing only, "
+  "`SIGUSR1` prints recent verdicts\n"
+  "\t-d, --down-after\t - consecutive failures to go down (1 by default)\n"
+  "\t-u, --up-after\t\t - consecutive successes to come up (1 by default)\n"
+  "\t-F, --damping\t\t - flap penalty half life in milliseconds, 0 to "
+  "report every change (30000 by default)\n"
+  "\t-f, --file\t\t - targets to sweep once, a spec per line, kept in a "
+  "compact table for lists of millions\n"
   "\t-h, --help\t\t - this help message\n"
   "\t-v, --version\t\t - current application version\n\n"
   "Examples:\n"
   "\tprobe --service=http localhost\n"
   "\tprobe --port=8080 localhost\n"
-  "\tprobe --timeout=3 --retry=5 --service=https example.com\n";
+  "\tprobe --timeout=3 --retry=5 --service=https example.com\n"
+  "\tprobe --require=2/3 db1:5432 db2:5432 db3:5432\n"
+  "\tprobe --interval=5000 --jitter=500 db1:5432 db2:5432 cache:6379\n"
+  "\tprobe --require=any 10.20.0.0/16:80,443,8000-8100\n"
+  "\tprobe --rate=1000 --per-host=4 --per-subnet=64 10.20.0.0/16:1-1024\n"
+  "\tprobe --tls --expiry-days=14 --service=https example.com\n"
+  "\tprobe --grpc --grpc-service=orders --port=50051 orders\n"
+  "\tprobe unix:/run/php-fpm.sock\n"
+  "\tprobe --seqpacket unix:@agent db:5432\n"
+  "\tprobe --wait=30000 db:5432 unix:/run/app.sock -- ./server --port=80\n"
+  "\tprobe --interval=1000 --events --down-after=3 --up-after=2 db:5432\n"
+  "\tprobe --file=targets.txt --rate=10000 --require=any\n";
 
-static char* short_options = "s:p:r:t:hv";
+static char* short_options =
+  "s:p:r:t:Tiq:c:I:j:R:H:S:LN:A:D:gG:Pw:Ed:u:F:f:hv";
 static struct option long_options[] = {
   { "service", required_argument, NULL, 's' },
   { "port", required_argument, NULL, 'p' },
   { "retry", required_argument, NULL, 'r' },
   { "timeout", required_argument, NULL, 't' },
+  { "timings", no_argument, NULL, 'T' },
+  { "tcp-info", no_argument, NULL, 'i' },
+  { "require", required_argument, NULL, 'q' },
+  { "cache", required_argument, NULL, 'c' },
+  { "interval", required_argument, NULL, 'I' },
+  { "jitter", required_argument, NULL, 'j' },
+  { "rate", required_argument, NULL, 'R' },
+  { "per-host", required_argument, NULL, 'H' },
+  { "per-subnet", required_argument, NULL, 'S' },
+  { "tls", no_argument, NULL, 'L' },
+  { "server-name", required_argument, NULL, 'N' },
+  { "ca-file", required_argument, NULL, 'A' },
+  { "expiry-days", required_argument, NULL, 'D' },
+  { "grpc", no_argument, NULL, 'g' },
+  { "grpc-service", required_argument, NULL, 'G' },
+  { "seqpacket", no_argument, NULL, 'P' },
+  { "wait", required_argument, NULL, 'w' },
+  { "events", no_argument, NULL, 'E' },
+  { "down-after", required_argument, NULL, 'd' },
+  { "up-after", required_argument, NULL, 'u' },
+  { "damping", required_argument, NULL, 'F' },
+  { "file", required_argument, NULL, 'f' },
   { "help", no_argument, NULL, 'h' },
   { "version", no_argument, NULL, 'v' },
   { 0, 0, 0, 0 }
 };
 
+static void
+print_timings(probe_result_t* result)
+{
+  probe_timings_t* t = &result->timings;
+
+  puts("Timings:");
+
+  for (PROBE_PHASE phase = 0; phase < PHASE_COUNT; ++phase) {
+    printf("\t%s: %.3f ms\n",
+           probe_phase_name(phase),
+           (double)t->phase_ns[phase] / 1e6);
+  }
+
+  for (size_t i = 0; i < t->attempts && i < MAX_TRACKED_ATTEMPTS; ++i) {
+    printf("\tconnect #%zu: %.3f ms\n", i + 1, (double)t->attempt_ns[i] / 1e6);
+  }
+
+  printf("\ttotal: %.3f ms\n", (double)t->total_ns / 1e6);
+}
+
+static void
+print_tcp_info(probe_result_t* result)
+{
+  probe_tcp_info_t* info = &result->tcp_info;
+
+  if (!info->valid) {
+    return;
+  }
+
+  puts("TCP info:");
+  printf("\trtt: %.3f ms\n", (double)info->rtt_us / 1e3);
+  printf("\trtt variance: %.3f ms\n", (double)info->rttvar_us / 1e3);
+  printf("\tretransmits: %u\n", info->retransmits);
+  printf("\tpmtu: %u\n", info->pmtu);
+  printf("\tmss: %u\n", info->snd_mss);
+  printf("\tcwnd: %u\n", info->snd_cwnd);
+}
+
+static void
+print_tls_info(probe_result_t* result)
+{
+  probe_tls_info_t* info = &result->tls;
+
+  if (!info->valid) {
+    return;
+  }
+
+  puts("TLS info:");
+  printf("\tversion: %s\n", info->version);
+  printf("\tcipher: %s\n", info->cipher);
+  printf("\tresumed: %s\n", info->resumed ? "yes" : "no");
+  printf("\tdays left: %lld\n", (long long)info->days_left);
+}
+
+// `all`, `any` or `K/N` where N is the number of dependencies
+static bool
+parse_require(char* value, size_t count, size_t* required)
+{
+  unsigned long k, n;
+  char* end;
+
+  if (strlen(value) == 0 || strcmp(value, "all") == 0) {
+    *required = count;
+    return true;
+  }
+
+  if (strcmp(value, "any") == 0) {
+    *required = 1;
+    return true;
+  }
+
+  k = strtoul(value, &end, 10);
+
+  if (end == value || *end != '/') {
+    return false;
+  }
+
+  value = end + 1;
+  n = strtoul(value, &end, 10);
+
+  if (end == value || *end != '\0' || n != count || k > n) {
+    return false;
+  }
+
+  *required = k;
+
+  return true;
+}
+
+// Resolves a HOST:PORT or HOST:SERVICE spec, `--port` or `--service` is used
+// when the spec has none. Unix socket specs need no lookups. The spec is
+// copied into `buf`, the TLS server name points into it
+static void
+target_init_spec(probe_target_t* target, const char* spec_arg, char* buf)
+{
+  char* spec = buf;
+  char port_str[8];
+
+  strncpy(spec, spec_arg, MAX_OPT_LEN_LIM);
+  spec[MAX_OPT_LEN_LIM] = '\0';
+
+  if (strncmp(spec, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+    probe_target_init_unix(target,
+                           spec + strlen(UNIX_PREFIX),
+                           seqpacket ? SOCK_SEQPACKET : SOCK_STREAM);
+    return;
+  }
+
+  char* host = spec;
+  char* target_service = strrchr(spec, ':');
+
+  // Colons of a bracketed IPv6 address don't separate the port
+  if (target_service != NULL && strchr(target_service, ']') != NULL) {
+    target_service = NULL;
+  }
+
+  if (target_service != NULL) {
+    *target_service++ = '\0';
+  } else if (strlen(service) != 0) {
+    target_service = service;
+  } else if (port != 0) {
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    target_service = port_str;
+  } else {
+    fprintf(stderr, "No port or service for \"%s\".\n", spec_arg);
+    exit(EXIT_FAILURE);
+  }
+
+  if (*host == '[') {
+    host++;
+    host[strcspn(host, "]")] = '\0';
+  }
+
+  probe_target_init(target, host, target_service, NULL);
+}
+
+typedef struct resolver
+{
+  probe_target_t* target;
+  char* spec;
+  pthread_t thread;
+} resolver_t;
+
+static void*
+resolve_spec(void* arg)
+{
+  resolver_t* resolver = arg;
+  probe_target_t* target = resolver->target;
+  char spec[MAX_OPT_LEN_LIM + 1];
+
+  target_init_spec(target, resolver->spec, spec);
+  target->data = resolver->spec;
+
+  // TLS server name has to outlive `spec`
+  if (target->server_name != NULL) {
+    target->server_name = strdup(target->server_name);
+  }
+
+  return NULL;
+}
+
+// Lookups are blocking, they run on threads of their own, so the time to
+// resolve all targets is the one of the slowest lookup
+static probe_target_t*
+targets_init(size_t count, char** specs)
+{
+  probe_target_t* targets = calloc(count, sizeof(probe_target_t));
+  resolver_t resolvers[MAX_RESOLVERS];
+
+  if (targets == NULL) {
+    perror("Targets allocation");
+    exit(EXIT_FAILURE);
+  }
+
+  if (count == 1) {
+    resolvers[0] = (resolver_t){ .target = targets, .spec = specs[0] };
+    resolve_spec(&resolvers[0]);
+
+    return targets;
+  }
+
+  for (size_t first = 0; first < count; first += MAX_RESOLVERS) {
+    size_t round = count - first < MAX_RESOLVERS ? count - first
+                                                 : MAX_RESOLVERS;
+
+    for (size_t i = 0; i < round; ++i) {
+      resolvers[i].target = &targets[first + i];
+      resolvers[i].spec = specs[first + i];
+
+      if (pthread_create(
+            &resolvers[i].thread, NULL, resolve_spec, &resolvers[i]) != 0) {
+        perror("Resolver creation");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    for (size_t i = 0; i < round; ++i) {
+      pthread_join(resolvers[i].thread, NULL);
+    }
+  }
+
+  return targets;
+}
+
+static void
+targets_free(probe_target_t* targets, size_t count)
+{
+  for (size_t i = 0; i < count; ++i) {
+    free((char*)targets[i].server_name);
+  }
+
+  free(targets);
+}
+
+static void
+print_target_state(probe_target_t* target)
+{
+  probe_result_t* result = &target->result;
+  char* spec = target->data;
+  double total_ms = (double)result->timings.total_ns / 1e6;
+
+  switch (result->state) {
+    case AVAILABLE: {
+      printf("\"%s\" is available (%.3f ms).\n", spec, total_ms);
+      break;
+    }
+    case UNAVAILABLE: {
+      fprintf(stderr, "\"%s\" is unavailable (%.3f ms).\n", spec, total_ms);
+      break;
+    }
+    case UNKNOWN_PROTOCOL: {
+      fprintf(stderr, "Protocol of \"%s\" is not supported.\n", spec);
+      break;
+    }
+    case UNKNOWN_HOST: {
+      fprintf(stderr, "Lookup for host of \"%s\" is failed.\n", spec);
+      break;
+    }
+    case UNKNOWN_SERVICE: {
+      fprintf(stderr, "Service of \"%s\" is not well known\n", spec);
+      break;
+    }
+    case CANCELLED: {
+      fprintf(
+        stderr, "\"%s\" is not probed to the end, quorum is decided.\n", spec);
+      break;
+    }
+    case HANDSHAKE_FAILED: {
+      fprintf(stderr,
+              "TLS handshake with \"%s\" is failed: %s.\n",
+              spec,
+              result->tls.error);
+      break;
+    }
+    case CERTIFICATE_EXPIRING: {
+      fprintf(stderr,
+              "Certificate of \"%s\" expires in %lld days.\n",
+              spec,
+              (long long)result->tls.days_left);
+      break;
+    }
+    case NOT_SERVING: {
+      fprintf(
+        stderr, "\"%s\" is not serving: %s.\n", spec, result->grpc.message);
+      break;
+    }
+    case INVALID_PATH: {
+      fprintf(stderr, "Socket path of \"%s\" is invalid.\n", spec);
+      break;
+    }
+    default: {
+      fprintf(stderr, "Unknown error %d\n", result->state);
+      break;
+    }
+  }
+}
+
+// `--timings`, `--tcp-info` & `--tls` details of a probed target
+static void
+print_target_details(probe_target_t* target)
+{
+  if (target->result.state == CANCELLED || target->addrlen == 0) {
+    return;
+  }
+
+  if (timings) {
+    print_timings(&target->result);
+  }
+
+  if (tcp_info) {
+    print_tcp_info(&target->result);
+  }
+
+  if (tls) {
+    print_tls_info(&target->result);
+  }
+}
+
+static int
+quorum_probe(size_t count, char** specs)
+{
+  probe_target_t* targets;
+  size_t required;
+  bool met;
+
+  if (!parse_require(require, count, &required)) {
+    fprintf(stderr,
+            "Require \"%s\" is invalid. Use `all`, `any` or `K/%zu`.\n",
+            require,
+            count);
+    exit(EXIT_FAILURE);
+  }
+
+  targets = targets_init(count, specs);
+  met = probe_quorum(targets, count, required);
+
+  for (size_t i = 0; i < count; ++i) {
+    print_target_state(&targets[i]);
+    print_target_details(&targets[i]);
+  }
+
+  if (met) {
+    printf("Quorum %zu/%zu is met.\n", required, count);
+  } else {
+    fprintf(stderr, "Quorum %zu/%zu is not met.\n", required, count);
+  }
+
+  targets_free(targets, count);
+
+  return met ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// `HOST:PORT` or `[IPV6]:PORT`, bare IPv6 addresses take `--port`
+static bool
+has_port(const char* spec)
+{
+  const char* colon = strchr(spec, ':');
+
+  if (colon == NULL || strncmp(spec, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+    return false;
+  }
+
+  return spec[0] == '[' ? strstr(spec, "]:") != NULL
+                        : strchr(colon + 1, ':') == NULL;
+}
+
+// Port or service of a single `HOST:PORT` spec replaces `--port` or
+// `--service`, so it is probed the same way
+static void
+split_host_port()
+{
+  char* target_service = strrchr(host_or_ip, ':');
+
+  *target_service++ = '\0';
+  port = 0;
+  service[0] = '\0';
+
+  if (strspn(target_service, "0123456789") == strlen(target_service)) {
+    port = (in_port_t)atoi(target_service);
+  } else {
+    strncpy(service, target_service, MAX_OPT_LEN_LIM - 1);
+  }
+}
+
+// `--port` or `--service` for ranges without ports
+static in_port_t
+range_port()
+{
+  struct servent* serv_ent;
+
+  if (port != 0 || strlen(service) == 0) {
+    return port;
+  }
+
+  serv_ent = getservbyname(service, DEFAULT_SERVICE_PROTOCOL);
+
+  return serv_ent != NULL ? ntohs((in_port_t)serv_ent->s_port) : 0;
+}
+
+// Any spec expanding to several targets turns dependencies into a sweep
+static bool
+is_sweep(size_t count, char** specs)
+{
+  probe_range_t range;
+
+  for (size_t i = 0; i < count; ++i) {
+    if (probe_range_parse(&range, specs[i], range_port(), RANGE_SEED) &&
+        range.size > 1) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Sweeps probe every target once & print a verdict line per target, modes
+// repeating probes or printing details don't combine
+static void
+check_sweep_modes(const char* targets)
+{
+  if (wait_mode || interval != 0) {
+    fprintf(stderr,
+            "%s are swept once, `--wait` & `--interval` don't apply.\n",
+            targets);
+    exit(EXIT_FAILURE);
+  }
+
+  if (timings || tcp_info) {
+    fprintf(stderr,
+            "%s get a line each, `--timings` & `--tcp-info` don't apply.\n",
+            targets);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void
+print_sweep_result(probe_target_t* target, void* data)
+{
+  size_t* available = data;
+  struct sockaddr_in* sin = (struct sockaddr_in*)&target->addr;
+  struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&target->addr;
+  double total_ms = (double)target->result.timings.total_ns / 1e6;
+  char addr[INET6_ADDRSTRLEN];
+
+  // Called from the sweep workers, a line is printed at once
+  if (sin->sin_family == AF_INET) {
+    inet_ntop(AF_INET, &sin->sin_addr, addr, sizeof(addr));
+  } else {
+    inet_ntop(AF_INET6, &sin6->sin6_addr, addr, sizeof(addr));
+  }
+
+  if (target->result.state == AVAILABLE) {
+    __atomic_add_fetch(available, 1, __ATOMIC_RELAXED);
+    printf(sin->sin_family == AF_INET ? "%s:%u is available (%.3f ms).\n"
+                                      : "[%s]:%u is available (%.3f ms).\n",
+           addr,
+           ntohs(sin->sin_port),
+           total_ms);
+  } else {
+    fprintf(stderr,
+            sin->sin_family == AF_INET ? "%s:%u is unavailable.\n"
+                                       : "[%s]:%u is unavailable.\n",
+            addr,
+            ntohs(sin->sin_port));
+  }
+}
+
+// Probes every address & port of the ranges on all CPUs
+static int
+sweep_probe(size_t count, char** specs)
+{
+  probe_sweep_conf_t conf;
+  probe_range_t range;
+  size_t available = 0, total = 0, required;
+
+  probe_sweep_conf_init(&conf);
+
+  for (size_t i = 0; i < count; ++i) {
+    if (!probe_range_parse(&range, specs[i], range_port(), RANGE_SEED)) {
+      fprintf(stderr, "Range \"%s\" is invalid.\n", specs[i]);
+      exit(EXIT_FAILURE);
+    }
+
+    total += range.size;
+  }
+
+  if (!parse_require(require, total, &required)) {
+    fprintf(stderr,
+            "Require \"%s\" is invalid. Use `all`, `any` or `K/%zu`.\n",
+            require,
+            total);
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    probe_range_parse(&range, specs[i], range_port(), RANGE_SEED);
+    probe_sweep_range(&range, &conf, print_sweep_result, &available);
+  }
+
+  if (available >= required) {
+    printf("%zu/%zu targets are available.\n", available, total);
+  } else {
+    fprintf(stderr, "%zu/%zu targets are available.\n", available, total);
+  }
+
+  return available >= required ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static const char* state_names[] = {
+  [AVAILABLE] = "available",
+  [UNAVAILABLE] = "unavailable",
+  [UNKNOWN_PROTOCOL] = "unknown protocol",
+  [UNKNOWN_HOST] = "unknown host",
+  [UNKNOWN_SERVICE] = "unknown service",
+  [INVALID_IP] = "invalid ip",
+  [CANCELLED] = "cancelled",
+  [HANDSHAKE_FAILED] = "handshake failed",
+  [CERTIFICATE_EXPIRING] = "certificate expiring",
+  [NOT_SERVING] = "not serving",
+  [INVALID_PATH] = "invalid path",
+};
+
+static void
+table_add_spec(probe_table_t* table, const char* spec_arg)
+{
+  probe_target_t target;
+  char spec[MAX_OPT_LEN_LIM + 1];
+
+  target_init_spec(&target, spec_arg, spec);
+  target.data = (char*)spec_arg;
+
+  // Failed lookups are reported right away, the table keeps no spec
+  if (target.result.state != CANCELLED) {
+    print_target_state(&target);
+  }
+
+  if (!probe_table_add(table, &target)) {
+    perror("Target table growth");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Targets of `--file`, a spec per line, & of the arguments are packed into a
+// table & swept, results are printed in the order of the specs
+static int
+table_probe(size_t count, char** specs)
+{
+  probe_table_t* table = probe_table_create(count);
+  FILE* file = fopen(targets_path, "r");
+  char line[MAX_OPT_LEN_LIM + 2], name[MAX_OPT_LEN_LIM + 8];
+  probe_sweep_conf_t conf;
+  size_t available = 0, total, required;
+
+  if (table == NULL) {
+    perror("Target table allocation");
+    exit(EXIT_FAILURE);
+  }
+
+  if (file == NULL) {
+    perror("Targets file open");
+    exit(EXIT_FAILURE);
+  }
+
+  // Blank lines & `#` comments are skipped
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (line[0] != '\0' && line[0] != '#') {
+      table_add_spec(table, line);
+    }
+  }
+
+  fclose(file);
+
+  for (size_t i = 0; i < count; ++i) {
+    table_add_spec(table, specs[i]);
+  }
+
+  total = probe_table_count(table);
+
+  if (!parse_require(require, total, &required)) {
+    fprintf(stderr,
+            "Require \"%s\" is invalid. Use `all`, `any` or `K/%zu`.\n",
+            require,
+            total);
+    exit(EXIT_FAILURE);
+  }
+
+  probe_sweep_conf_init(&conf);
+  probe_sweep_table(table, &conf, NULL, NULL);
+
+  for (size_t i = 0; i < total; ++i) {
+    SERVICE_STATE state = probe_table_state(table, i);
+
+    // Failed lookups are reported already
+    if (!probe_table_format(table, i, name, sizeof(name))) {
+      continue;
+    }
+
+    if (state == AVAILABLE) {
+      available++;
+      printf("%s is available (%.3f ms).\n",
+             name,
+             (double)probe_table_latency_us(table, i) / 1e3);
+    } else {
+      fprintf(stderr, "%s is %s.\n", name, state_names[state]);
+    }
+  }
+
+  probe_table_destroy(table);
+
+  if (available >= required) {
+    printf("%zu/%zu targets are available.\n", available, total);
+  } else {
+    fprintf(stderr, "%zu/%zu targets are available.\n", available, total);
+  }
+
+  return available >= required ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Scheduler targets & their dampers share ids
+typedef struct watch
+{
+  probe_scheduler_t* scheduler;
+  probe_damper_t* dampers;
+} watch_t;
+
+static uint64_t
+monotonic_ms()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void
+on_history_signal(int sig)
+{
+  (void)sig;
+  history_requested = 1;
+}
+
+static void
+print_history(watch_t* watch)
+{
+  probe_history_entry_t entries[DAMPING_HISTORY];
+  uint64_t now_ms = monotonic_ms();
+
+  probe_target_t target;
+
+  for (size_t i = 0; i < probe_scheduler_count(watch->scheduler); ++i) {
+    probe_damper_t* damper = &watch->dampers[i];
+    size_t count = probe_damper_history(damper, entries, DAMPING_HISTORY);
+
+    probe_scheduler_target(watch->scheduler, i, &target);
+    printf("\"%s\" is %s, penalty %.0f%s:\n",
+           (char*)target.data,
+           damper->reported == DAMPER_UP     ? "up"
+           : damper->reported == DAMPER_DOWN ? "down"
+                                             : "not probed yet",
+           probe_damper_penalty(damper, &damping, now_ms),
+           damper->suppressed ? ", suppressed" : "");
+
+    for (size_t j = 0; j < count; ++j) {
+      printf("\t%llu ms ago: %s (%.3f ms)\n",
+             (unsigned long long)(now_ms - entries[j].at_ms),
+             state_names[entries[j].state],
+             (double)entries[j].total_us / 1e3);
+    }
+  }
+
+  fflush(stdout);
+}
+
+// Every verdict or, with `--events`, state changes only
+static void
+print_watch_result(probe_target_t* target, void* data)
+{
+  watch_t* watch = data;
+  size_t id = probe_scheduler_id(watch->scheduler, target);
+
+  if (events && !probe_damper_update(&watch->dampers[id],
+                                     &damping,
+                                     &target->result,
+                                     monotonic_ms())) {
+    return;
+  }
+
+  print_target_state(target);
+  fflush(stdout);
+}
+
+// Probes every target each `interval` forever
+static int
+watch_probe(size_t count, char** specs)
+{
+  probe_target_t* targets = targets_init(count, specs);
+  probe_engine_conf_t conf;
+  probe_scheduler_t* scheduler;
+  watch_t watch;
+
+  probe_engine_conf_init(&conf);
+  scheduler = probe_scheduler_create(
+    count, count < MAX_ACTIVE_PROBES ? count : MAX_ACTIVE_PROBES, &conf);
+
+  if (scheduler == NULL) {
+    perror("Scheduler creation");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    // Unresolvable targets are reported once and never probed
+    if (targets[i].result.state != CANCELLED) {
+      print_target_state(&targets[i]);
+    } else {
+      probe_scheduler_add(scheduler, &targets[i], interval, jitter);
+    }
+  }
+
+  if (probe_scheduler_count(scheduler) == 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  watch.scheduler = scheduler;
+  watch.dampers = calloc(count, sizeof(probe_damper_t));
+
+  if (watch.dampers == NULL) {
+    perror("Dampers allocation");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    probe_damper_init(&watch.dampers[i]);
+  }
+
+  if (events) {
+    signal(SIGUSR1, on_history_signal);
+  }
+
+  for (;;) {
+    probe_scheduler_run(scheduler, -1, print_watch_result, &watch);
+
+    // Waits are cut short by the signal
+    if (history_requested) {
+      history_requested = 0;
+      print_history(&watch);
+    }
+  }
+}
+
+// Retries all targets till they are available or `--wait` time is over,
+// then replaces the process with `command` if there is one
+static void
+print_wait_result(probe_target_t* target, void* data)
+{
+  (void)data;
+  print_target_state(target);
+  fflush(stdout);
+}
+
+static int
+wait_probe(size_t count, char** specs)
+{
+  probe_target_t* targets = targets_init(count, specs);
+  probe_engine_conf_t conf;
+  bool ready;
+
+  probe_engine_conf_init(&conf);
+
+  for (size_t i = 0; i < count; ++i) {
+    if (targets[i].result.state != CANCELLED) {
+      print_target_state(&targets[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  ready =
+    probe_wait(targets, count, wait_timeout, &conf, print_wait_result, NULL);
+
+  for (size_t i = 0; !ready && i < count; ++i) {
+    if (targets[i].result.state == CANCELLED) {
+      fprintf(stderr, "\"%s\" is not probed to the end.\n", specs[i]);
+    } else if (targets[i].result.state != AVAILABLE) {
+      print_target_state(&targets[i]);
+    }
+  }
+
+  targets_free(targets, count);
+
+  if (!ready) {
+    fprintf(stderr,
+            "Targets are not available in %llu ms.\n",
+            (unsigned long long)wait_timeout);
+    return EXIT_FAILURE;
+  }
+
+  if (command != NULL) {
+    fflush(stdout);
+    execvp(command[0], command);
+    perror("Command execution");
+    exit(EXIT_FAILURE);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+#ifdef DEBUG
+
+static void
+print_trace_event(const probe_trace_event_t* event, void* data)
+{
+  fprintf(stderr,
+          "DEBUG %s #%zu: %.3f ms, error %d\n",
+          probe_phase_name(event->phase),
+          event->attempt,
+          (double)event->elapsed_ns / 1e6,
+          event->error);
+}
+
+#endif // DEBUG
+
 int
 main(int argc, char** argv)
 {
@@ -61,12 +972,23 @@ main(int argc, char** argv)
   struct option* option;
 
   r = regcomp(&regex, ip_re, REG_EXTENDED);
+  probe_damping_conf_init(&damping);
 
   if (r != 0) {
     fprintf(stderr, "Regex compile fail: %d\n", r);
     exit(EXIT_FAILURE);
   }
 
+  // Everything after `--` is the command to run, options stop there
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--") == 0) {
+      command = argv + i + 1;
+      argv[i] = NULL;
+      argc = i;
+      break;
+    }
+  }
+
   size_t host_ip_len = strlen(argv[argc - 1]);
 
   if (host_ip_len > MAX_OPT_LEN_LIM) {
@@ -118,10 +1040,99 @@ main(int argc, char** argv)
         timeout = (size_t)atoi(optarg);
         break;
       }
+      case 'T': {
+        timings = true;
+        break;
+      }
+      case 'i': {
+        tcp_info = true;
+        break;
+      }
+      case 'q': {
+        strncpy(require, optarg, MAX_OPT_LEN_LIM);
+        break;
+      }
+      case 'c': {
+        strncpy(cache_path, optarg, MAX_OPT_LEN_LIM);
+        break;
+      }
+      case 'I': {
+        interval = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'j': {
+        jitter = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'R': {
+        rate = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'H': {
+        per_host = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'S': {
+        per_subnet = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'L': {
+        tls = true;
+        break;
+      }
+      case 'N': {
+        strncpy(server_name, optarg, MAX_OPT_LEN_LIM);
+        break;
+      }
+      case 'A': {
+        strncpy(ca_file, optarg, MAX_OPT_LEN_LIM);
+        break;
+      }
+      case 'D': {
+        expiry_days = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'g': {
+        grpc = true;
+        break;
+      }
+      case 'G': {
+        strncpy(grpc_service, optarg, MAX_OPT_LEN_LIM);
+        break;
+      }
+      case 'P': {
+        seqpacket = true;
+        break;
+      }
+      case 'w': {
+        wait_mode = true;
+        wait_timeout = strtoull(optarg, NULL, 10);
+        break;
+      }
+      case 'E': {
+        events = true;
+        break;
+      }
+      case 'd': {
+        damping.down_after = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'u': {
+        damping.up_after = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'F': {
+        damping.half_life_ms = (uint32_t)atoi(optarg);
+        break;
+      }
+      case 'f': {
+        strncpy(targets_path, optarg, MAX_OPT_LEN_LIM);
+        break;
+      }
     }
   }
 
-  if (argc < 3) {
+  if (optind >= argc && strlen(targets_path) == 0) {
     fputs("Not enough arguments.\n", stderr);
     exit(EXIT_FAILURE);
   }
@@ -149,12 +1160,116 @@ main(int argc, char** argv)
 #endif
 
   probe_config(retry, timeout);
+  probe_config_tcp_info(tcp_info);
+  // Bursts of a tenth of a second worth of attempts
+  probe_config_limits(rate, rate / 10 + 1, per_host, per_subnet);
+
+  if (grpc && tls) {
+    fputs("gRPC health check works over cleartext HTTP/2 only.\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+
+  probe_config_grpc(grpc, grpc_service);
+
+  if (tls) {
+    // A peer gone mid handshake must fail the probe, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!probe_config_tls(true,
+                          strlen(server_name) != 0 ? server_name : NULL,
+                          strlen(ca_file) != 0 ? ca_file : NULL,
+                          expiry_days)) {
+      fputs("TLS setup is failed.\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // The cache is an optimization, probing goes on without it
+  if (strlen(cache_path) != 0 &&
+      !probe_cache_open(cache_path, DEFAULT_CACHE_TTL)) {
+    perror("Cache open");
+  }
+
+#ifdef DEBUG
+  probe_trace(print_trace_event, NULL);
+#endif
+
+  if (command != NULL && (!wait_mode || command[0] == NULL)) {
+    fputs("A command after `--` is run by `--wait` only.\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+
+  if (strlen(targets_path) != 0) {
+    check_sweep_modes("Targets of `--file`");
+    exit(table_probe(argc - optind, argv + optind));
+  }
+
+  if (is_sweep(argc - optind, argv + optind)) {
+    check_sweep_modes("Ranges");
+    exit(sweep_probe(argc - optind, argv + optind));
+  }
+
+  if (wait_mode) {
+    exit(wait_probe(argc - optind, argv + optind));
+  }
+
+  if (interval != 0) {
+    exit(watch_probe(argc - optind, argv + optind));
+  }
+
+  // Blocking probes are IPv4 only, a bracketed IPv6 address is a quorum of one
+  if (argc - optind > 1 || strlen(require) != 0 || argv[optind][0] == '[') {
+    exit(quorum_probe(argc - optind, argv + optind));
+  }
+
+  if (has_port(host_or_ip)) {
+    split_host_port();
+  }
 
   r = regexec(&regex, host_or_ip, 0, NULL, 0);
 
-  // IP + service
-  if (r == 0 && strlen(service) != 0) {
-    service_state = ipv4_service_probe(host_or_ip, service, NULL);
+  // Unix socket
+  if (strncmp(host_or_ip, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+    char* path = host_or_ip + strlen(UNIX_PREFIX);
+
+    service_state = unix_probe_r(
+      path, seqpacket ? SOCK_SEQPACKET : SOCK_STREAM, &result);
+
+    switch (service_state) {
+      case AVAILABLE: {
+        printf("Socket \"%s\" is available.\n", path);
+        break;
+      }
+      case UNAVAILABLE: {
+        fprintf(stderr, "Socket \"%s\" is unavailable.\n", path);
+        break;
+      }
+      case INVALID_PATH: {
+        fprintf(stderr, "Socket path \"%s\" is invalid.\n", path);
+        break;
+      }
+      case HANDSHAKE_FAILED: {
+        fprintf(stderr, "TLS handshake is failed: %s.\n", result.tls.error);
+        break;
+      }
+      case CERTIFICATE_EXPIRING: {
+        fprintf(stderr,
+                "Certificate expires in %lld days.\n",
+                (long long)result.tls.days_left);
+        break;
+      }
+      case NOT_SERVING: {
+        fprintf(stderr, "Health check is failed: %s.\n", result.grpc.message);
+        break;
+      }
+      default: {
+        fprintf(stderr, "Unknown error %d\n", service_state);
+        break;
+      }
+    }
+    // IP + service
+  } else if (r == 0 && strlen(service) != 0) {
+    service_state = ipv4_service_probe_r(host_or_ip, service, NULL, &result);
 
     switch (service_state) {
       case AVAILABLE: {
@@ -181,6 +1296,20 @@ main(int argc, char** argv)
         fprintf(stderr, "Service \"%s\" is not well known\n", service);
         break;
       }
+      case HANDSHAKE_FAILED: {
+        fprintf(stderr, "TLS handshake is failed: %s.\n", result.tls.error);
+        break;
+      }
+      case CERTIFICATE_EXPIRING: {
+        fprintf(stderr,
+                "Certificate expires in %lld days.\n",
+                (long long)result.tls.days_left);
+        break;
+      }
+      case NOT_SERVING: {
+        fprintf(stderr, "Health check is failed: %s.\n", result.grpc.message);
+        break;
+      }
       default: {
         fprintf(stderr, "Unknown error %d\n", service_state);
         break;
@@ -188,7 +1317,7 @@ main(int argc, char** argv)
     }
     // IP + port
   } else if (r == 0 && port != 0) {
-    service_state = ipv4_port_probe(host_or_ip, port, NULL);
+    service_state = ipv4_port_probe_r(host_or_ip, port, NULL, &result);
 
     switch (service_state) {
       case AVAILABLE: {
@@ -210,6 +1339,20 @@ main(int argc, char** argv)
         fprintf(stderr, "Lookup for host \"%s\" is failed.\n", host_or_ip);
         break;
       }
+      case HANDSHAKE_FAILED: {
+        fprintf(stderr, "TLS handshake is failed: %s.\n", result.tls.error);
+        break;
+      }
+      case CERTIFICATE_EXPIRING: {
+        fprintf(stderr,
+                "Certificate expires in %lld days.\n",
+                (long long)result.tls.days_left);
+        break;
+      }
+      case NOT_SERVING: {
+        fprintf(stderr, "Health check is failed: %s.\n", result.grpc.message);
+        break;
+      }
       default: {
         fprintf(stderr, "Unknown error %d\n", service_state);
         break;
@@ -217,7 +1360,7 @@ main(int argc, char** argv)
     }
     // host + service
   } else if (strlen(host_or_ip) != 0 && strlen(service) != 0) {
-    service_state = host_service_probe(host_or_ip, service, NULL);
+    service_state = host_service_probe_r(host_or_ip, service, NULL, &result);
 
     switch (service_state) {
       case AVAILABLE: {
@@ -240,6 +1383,20 @@ main(int argc, char** argv)
         fprintf(stderr, "Service \"%s\" is not well known\n", service);
         break;
       }
+      case HANDSHAKE_FAILED: {
+        fprintf(stderr, "TLS handshake is failed: %s.\n", result.tls.error);
+        break;
+      }
+      case CERTIFICATE_EXPIRING: {
+        fprintf(stderr,
+                "Certificate expires in %lld days.\n",
+                (long long)result.tls.days_left);
+        break;
+      }
+      case NOT_SERVING: {
+        fprintf(stderr, "Health check is failed: %s.\n", result.grpc.message);
+        break;
+      }
       default: {
         fprintf(stderr, "Unknown error %d\n", service_state);
         break;
@@ -247,7 +1404,7 @@ main(int argc, char** argv)
     }
     // host + port
   } else if (strlen(host_or_ip) != 0 && port != 0) {
-    service_state = host_port_probe(host_or_ip, port, NULL);
+    service_state = host_port_probe_r(host_or_ip, port, NULL, &result);
 
     switch (service_state) {
       case AVAILABLE: {
@@ -269,6 +1426,20 @@ main(int argc, char** argv)
         fprintf(stderr, "Service \"%s\" is not well known\n", service);
         break;
       }
+      case HANDSHAKE_FAILED: {
+        fprintf(stderr, "TLS handshake is failed: %s.\n", result.tls.error);
+        break;
+      }
+      case CERTIFICATE_EXPIRING: {
+        fprintf(stderr,
+                "Certificate expires in %lld days.\n",
+                (long long)result.tls.days_left);
+        break;
+      }
+      case NOT_SERVING: {
+        fprintf(stderr, "Health check is failed: %s.\n", result.grpc.message);
+        break;
+      }
       default: {
         fprintf(stderr, "Unknown error %d\n", service_state);
         break;
@@ -279,6 +1450,18 @@ main(int argc, char** argv)
     exit(EXIT_FAILURE);
   }
 
+  if (timings) {
+    print_timings(&result);
+  }
+
+  if (tcp_info) {
+    print_tcp_info(&result);
+  }
+
+  if (tls) {
+    print_tls_info(&result);
+  }
+
   if (service_state != AVAILABLE) {
     exit(EXIT_FAILURE);
   }
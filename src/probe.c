@@ -1,127 +1,228 @@
 #include "probe.h"
+#include "cache.h"
+#include "grpc.h"
+#include "internal.h"
+#include "tls.h"
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 static probe_conf_t probe_conf = { .retry_count = DEFAULT_RETRY_COUNT,
-                                   .timeout = DEFAULT_TIMEOUT };
+                                   .timeout = DEFAULT_TIMEOUT,
+                                   .tcp_info = false };
+
+static probe_trace_fn trace_fn = NULL;
+static void* trace_data = NULL;
+
+static const char* phase_names[PHASE_COUNT] = {
+  [PHASE_PROTOCOL_LOOKUP] = "protocol lookup",
+  [PHASE_SERVICE_LOOKUP] = "service lookup",
+  [PHASE_HOST_RESOLUTION] = "host resolution",
+  [PHASE_SOCKET_CREATION] = "socket creation",
+  [PHASE_CONNECT] = "connect",
+  [PHASE_BACKOFF] = "backoff",
+  [PHASE_CLOSE] = "close",
+  [PHASE_PACING] = "pacing",
+  [PHASE_HANDSHAKE] = "handshake",
+  [PHASE_RPC] = "rpc",
+};
+
+uint64_t
+probe_now_ns()
+{
+  struct timespec ts;
 
-#ifdef DEBUG
+  clock_gettime(CLOCK_MONOTONIC, &ts);
 
-static void
-print_config()
-{
-  puts("DEBUG \"print_config\" {");
-  printf("\tRetry count: %d\n", probe_conf.retry_count);
-  printf("\tTimeout: %d\n", probe_conf.timeout);
-  puts("}");
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
-static void
-print_protoent(struct protoent* proto_ent)
+uint64_t
+probe_phase_end(probe_result_t* result,
+                PROBE_PHASE phase,
+                size_t attempt,
+                uint64_t start,
+                int error)
 {
-  assert(proto_ent != NULL);
+  uint64_t end = probe_now_ns();
+  uint64_t elapsed = end - start;
+
+  result->timings.phase_ns[phase] += elapsed;
+
+  if (phase == PHASE_CONNECT) {
+    if (attempt < MAX_TRACKED_ATTEMPTS) {
+      result->timings.attempt_ns[attempt] = elapsed;
+    }
 
-  puts("DEBUG \"print_protoent\" {");
+    result->timings.attempts = attempt + 1;
+  }
+
+  if (unlikely(trace_fn != NULL)) {
+    probe_trace_event_t event = {
+      .phase = phase, .attempt = attempt, .elapsed_ns = elapsed, .error = error
+    };
 
-  printf("\tOfficial protocol name(p_name): %s\n", proto_ent->p_name);
-  printf("\tProtocol number(p_proto): %d\n", proto_ent->p_proto);
+    trace_fn(&event, trace_data);
+  }
 
-  puts("}");
+  return end;
 }
 
-static void
-print_servent(struct servent* serv_ent)
+static SERVICE_STATE
+probe_finish(probe_result_t* result, uint64_t start, SERVICE_STATE state)
 {
-  assert(serv_ent != NULL);
-  char** s_aliases = serv_ent->s_aliases;
-
-  puts("DEBUG \"print_servent\" {");
+  result->state = state;
+  result->timings.total_ns = probe_now_ns() - start;
 
-  printf("\tOfficial service name(s_name): %s\n", serv_ent->s_name);
+  return state;
+}
 
-  puts("\tAlias list:");
+void
+probe_read_tcp_info(socket_t sock, probe_tcp_info_t* info)
+{
+  struct tcp_info ti;
+  socklen_t len = sizeof(ti);
 
-  while (*s_aliases != NULL) {
-    printf("\tAlias: %s\n", *s_aliases++);
+  if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &ti, &len) != 0) {
+    return;
   }
 
-  printf("\tPort number(s_port): %d\n", ntohs(serv_ent->s_port));
-  printf("\tProtocol to use(s_proto): %s\n", serv_ent->s_proto);
-
-  puts("}");
+  info->valid = true;
+  info->rtt_us = ti.tcpi_rtt;
+  info->rttvar_us = ti.tcpi_rttvar;
+  // SYN retransmits are accounted here as well
+  info->retransmits = ti.tcpi_total_retrans;
+  info->pmtu = ti.tcpi_pmtu;
+  info->snd_mss = ti.tcpi_snd_mss;
+  info->snd_cwnd = ti.tcpi_snd_cwnd;
 }
 
+// Every connect, read & write of blocking `sock` is limited by the probe
+// timeout
 static void
-print_sockaddr_in(struct sockaddr_in* p_addr)
+set_io_timeout(socket_t sock)
 {
-  assert(p_addr != NULL);
-  // only PF_INET
-  assert(p_addr->sin_family == PF_INET);
-
-  puts("DEBUG \"print_sockaddr_in\" {");
+  struct timeval timeout = { 0 };
 
-  printf("\tInternet address(sin_addr): %s\n", inet_ntoa(p_addr->sin_addr));
-  printf("\tPort number(sin_port): %d\n", ntohs(p_addr->sin_port));
-
-  puts("}");
+  timeout.tv_sec =
+    probe_conf.timeout != 0 ? probe_conf.timeout : DEFAULT_TIMEOUT;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 }
 
+// The ticket is sent about a round trip after the handshake, which took at
+// least one, so it is waited for as long as the handshake took
 static void
-print_hostent(struct hostent* p_host)
+tls_wait_ticket(socket_t sock, probe_tls_t* tls, uint64_t handshake_ns)
 {
-  assert(p_host != NULL);
-  struct in_addr addr;
-  in_addr_t** p_next_addr = (in_addr_t**)p_host->h_addr_list;
-  size_t i = 0ull;
-
-  puts("DEBUG \"print_hostent\" {");
+  struct pollfd pfd = { .fd = sock, .events = POLLIN };
+  uint64_t deadline = probe_now_ns() + handshake_ns + NS_IN_MS;
 
-  printf("\tOfficial name of host(h_name): %s\n", p_host->h_name);
+  // Reads past the ticket must not block
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
 
-  printf("\tHost address type(h_addrtype): ");
+  while (probe_tls_wait_ticket(tls)) {
+    uint64_t now = probe_now_ns();
 
-  switch (p_host->h_addrtype) {
-    case PF_INET: {
-      puts("\tIP protocol family");
+    if (now >= deadline ||
+        poll(&pfd, 1, (int)((deadline - now + NS_IN_MS - 1) / NS_IN_MS)) <=
+          0) {
       break;
     }
-    default: {
-      printf("\tProtocol family: %d\n", p_host->h_addrtype);
-      return;
-    }
+  }
+}
+
+// Handshake over connected blocking `sock`
+static SERVICE_STATE
+tls_handshake(socket_t sock,
+              const char* host,
+              const struct sockaddr* addr,
+              socklen_t addrlen,
+              size_t attempt,
+              probe_result_t* result,
+              uint64_t* ts)
+{
+  const char* server_name =
+    probe_conf.tls_server_name != NULL ? probe_conf.tls_server_name : host;
+  TLS_STEP step = TLS_FAILED;
+  struct sockaddr_storage peer;
+  uint64_t start = *ts;
+  probe_tls_t* tls;
+  SERVICE_STATE state;
+
+  // Sessions are cached per peer like the ones of the engine
+  memset(&peer, 0, sizeof(peer));
+  memcpy(&peer, addr, addrlen);
+  tls = probe_tls_new(sock, server_name, &peer);
+
+  if (tls != NULL) {
+    step = probe_tls_handshake(tls);
   }
 
-  puts("\tAlias list:");
+  *ts = probe_phase_end(
+    result, PHASE_HANDSHAKE, attempt, *ts, step == TLS_DONE ? 0 : step);
+  state = probe_tls_verdict(tls, step, &result->tls);
 
-  while (*p_next_addr != NULL) {
-    addr.s_addr = **p_next_addr;
-    printf("\tAddress: %s\n", inet_ntoa(addr));
-    p_next_addr++;
+  if (step == TLS_DONE) {
+    tls_wait_ticket(sock, tls, *ts - start);
   }
 
-  puts("}");
-}
+  probe_tls_free(tls);
 
-#endif // DEBUG
+  return state;
+}
 
+// Health check call over connected blocking `sock`
 static SERVICE_STATE
-probe(struct sockaddr_in* sockaddr, struct protoent* proto)
+grpc_check(socket_t sock,
+           const char* host,
+           const struct sockaddr* addr,
+           size_t attempt,
+           probe_result_t* result,
+           uint64_t* ts)
 {
-#ifdef DEBUG
-  print_sockaddr_in(sockaddr);
-#endif
+  probe_grpc_t* grpc = probe_grpc_new(host, addr, probe_conf.grpc_service);
+  GRPC_STEP step = GRPC_FAILED;
+  SERVICE_STATE state;
+
+  if (grpc != NULL && (step = probe_grpc_start(grpc, sock)) == GRPC_MORE) {
+    step = probe_grpc_receive(grpc, sock);
+  }
+
+  *ts = probe_phase_end(
+    result, PHASE_RPC, attempt, *ts, step == GRPC_DONE ? 0 : step);
+  state = probe_grpc_verdict(grpc, step, &result->grpc);
+  probe_grpc_free(grpc);
+
+  return state;
+}
 
+// Blocking socket with every connect, read & write limited by the probe
+// timeout. Unix domain sockets have no protocol of their own
+static socket_t
+open_socket(int type, int protocol)
+{
   socket_t sock;
 
-  switch (proto->p_proto) {
+  switch (protocol) {
     case (IPPROTO_TCP): {
-      sock = socket(PF_INET, SOCK_STREAM, proto->p_proto);
+      sock = socket(PF_INET, type, protocol);
+      break;
+    }
+    case (0): {
+      sock = socket(PF_UNIX, type, protocol);
       break;
     }
     default: {
@@ -130,6 +231,36 @@ probe(struct sockaddr_in* sockaddr, struct protoent* proto)
     }
   }
 
+  if (sock != -1) {
+    set_io_timeout(sock);
+  }
+
+  return sock;
+}
+
+// Attempts go round robin over `count` addresses of `addrlen` bytes each,
+// `probed` is set to the index of the last one tried. `host` is the TLS server
+// name, may be NULL
+static SERVICE_STATE
+probe(const struct sockaddr* sockaddrs,
+      socklen_t addrlen,
+      size_t count,
+      int type,
+      int protocol,
+      const char* host,
+      probe_result_t* result,
+      size_t* probed)
+{
+  const struct sockaddr* addr = sockaddrs;
+  socket_t sock;
+  size_t attempt = 0;
+  SERVICE_STATE state = UNAVAILABLE;
+  uint64_t ts = probe_now_ns();
+
+  sock = open_socket(type, protocol);
+  ts = probe_phase_end(
+    result, PHASE_SOCKET_CREATION, 0, ts, sock == -1 ? errno : 0);
+
   if (sock == -1) {
     perror("Socket creation in `probe` call");
     exit(EXIT_FAILURE);
@@ -137,31 +268,161 @@ probe(struct sockaddr_in* sockaddr, struct protoent* proto)
 
   int conn_res;
 
-  for (size_t i = 0; i < probe_conf.retry_count; ++i) {
-#ifdef DEBUG
-    printf("Trying to connect %d time\n", i);
-#endif
+  *probed = 0;
 
-    conn_res = connect(sock, (struct sockaddr*)sockaddr, INET_ADDRSTRLEN);
+  for (size_t i = 0; i < probe_conf.retry_count; ++i) {
+    attempt = i;
+    *probed = i % count;
+    addr = (const struct sockaddr*)((const char*)sockaddrs + *probed * addrlen);
+    conn_res = connect(sock, addr, addrlen);
+    ts = probe_phase_end(
+      result, PHASE_CONNECT, i, ts, conn_res == 0 ? 0 : errno);
 
     if (conn_res == 0) {
       break;
     } else if (i != probe_conf.retry_count - 1) {
+      // A connect cut by the timeout is still in progress, the next attempt
+      // can't reuse its socket
+      close(sock);
+
+      if ((sock = open_socket(type, protocol)) == -1) {
+        perror("Socket creation in `probe` call");
+        exit(EXIT_FAILURE);
+      }
+
       sleep(probe_conf.timeout);
+      ts = probe_phase_end(result, PHASE_BACKOFF, i, ts, 0);
     }
   }
 
+  if (conn_res == 0 && probe_conf.tcp_info && protocol == IPPROTO_TCP) {
+    probe_read_tcp_info(sock, &result->tcp_info);
+  }
+
+  if (conn_res == 0 && probe_conf.grpc) {
+    state = grpc_check(sock, host, addr, attempt, result, &ts);
+  } else if (conn_res == 0 && probe_conf.tls) {
+    state = tls_handshake(sock, host, addr, addrlen, attempt, result, &ts);
+  } else if (conn_res == 0) {
+    state = AVAILABLE;
+  }
+
   close(sock);
+  probe_phase_end(result, PHASE_CLOSE, 0, ts, 0);
+
+  return state;
+}
+
+// Fills `sockaddrs` with the addresses of `host`, the last known good one
+// first. While the cache entry is fresh no resolution is done at all
+static bool
+resolve_host(char* host,
+             in_port_t port,
+             struct sockaddr_in* sockaddrs,
+             size_t* count,
+             probe_result_t* result)
+{
+  struct in_addr addrs[CACHE_MAX_ADDRS];
+  probe_cache_entry_t entry;
+  struct hostent* host_ent;
+  size_t first = 0;
+  uint64_t ts = probe_now_ns();
+  bool cached = probe_cache_lookup(host, port, &entry);
+
+  if (cached && probe_cache_fresh(&entry)) {
+    *count = entry.addr_count;
+    memcpy(addrs, entry.addrs, *count * sizeof(struct in_addr));
+    probe_phase_end(result, PHASE_HOST_RESOLUTION, 0, ts, 0);
+  } else {
+    host_ent = gethostbyname(host);
+    probe_phase_end(
+      result, PHASE_HOST_RESOLUTION, 0, ts, host_ent == NULL ? h_errno : 0);
+
+    if (host_ent == NULL) {
+      return false;
+    }
 
-  if (conn_res == 0) {
-    return AVAILABLE;
+    if (host_ent->h_addrtype != AF_INET) {
+      fprintf(stderr, "Only IPv4 is supported\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for (*count = 0;
+         *count < CACHE_MAX_ADDRS && host_ent->h_addr_list[*count] != NULL;
+         ++*count) {
+      addrs[*count] = *(struct in_addr*)host_ent->h_addr_list[*count];
+    }
+
+    probe_cache_store_addrs(host, port, addrs, *count);
   }
 
-#ifdef DEBUG
-  perror("Connect creation in `probe` call");
-#endif
+  for (size_t i = 0; cached && entry.last_good < entry.addr_count && i < *count;
+       ++i) {
+    if (addrs[i].s_addr == entry.addrs[entry.last_good].s_addr) {
+      first = i;
+    }
+  }
+
+  for (size_t i = 0; i < *count; ++i) {
+    struct sockaddr_in* sockaddr = &sockaddrs[i];
+
+    memset(sockaddr, 0, sizeof(struct sockaddr_in));
+    sockaddr->sin_addr = addrs[(first + i) % *count];
+    sockaddr->sin_family = PF_INET;
+    sockaddr->sin_port = htons(port);
+  }
+
+  return *count > 0;
+}
+
+// Probes every address of `host` and remembers the outcome in the cache
+static SERVICE_STATE
+host_probe(char* host,
+           in_port_t port,
+           struct protoent* proto,
+           probe_result_t* result)
+{
+  struct sockaddr_in sockaddrs[CACHE_MAX_ADDRS];
+  size_t count, probed, last;
+  SERVICE_STATE state;
+
+  if (!resolve_host(host, port, sockaddrs, &count, result)) {
+    return UNKNOWN_HOST;
+  }
+
+  state = probe((struct sockaddr*)sockaddrs,
+                sizeof(struct sockaddr_in),
+                count,
+                SOCK_STREAM,
+                proto->p_proto,
+                host,
+                result,
+                &probed);
+  last = result->timings.attempts - 1;
+
+  probe_cache_store_result(
+    host,
+    port,
+    sockaddrs[probed].sin_addr,
+    state,
+    last < MAX_TRACKED_ATTEMPTS ? result->timings.attempt_ns[last] / 1000 : 0);
+
+  return state;
+}
 
-  return UNAVAILABLE;
+// Maps `gethostbyaddr` failure to the probe state
+static SERVICE_STATE
+host_lookup_failure(int error)
+{
+  switch (error) {
+    case HOST_NOT_FOUND: {
+      return UNKNOWN_HOST;
+    }
+    default: {
+      // TRY_AGAIN, NO_RECOVERY, NO_DATA
+      return UNAVAILABLE;
+    }
+  }
 }
 
 void
@@ -171,6 +432,100 @@ probe_config(size_t retry_count, size_t timeout)
   probe_conf.timeout = timeout;
 }
 
+const probe_conf_t*
+probe_current_config()
+{
+  return &probe_conf;
+}
+
+bool
+probe_unix_addr(const char* path,
+                struct sockaddr_storage* addr,
+                socklen_t* addrlen)
+{
+  struct sockaddr_un* un = (struct sockaddr_un*)addr;
+  bool abstract = path[0] == '@';
+  size_t len = strlen(path);
+
+  // Abstract names are not NUL terminated, they may fill the whole path
+  if (len <= (abstract ? 1 : 0) ||
+      len > sizeof(un->sun_path) - (abstract ? 0 : 1)) {
+    return false;
+  }
+
+  memset(addr, 0, sizeof(struct sockaddr_storage));
+  un->sun_family = AF_UNIX;
+  memcpy(un->sun_path, path, len);
+
+  if (abstract) {
+    un->sun_path[0] = '\0';
+  }
+
+  *addrlen = offsetof(struct sockaddr_un, sun_path) + len + (abstract ? 0 : 1);
+
+  return true;
+}
+
+void
+probe_config_tcp_info(bool enable)
+{
+  probe_conf.tcp_info = enable;
+}
+
+void
+probe_config_limits(uint32_t rate,
+                    uint32_t burst,
+                    uint32_t per_host,
+                    uint32_t per_subnet)
+{
+  probe_conf.rate = rate;
+  probe_conf.burst = burst;
+  probe_conf.per_host = per_host;
+  probe_conf.per_subnet = per_subnet;
+}
+
+bool
+probe_config_tls(bool enable,
+                 const char* server_name,
+                 const char* ca_file,
+                 uint32_t expiry_days)
+{
+  probe_conf.tls = false;
+  probe_conf.tls_server_name = server_name;
+  probe_conf.tls_ca_file = ca_file;
+  probe_conf.tls_expiry_days = expiry_days;
+
+  if (enable && !probe_tls_setup(&probe_conf)) {
+    return false;
+  }
+
+  probe_conf.tls = enable;
+
+  return true;
+}
+
+void
+probe_config_grpc(bool enable, const char* service)
+{
+  probe_conf.grpc = enable;
+  probe_conf.grpc_service = service;
+}
+
+void
+probe_trace(probe_trace_fn fn, void* data)
+{
+  trace_data = data;
+  trace_fn = fn;
+}
+
+const char*
+probe_phase_name(PROBE_PHASE phase)
+{
+  assert(phase < PHASE_COUNT);
+
+  return phase_names[phase];
+}
+
 char*
 probe_version()
 {
@@ -178,8 +533,20 @@ probe_version()
 }
 
 SERVICE_STATE
-ipv4_port_probe(char* ipv4, in_port_t port, char* protocol)
+ipv4_port_probe_r(char* ipv4,
+                  in_port_t port,
+                  char* protocol,
+                  probe_result_t* result)
 {
+  probe_result_t local_result;
+  uint64_t start = probe_now_ns(), ts = start;
+
+  if (result == NULL) {
+    result = &local_result;
+  }
+
+  memset(result, 0, sizeof(probe_result_t));
+
   if (protocol == NULL) {
     protocol = DEFAULT_SERVICE_PROTOCOL;
   }
@@ -188,59 +555,28 @@ ipv4_port_probe(char* ipv4, in_port_t port, char* protocol)
   struct hostent* host_ent;
   struct sockaddr_in sockaddr;
   struct in_addr addr;
+  size_t probed;
+
+  ts =
+    probe_phase_end(result, PHASE_PROTOCOL_LOOKUP, 0, ts, proto == NULL);
 
   if (inet_aton(ipv4, &addr) == 0) {
-    return INVALID_IP;
+    return probe_finish(result, start, INVALID_IP);
   }
 
   if (proto == NULL) {
-#ifdef DEBUG
-    fprintf(stderr, "Unknown protocol: %s\n", protocol);
-#endif
-    return UNKNOWN_PROTOCOL;
+    return probe_finish(result, start, UNKNOWN_PROTOCOL);
   }
 
-#ifdef DEBUG
-  print_config();
-  print_protoent(proto);
-#endif
-
+  ts = probe_now_ns();
   host_ent = gethostbyaddr(&addr, sizeof(struct in_addr), AF_INET);
+  probe_phase_end(
+    result, PHASE_HOST_RESOLUTION, 0, ts, host_ent == NULL ? h_errno : 0);
 
   if (host_ent == NULL) {
-    switch (h_errno) {
-      case HOST_NOT_FOUND: {
-#ifdef DEBUG
-        fprintf(stderr, "Host by ip \"%s\" is not found\n", ipv4);
-#endif
-        return UNKNOWN_HOST;
-      }
-      case TRY_AGAIN: {
-#ifdef DEBUG
-        fprintf(
-          stderr, "Host by ip \"%s\" is not found. Try again later\n", ipv4);
-#endif
-        return UNAVAILABLE;
-      }
-      case NO_RECOVERY: {
-#ifdef DEBUG
-        fprintf(stderr, "Non recoverable error\n");
-#endif
-        return UNAVAILABLE;
-      }
-      case NO_DATA: {
-#ifdef DEBUG
-        fprintf(stderr, "No data record of requested ip \"%s\"\n", ipv4);
-#endif
-        return UNAVAILABLE;
-      }
-    }
+    return probe_finish(result, start, host_lookup_failure(h_errno));
   }
 
-#ifdef DEBUG
-  print_hostent(host_ent);
-#endif
-
   if (host_ent->h_addrtype != AF_INET) {
     fprintf(stderr, "Only IPv4 is supported\n");
     exit(EXIT_FAILURE);
@@ -250,199 +586,221 @@ ipv4_port_probe(char* ipv4, in_port_t port, char* protocol)
   sockaddr.sin_family = PF_INET;
   sockaddr.sin_port = htons(port);
 
-  return probe(&sockaddr, proto);
+  return probe_finish(result,
+                      start,
+                      probe((struct sockaddr*)&sockaddr,
+                            sizeof(struct sockaddr_in),
+                            1,
+                            SOCK_STREAM,
+                            proto->p_proto,
+                            NULL,
+                            result,
+                            &probed));
 }
 
 SERVICE_STATE
-ipv4_service_probe(char* ipv4, char* service, char* protocol)
+ipv4_service_probe_r(char* ipv4,
+                     char* service,
+                     char* protocol,
+                     probe_result_t* result)
 {
+  probe_result_t local_result;
+  uint64_t start = probe_now_ns(), ts = start;
+
+  if (result == NULL) {
+    result = &local_result;
+  }
+
+  memset(result, 0, sizeof(probe_result_t));
+
   if (protocol == NULL) {
     protocol = DEFAULT_SERVICE_PROTOCOL;
   }
 
   struct protoent* proto = getprotobyname(DEFAULT_SERVICE_PROTOCOL);
+  ts =
+    probe_phase_end(result, PHASE_PROTOCOL_LOOKUP, 0, ts, proto == NULL);
+
   struct hostent* host_ent;
   struct servent* serv_ent = getservbyname(service, DEFAULT_SERVICE_PROTOCOL);
   struct sockaddr_in sockaddr;
   struct in_addr addr;
+  size_t probed;
+
+  probe_phase_end(result, PHASE_SERVICE_LOOKUP, 0, ts, serv_ent == NULL);
 
   if (inet_aton(ipv4, &addr) == 0) {
-    return INVALID_IP;
+    return probe_finish(result, start, INVALID_IP);
   }
 
   if (proto == NULL) {
-#ifdef DEBUG
-    fprintf(stderr, "Unknown protocol: %s\n", protocol);
-#endif
-    return UNKNOWN_PROTOCOL;
+    return probe_finish(result, start, UNKNOWN_PROTOCOL);
   }
 
-#ifdef DEBUG
-  print_config();
-  print_protoent(proto);
-#endif
-
+  ts = probe_now_ns();
   host_ent = gethostbyaddr(&addr, sizeof(struct in_addr), AF_INET);
+  probe_phase_end(
+    result, PHASE_HOST_RESOLUTION, 0, ts, host_ent == NULL ? h_errno : 0);
 
   if (host_ent == NULL) {
-    switch (h_errno) {
-      case HOST_NOT_FOUND: {
-#ifdef DEBUG
-        fprintf(stderr, "Host by ip \"%s\" is not found\n", ipv4);
-#endif
-        return UNKNOWN_HOST;
-      }
-      case TRY_AGAIN: {
-#ifdef DEBUG
-        fprintf(
-          stderr, "Host by ip \"%s\" is not found. Try again later\n", ipv4);
-#endif
-        return UNAVAILABLE;
-      }
-      case NO_RECOVERY: {
-#ifdef DEBUG
-        fprintf(stderr, "Non recoverable error\n");
-#endif
-        return UNAVAILABLE;
-      }
-      case NO_DATA: {
-#ifdef DEBUG
-        fprintf(stderr, "No data record of requested ip \"%s\"\n", ipv4);
-#endif
-        return UNAVAILABLE;
-      }
-    }
+    return probe_finish(result, start, host_lookup_failure(h_errno));
   }
 
-#ifdef DEBUG
-  print_hostent(host_ent);
-#endif
-
   if (host_ent->h_addrtype != AF_INET) {
     fprintf(stderr, "Only IPv4 is supported\n");
     exit(EXIT_FAILURE);
   }
 
   if (serv_ent == NULL) {
-#ifdef DEBUG
-    fprintf(stderr, "Invalid service: %s\n", service);
-#endif
-    return UNKNOWN_SERVICE;
+    return probe_finish(result, start, UNKNOWN_SERVICE);
   }
 
-#ifdef DEBUG
-  print_servent(serv_ent);
-#endif
-
   sockaddr.sin_addr = addr;
   sockaddr.sin_family = PF_INET;
   sockaddr.sin_port = serv_ent->s_port;
 
-  return probe(&sockaddr, proto);
+  return probe_finish(result,
+                      start,
+                      probe((struct sockaddr*)&sockaddr,
+                            sizeof(struct sockaddr_in),
+                            1,
+                            SOCK_STREAM,
+                            proto->p_proto,
+                            NULL,
+                            result,
+                            &probed));
 }
 
 SERVICE_STATE
-host_service_probe(char* host, char* service, char* protocol)
+host_service_probe_r(char* host,
+                     char* service,
+                     char* protocol,
+                     probe_result_t* result)
 {
+  probe_result_t local_result;
+  uint64_t start = probe_now_ns(), ts = start;
+
+  if (result == NULL) {
+    result = &local_result;
+  }
+
+  memset(result, 0, sizeof(probe_result_t));
+
   if (protocol == NULL) {
     protocol = DEFAULT_SERVICE_PROTOCOL;
   }
 
   struct protoent* proto = getprotobyname(protocol);
-  struct hostent* host_ent = gethostbyname(host);
+  ts =
+    probe_phase_end(result, PHASE_PROTOCOL_LOOKUP, 0, ts, proto == NULL);
+
+  // Service goes first, the port is part of the cache key
   struct servent* serv_ent = getservbyname(service, protocol);
-  struct sockaddr_in sockaddr;
+  probe_phase_end(result, PHASE_SERVICE_LOOKUP, 0, ts, serv_ent == NULL);
 
   if (proto == NULL) {
-#ifdef DEBUG
-    fprintf(stderr, "Unknown protocol: %s\n", protocol);
-#endif
-    return UNKNOWN_PROTOCOL;
-  }
-
-#ifdef DEBUG
-  print_config();
-  print_protoent(proto);
-#endif
-
-  if (host_ent == NULL) {
-#ifdef DEBUG
-    fprintf(stderr, "Invalid host: %s\n", host);
-#endif
-    return UNKNOWN_HOST;
+    return probe_finish(result, start, UNKNOWN_PROTOCOL);
   }
 
   if (serv_ent == NULL) {
-#ifdef DEBUG
-    fprintf(stderr, "Invalid service: %s\n", service);
-#endif
-    return UNKNOWN_SERVICE;
-  }
-
-#ifdef DEBUG
-  print_hostent(host_ent);
-#endif
-
-  if (host_ent->h_addrtype != AF_INET) {
-    fprintf(stderr, "Only IPv4 is supported\n");
-    exit(EXIT_FAILURE);
+    return probe_finish(result, start, UNKNOWN_SERVICE);
   }
 
-#ifdef DEBUG
-  print_servent(serv_ent);
-#endif
-
-  // TODO: check all addresses
-  sockaddr.sin_addr = *(struct in_addr*)host_ent->h_addr;
-  sockaddr.sin_family = PF_INET;
-  sockaddr.sin_port = serv_ent->s_port;
-
-  return probe(&sockaddr, proto);
+  return probe_finish(
+    result, start, host_probe(host, ntohs(serv_ent->s_port), proto, result));
 }
 
 SERVICE_STATE
-host_port_probe(char* host, in_port_t port, char* protocol)
+host_port_probe_r(char* host,
+                  in_port_t port,
+                  char* protocol,
+                  probe_result_t* result)
 {
+  probe_result_t local_result;
+  uint64_t start = probe_now_ns(), ts = start;
+
+  if (result == NULL) {
+    result = &local_result;
+  }
+
+  memset(result, 0, sizeof(probe_result_t));
+
   if (protocol == NULL) {
     protocol = DEFAULT_SERVICE_PROTOCOL;
   }
 
   struct protoent* proto = getprotobyname(protocol);
-  struct hostent* host_ent = gethostbyname(host);
-  struct sockaddr_in sockaddr;
+  probe_phase_end(result, PHASE_PROTOCOL_LOOKUP, 0, ts, proto == NULL);
 
   if (proto == NULL) {
-#ifdef DEBUG
-    fprintf(stderr, "Unknown protocol: %s\n", protocol);
-#endif
-    return UNKNOWN_PROTOCOL;
+    return probe_finish(result, start, UNKNOWN_PROTOCOL);
   }
 
-#ifdef DEBUG
-  print_config();
-  print_protoent(proto);
-#endif
+  return probe_finish(result, start, host_probe(host, port, proto, result));
+}
 
-  if (host_ent == NULL) {
-#ifdef DEBUG
-    fprintf(stderr, "Invalid host: %s\n", host);
-#endif
-    return UNKNOWN_HOST;
+SERVICE_STATE
+unix_probe_r(char* path, int type, probe_result_t* result)
+{
+  probe_result_t local_result;
+  struct sockaddr_storage sockaddr;
+  socklen_t addrlen;
+  size_t probed;
+  uint64_t start = probe_now_ns();
+
+  if (result == NULL) {
+    result = &local_result;
   }
 
-#ifdef DEBUG
-  print_hostent(host_ent);
-#endif
+  memset(result, 0, sizeof(probe_result_t));
 
-  if (host_ent->h_addrtype != AF_INET) {
-    fprintf(stderr, "Only IPv4 is supported\n");
-    exit(EXIT_FAILURE);
+  if (type != SOCK_STREAM && type != SOCK_SEQPACKET) {
+    return probe_finish(result, start, UNKNOWN_PROTOCOL);
   }
 
-  // TODO: check all addresses
-  sockaddr.sin_addr = *(struct in_addr*)host_ent->h_addr;
-  sockaddr.sin_family = PF_INET;
-  sockaddr.sin_port = htons(port);
+  if (!probe_unix_addr(path, &sockaddr, &addrlen)) {
+    return probe_finish(result, start, INVALID_PATH);
+  }
+
+  // No lookups and no cache, the path is the address
+  return probe_finish(result,
+                      start,
+                      probe((struct sockaddr*)&sockaddr,
+                            addrlen,
+                            1,
+                            type,
+                            0,
+                            NULL,
+                            result,
+                            &probed));
+}
+
+SERVICE_STATE
+ipv4_port_probe(char* ipv4, in_port_t port, char* protocol)
+{
+  return ipv4_port_probe_r(ipv4, port, protocol, NULL);
+}
 
-  return probe(&sockaddr, proto);
+SERVICE_STATE
+ipv4_service_probe(char* ipv4, char* service, char* protocol)
+{
+  return ipv4_service_probe_r(ipv4, service, protocol, NULL);
+}
+
+SERVICE_STATE
+host_service_probe(char* host, char* service, char* protocol)
+{
+  return host_service_probe_r(host, service, protocol, NULL);
+}
+
+SERVICE_STATE
+host_port_probe(char* host, in_port_t port, char* protocol)
+{
+  return host_port_probe_r(host, port, protocol, NULL);
+}
+
+SERVICE_STATE
+unix_probe(char* path, int type)
+{
+  return unix_probe_r(path, type, NULL);
 }
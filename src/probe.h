@@ -22,17 +22,186 @@ typedef enum SERVICE_STATE
   UNKNOWN_HOST,
   UNKNOWN_SERVICE,
   INVALID_IP,
+  // Probing was stopped before the verdict, see `probe_quorum`
+  CANCELLED,
+  // Connected, but TLS handshake or certificate verification failed
+  HANDSHAKE_FAILED,
+  // Certificate expires sooner than `probe_config_tls` allows
+  CERTIFICATE_EXPIRING,
+  // Connected, but the gRPC health check failed or didn't report SERVING
+  NOT_SERVING,
+  // Unix socket path is empty or doesn't fit `sun_path`
+  INVALID_PATH,
 } SERVICE_STATE;
 
+typedef enum PROBE_PHASE
+{
+  PHASE_PROTOCOL_LOOKUP,
+  PHASE_SERVICE_LOOKUP,
+  PHASE_HOST_RESOLUTION,
+  PHASE_SOCKET_CREATION,
+  PHASE_CONNECT,
+  PHASE_BACKOFF,
+  PHASE_CLOSE,
+  // Waiting for the engine rate limits, see `probe_engine_conf_t`
+  PHASE_PACING,
+  PHASE_HANDSHAKE,
+  // gRPC health check call, see `probe_config_grpc`
+  PHASE_RPC,
+  PHASE_COUNT,
+} PROBE_PHASE;
+
 typedef struct probe_conf
 {
   size_t retry_count;
   size_t timeout;
+  bool tcp_info;
+  // Concurrent probing limits, see `probe_config_limits`
+  uint32_t rate;
+  uint32_t burst;
+  uint32_t per_host;
+  uint32_t per_subnet;
+  // TLS handshake after connect, see `probe_config_tls`
+  bool tls;
+  const char* tls_server_name;
+  const char* tls_ca_file;
+  uint32_t tls_expiry_days;
+  // gRPC health check after connect, see `probe_config_grpc`
+  bool grpc;
+  const char* grpc_service;
 } probe_conf_t;
 
+// Only the first attempts get their own slot, later ones are still summed
+// into `phase_ns[PHASE_CONNECT]`
+#define MAX_TRACKED_ATTEMPTS 16
+
+typedef struct probe_timings
+{
+  uint64_t phase_ns[PHASE_COUNT];
+  uint64_t attempt_ns[MAX_TRACKED_ATTEMPTS];
+  size_t attempts;
+  uint64_t total_ns;
+} probe_timings_t;
+
+// Kernel view of the connection, read with `TCP_INFO` right before close
+typedef struct probe_tcp_info
+{
+  bool valid;
+  uint32_t rtt_us;
+  uint32_t rttvar_us;
+  uint32_t retransmits;
+  uint32_t pmtu;
+  uint32_t snd_mss;
+  uint32_t snd_cwnd;
+} probe_tcp_info_t;
+
+#define TLS_VERSION_LEN 16
+#define TLS_CIPHER_LEN 64
+#define TLS_ERROR_LEN 128
+
+typedef struct probe_tls_info
+{
+  // Handshake is completed
+  bool valid;
+  // Abbreviated handshake with a cached session
+  bool resumed;
+  char version[TLS_VERSION_LEN];
+  char cipher[TLS_CIPHER_LEN];
+  // Peer certificate expiry, Unix time
+  int64_t not_after;
+  int64_t days_left;
+  // Why the handshake or the certificate check failed
+  char error[TLS_ERROR_LEN];
+} probe_tls_info_t;
+
+#define GRPC_MESSAGE_LEN 128
+
+typedef enum GRPC_SERVING_STATUS
+{
+  GRPC_UNKNOWN,
+  GRPC_SERVING,
+  GRPC_NOT_SERVING,
+  GRPC_SERVICE_UNKNOWN,
+} GRPC_SERVING_STATUS;
+
+typedef struct probe_grpc_info
+{
+  // Response is received
+  bool valid;
+  uint32_t http_status;
+  // -1 when the server sent none
+  int32_t grpc_status;
+  // `GRPC_SERVING_STATUS` of the response, -1 without one
+  int32_t serving_status;
+  // `grpc-message` or why the check failed
+  char message[GRPC_MESSAGE_LEN];
+} probe_grpc_info_t;
+
+typedef struct probe_result
+{
+  SERVICE_STATE state;
+  probe_timings_t timings;
+  probe_tcp_info_t tcp_info;
+  probe_tls_info_t tls;
+  probe_grpc_info_t grpc;
+} probe_result_t;
+
+typedef struct probe_trace_event
+{
+  PROBE_PHASE phase;
+  // 0 based connect attempt, only meaningful for connect & backoff phases
+  size_t attempt;
+  uint64_t elapsed_ns;
+  // `errno` or `h_errno` of the failed call when there is one, non zero on
+  // failure and 0 on success
+  int error;
+} probe_trace_event_t;
+
+typedef void (*probe_trace_fn)(const probe_trace_event_t* event, void* data);
+
 void
 probe_config(size_t retry_count, size_t timeout);
 
+// Capture `TCP_INFO` of successful connects into `probe_result_t`
+void
+probe_config_tcp_info(bool enable);
+
+// Connect attempts per second (`burst` of them at once) and attempts in
+// flight to one address & to one /24 for concurrent probing, 0 for no limit.
+// Caps of destinations refusing or timing out are lowered
+void
+probe_config_limits(uint32_t rate,
+                    uint32_t burst,
+                    uint32_t per_host,
+                    uint32_t per_subnet);
+
+// Complete TLS handshake over every connection. `server_name` is sent as SNI
+// and checked against the certificate (host name of the blocking probes by
+// default), `ca_file` replaces the system CA bundle when not NULL. Fails the
+// probe when the certificate expires in less than `expiry_days`. Sessions are
+// cached per address & server name and resumed by later blocking and engine
+// probes of the process. Strings must outlive probing. Returns false when
+// built without TLS support
+bool
+probe_config_tls(bool enable,
+                 const char* server_name,
+                 const char* ca_file,
+                 uint32_t expiry_days);
+
+// Call `grpc.health.v1.Health/Check` for `service` (NULL or empty for the
+// server as a whole) over cleartext HTTP/2 on every connection. Only
+// `SERVING` is available. The string must outlive probing, TLS isn't used
+// for the call
+void
+probe_config_grpc(bool enable, const char* service);
+
+// Pass NULL to disable tracing
+void
+probe_trace(probe_trace_fn fn, void* data);
+
+const char*
+probe_phase_name(PROBE_PHASE phase);
+
 SERVICE_STATE
 ipv4_port_probe(char* ipv4, in_port_t port, char* protocol);
 
@@ -45,6 +214,39 @@ host_service_probe(char* host, char* service, char* protocol);
 SERVICE_STATE
 host_port_probe(char* host, in_port_t port, char* protocol);
 
+// Unix domain socket at `path`, `@name` for the abstract namespace. `type` is
+// `SOCK_STREAM` or `SOCK_SEQPACKET`
+SERVICE_STATE
+unix_probe(char* path, int type);
+
+// `_r` variants also fill `result` (may be NULL) with per phase timings
+SERVICE_STATE
+ipv4_port_probe_r(char* ipv4,
+                  in_port_t port,
+                  char* protocol,
+                  probe_result_t* result);
+
+SERVICE_STATE
+ipv4_service_probe_r(char* ipv4,
+                     char* service,
+                     char* protocol,
+                     probe_result_t* result);
+
+SERVICE_STATE
+host_service_probe_r(char* host,
+                     char* service,
+                     char* protocol,
+                     probe_result_t* result);
+
+SERVICE_STATE
+host_port_probe_r(char* host,
+                  in_port_t port,
+                  char* protocol,
+                  probe_result_t* result);
+
+SERVICE_STATE
+unix_probe_r(char* path, int type, probe_result_t* result);
+
 char*
 probe_version();
 
@@ -0,0 +1,360 @@
+#include "range.h"
+#include <arpa/inet.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FEISTEL_ROUNDS 4
+
+// splitmix64 finalizer, good enough as a Feistel round function
+static uint64_t
+mix(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+
+  return x;
+}
+
+static uint64_t
+feistel(const probe_range_t* range, unsigned half_bits, uint64_t x)
+{
+  uint64_t mask = (1ull << half_bits) - 1;
+  uint64_t left = x >> half_bits, right = x & mask;
+
+  for (size_t i = 0; i < FEISTEL_ROUNDS; ++i) {
+    uint64_t next = left ^ (mix(right ^ range->keys[i]) & mask);
+
+    left = right;
+    right = next;
+  }
+
+  return (left << half_bits) | right;
+}
+
+// Half the bits of the power of 4 enclosing `size`, at least 1
+static unsigned
+half_bits_of(uint64_t size)
+{
+  unsigned half_bits = 1;
+
+  while ((1ull << (2 * half_bits)) < size) {
+    half_bits++;
+  }
+
+  return half_bits;
+}
+
+// Bijection of `[0, size)`: the Feistel network permutes the enclosing power
+// of 4 and values out of the range are walked until they get back in
+static uint64_t
+permute(const probe_range_t* range,
+        unsigned half_bits,
+        uint64_t size,
+        uint64_t index)
+{
+  do {
+    index = feistel(range, half_bits, index);
+  } while (index >= size);
+
+  return index;
+}
+
+static bool
+parse_ports(probe_range_t* range, char* ports, in_port_t default_port)
+{
+  char* end;
+
+  if (ports == NULL || *ports == '\0') {
+    if (default_port == 0) {
+      return false;
+    }
+
+    range->spans[0].first = range->spans[0].last = default_port;
+    range->span_count = 1;
+    range->ports = 1;
+
+    return true;
+  }
+
+  for (;;) {
+    probe_port_span_t* span = &range->spans[range->span_count];
+    unsigned long first = strtoul(ports, &end, 10), last = first;
+
+    if (end == ports || range->span_count == RANGE_MAX_PORT_SPANS) {
+      return false;
+    }
+
+    if (*end == '-') {
+      ports = end + 1;
+      last = strtoul(ports, &end, 10);
+
+      if (end == ports) {
+        return false;
+      }
+    }
+
+    if (first == 0 || first > last || last > UINT16_MAX) {
+      return false;
+    }
+
+    span->first = (in_port_t)first;
+    span->last = (in_port_t)last;
+    range->span_count++;
+    range->ports += last - first + 1;
+
+    if (*end == '\0') {
+      return true;
+    }
+
+    if (*end != ',') {
+      return false;
+    }
+
+    ports = end + 1;
+  }
+}
+
+// Parses the address & zeroes its host bits
+static bool
+parse_base(probe_range_t* range, const char* addr, unsigned long prefix)
+{
+  struct sockaddr_in* sin = (struct sockaddr_in*)&range->base;
+  struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&range->base;
+  uint8_t* bytes;
+  unsigned bits;
+
+  if (inet_pton(AF_INET, addr, &sin->sin_addr) == 1) {
+    sin->sin_family = AF_INET;
+    range->addrlen = sizeof(struct sockaddr_in);
+    bytes = (uint8_t*)&sin->sin_addr;
+    bits = 32;
+  } else if (inet_pton(AF_INET6, addr, &sin6->sin6_addr) == 1) {
+    sin6->sin6_family = AF_INET6;
+    range->addrlen = sizeof(struct sockaddr_in6);
+    bytes = sin6->sin6_addr.s6_addr;
+    bits = 128;
+  } else {
+    return false;
+  }
+
+  if (prefix == ULONG_MAX) {
+    prefix = bits;
+  }
+
+  if (prefix > bits || bits - prefix > 62) {
+    return false;
+  }
+
+  range->host_bits = bits - (unsigned)prefix;
+
+  for (unsigned bit = (unsigned)prefix; bit < bits; ++bit) {
+    bytes[bit / 8] &= (uint8_t) ~(0x80u >> (bit % 8));
+  }
+
+  return true;
+}
+
+bool
+probe_range_parse(probe_range_t* range,
+                  const char* spec,
+                  in_port_t default_port,
+                  uint64_t seed)
+{
+  char buf[RANGE_SPEC_LEN + 1];
+  char *addr = buf, *rest, *slash, *end;
+  unsigned long prefix = ULONG_MAX;
+  uint64_t hosts;
+
+  memset(range, 0, sizeof(probe_range_t));
+
+  if (strlen(spec) > RANGE_SPEC_LEN) {
+    return false;
+  }
+
+  strcpy(buf, spec);
+
+  // IPv6 has to be bracketed to tell its colons from the ports one
+  if (*buf == '[') {
+    addr = buf + 1;
+    rest = strchr(addr, ']');
+
+    if (rest == NULL) {
+      return false;
+    }
+
+    *rest++ = '\0';
+  } else {
+    rest = strchr(buf, ':');
+    rest = rest != NULL ? rest : buf + strlen(buf);
+  }
+
+  if (*rest == '/') {
+    *rest++ = '\0';
+    slash = rest - 1;
+  } else {
+    slash = strchr(addr, '/');
+  }
+
+  if (slash != NULL) {
+    *slash = '\0';
+    prefix = strtoul(slash + 1, &end, 10);
+
+    if (end == slash + 1 || (*end != '\0' && *end != ':')) {
+      return false;
+    }
+
+    // Prefix inside the brackets ends the address, not the spec
+    if (end > rest) {
+      rest = end;
+    }
+  }
+
+  if (*rest == ':') {
+    *rest++ = '\0';
+  } else if (*rest != '\0') {
+    return false;
+  }
+
+  if (!parse_base(range, addr, prefix) ||
+      !parse_ports(range, *rest != '\0' ? rest : NULL, default_port)) {
+    return false;
+  }
+
+  hosts = 1ull << range->host_bits;
+
+  if (__builtin_mul_overflow(hosts, range->ports, &range->size) ||
+      range->size > RANGE_MAX_SIZE) {
+    return false;
+  }
+
+  range->half_bits = half_bits_of(range->size);
+
+  for (size_t i = 0; i < FEISTEL_ROUNDS; ++i) {
+    seed += 0x9e3779b97f4a7c15ull;
+    range->keys[i] = mix(seed);
+  }
+
+  return true;
+}
+
+static void
+pair_target(const probe_range_t* range, uint64_t pair, probe_target_t* target)
+{
+  uint64_t host = pair / range->ports, port = pair % range->ports;
+  const probe_port_span_t* span = range->spans;
+  uint8_t* bytes;
+  size_t len;
+
+  memset(target, 0, sizeof(probe_target_t));
+  memcpy(&target->addr, &range->base, range->addrlen);
+  target->addrlen = range->addrlen;
+  target->result.state = CANCELLED;
+
+  while (port > (uint64_t)(span->last - span->first)) {
+    port -= span->last - span->first + 1u;
+    span++;
+  }
+
+  if (range->base.ss_family == AF_INET) {
+    struct sockaddr_in* sin = (struct sockaddr_in*)&target->addr;
+
+    sin->sin_port = htons((in_port_t)(span->first + port));
+    bytes = (uint8_t*)&sin->sin_addr;
+    len = 4;
+  } else {
+    struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&target->addr;
+
+    sin6->sin6_port = htons((in_port_t)(span->first + port));
+    bytes = sin6->sin6_addr.s6_addr;
+    len = 16;
+  }
+
+  // Host bits are zero in the base, no carries
+  for (size_t i = len; i > 0 && host != 0; --i, host >>= 8) {
+    bytes[i - 1] |= (uint8_t)host;
+  }
+}
+
+void
+probe_range_target(const probe_range_t* range,
+                   uint64_t index,
+                   probe_target_t* target)
+{
+  pair_target(
+    range, permute(range, range->half_bits, range->size, index), target);
+}
+
+// Hosts sharing a destination: a single one, or a /24 (IPv4) or /64 (IPv6)
+// subnet, which a range past /64 is entirely in
+static unsigned
+group_bits(const probe_range_t* range, bool per_subnet)
+{
+  if (!per_subnet) {
+    return 0;
+  }
+
+  if (range->base.ss_family == AF_INET6 || range->host_bits < 8) {
+    return range->host_bits;
+  }
+
+  return 8;
+}
+
+uint64_t
+probe_range_partition_size(const probe_range_t* range,
+                           bool per_subnet,
+                           uint64_t partitions,
+                           uint64_t partition)
+{
+  unsigned bits = group_bits(range, per_subnet);
+  uint64_t groups = 1ull << (range->host_bits - bits);
+
+  // Groups `partition`, `partition + partitions` & so on
+  if (partition >= groups) {
+    return 0;
+  }
+
+  return (((groups - partition - 1) / partitions + 1) << bits) * range->ports;
+}
+
+void
+probe_range_partition_target(const probe_range_t* range,
+                             bool per_subnet,
+                             uint64_t partitions,
+                             uint64_t partition,
+                             uint64_t index,
+                             probe_target_t* target)
+{
+  unsigned bits = group_bits(range, per_subnet);
+  uint64_t size =
+    probe_range_partition_size(range, per_subnet, partitions, partition);
+  uint64_t group_size = (1ull << bits) * range->ports;
+  uint64_t pair = permute(range, half_bits_of(size), size, index);
+  uint64_t group = partition + pair / group_size * partitions;
+
+  pair = (group << bits) * range->ports + pair % group_size;
+  pair_target(range, pair, target);
+}
+
+void
+probe_range_iter_init(probe_range_iter_t* iter, const probe_range_t* range)
+{
+  iter->range = range;
+  iter->next = 0;
+}
+
+bool
+probe_range_next(probe_range_iter_t* iter, probe_target_t* target)
+{
+  if (iter->next == iter->range->size) {
+    return false;
+  }
+
+  probe_range_target(iter->range, iter->next++, target);
+
+  return true;
+}
@@ -0,0 +1,83 @@
+#ifndef PROBE_RANGE_H
+#define PROBE_RANGE_H
+
+#include "engine.h"
+
+#define RANGE_MAX_PORT_SPANS 32
+#define RANGE_SPEC_LEN 255
+// Address & port pairs of a single range
+#define RANGE_MAX_SIZE (1ull << 62)
+
+typedef struct probe_port_span
+{
+  in_port_t first;
+  in_port_t last;
+} probe_port_span_t;
+
+// `ADDRESS[/PREFIX][:PORTS]` or `[IPV6][/PREFIX][:PORTS]` target set, where
+// `PORTS` is a comma separated list of ports & `FIRST-LAST` spans. Targets
+// are never materialized, the n-th one is computed on demand
+typedef struct probe_range
+{
+  // Network address, host bits are zeroed
+  struct sockaddr_storage base;
+  socklen_t addrlen;
+  unsigned host_bits;
+  probe_port_span_t spans[RANGE_MAX_PORT_SPANS];
+  size_t span_count;
+  uint64_t ports;
+  uint64_t size;
+  // Feistel permutation over `[0, 2^(2 * half_bits))`
+  unsigned half_bits;
+  uint64_t keys[4];
+} probe_range_t;
+
+typedef struct probe_range_iter
+{
+  const probe_range_t* range;
+  uint64_t next;
+} probe_range_iter_t;
+
+// `default_port` is used when the spec has no ports, 0 to require them.
+// The same `seed` gives the same order. Returns false on invalid spec or
+// more than `RANGE_MAX_SIZE` targets
+bool
+probe_range_parse(probe_range_t* range,
+                  const char* spec,
+                  in_port_t default_port,
+                  uint64_t seed);
+
+// `index`-th target of the randomized order, `index` must be less than the
+// range size. The target is ready to be probed like after `probe_target_init`
+void
+probe_range_target(const probe_range_t* range,
+                   uint64_t index,
+                   probe_target_t* target);
+
+// Targets of `partition` out of `partitions`. Ranges are partitioned by host,
+// or by subnet with `per_subnet`, so all the targets of a destination cap are
+// in the same partition
+uint64_t
+probe_range_partition_size(const probe_range_t* range,
+                           bool per_subnet,
+                           uint64_t partitions,
+                           uint64_t partition);
+
+// `index`-th target of `partition` in a randomized order of its own, `index`
+// must be less than the partition size
+void
+probe_range_partition_target(const probe_range_t* range,
+                             bool per_subnet,
+                             uint64_t partitions,
+                             uint64_t partition,
+                             uint64_t index,
+                             probe_target_t* target);
+
+void
+probe_range_iter_init(probe_range_iter_t* iter, const probe_range_t* range);
+
+// Returns false when the range is over
+bool
+probe_range_next(probe_range_iter_t* iter, probe_target_t* target);
+
+#endif
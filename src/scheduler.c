@@ -0,0 +1,263 @@
+#include "scheduler.h"
+#include "internal.h"
+#include "table.h"
+#include "wheel.h"
+#include <poll.h>
+#include <stdlib.h>
+
+// Per target scheduling state, the address is a row of `targets` & the due
+// time is in the wheel
+typedef struct schedule
+{
+  void* data;
+  uint32_t interval_ms;
+  uint32_t jitter_ms;
+  uint32_t connect_timeout_ms;
+} schedule_t;
+
+struct probe_scheduler
+{
+  probe_engine_t* engine;
+  probe_wheel_t* wheel;
+  probe_table_t* targets;
+  schedule_t* schedules;
+  size_t capacity;
+  size_t count;
+  // Targets in flight are expanded into slots, one per engine slot
+  probe_target_t* slots;
+  uint32_t* slot_ids;
+  uint32_t* free_slots;
+  size_t free_count;
+  // Due targets the engine had no room for, FIFO
+  uint32_t* queue;
+  size_t queue_head;
+  size_t queue_len;
+  uint64_t rng;
+  probe_done_fn done;
+  void* done_data;
+};
+
+// xorshift64, jitter needs no quality but has to be cheap
+static uint32_t
+next_random(probe_scheduler_t* scheduler)
+{
+  uint64_t x = scheduler->rng;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  scheduler->rng = x;
+
+  return (uint32_t)(x >> 32);
+}
+
+static void
+expand_target(probe_scheduler_t* scheduler,
+              uint32_t id,
+              probe_target_t* target)
+{
+  probe_table_target(scheduler->targets, id, target);
+  target->connect_timeout_ms = scheduler->schedules[id].connect_timeout_ms;
+  target->data = scheduler->schedules[id].data;
+}
+
+static void
+start_probe(probe_scheduler_t* scheduler, uint32_t id)
+{
+  uint32_t slot, tail;
+
+  // Engine has a free slot, so does the scheduler
+  if (scheduler->free_count > 0) {
+    slot = scheduler->free_slots[--scheduler->free_count];
+    scheduler->slot_ids[slot] = id;
+    expand_target(scheduler, id, &scheduler->slots[slot]);
+    probe_engine_submit(scheduler->engine, &scheduler->slots[slot]);
+    return;
+  }
+
+  tail = (uint32_t)((scheduler->queue_head + scheduler->queue_len++) %
+                    scheduler->capacity);
+  scheduler->queue[tail] = id;
+}
+
+static void
+on_due(uint32_t id, void* data)
+{
+  start_probe(data, id);
+}
+
+static void
+on_done(probe_target_t* target, void* data)
+{
+  probe_scheduler_t* scheduler = data;
+  uint32_t slot = (uint32_t)(target - scheduler->slots);
+  uint32_t id = scheduler->slot_ids[slot];
+  schedule_t* schedule = &scheduler->schedules[id];
+  // Rounded up, checks are never closer than the interval
+  uint64_t next =
+    (probe_now_ns() + NS_IN_MS - 1) / NS_IN_MS + schedule->interval_ms;
+
+  if (schedule->jitter_ms != 0) {
+    next += next_random(scheduler) % (schedule->jitter_ms + 1);
+  }
+
+  probe_wheel_schedule(scheduler->wheel, id, next);
+  probe_table_store(scheduler->targets, id, &target->result);
+
+  if (scheduler->done != NULL) {
+    scheduler->done(target, scheduler->done_data);
+  }
+
+  scheduler->free_slots[scheduler->free_count++] = slot;
+
+  // The engine has a free slot now
+  if (scheduler->queue_len > 0) {
+    uint32_t queued = scheduler->queue[scheduler->queue_head];
+
+    scheduler->queue_head = (scheduler->queue_head + 1) % scheduler->capacity;
+    scheduler->queue_len--;
+    start_probe(scheduler, queued);
+  }
+}
+
+probe_scheduler_t*
+probe_scheduler_create(size_t capacity,
+                       size_t max_active,
+                       const probe_engine_conf_t* conf)
+{
+  probe_scheduler_t* scheduler = calloc(1, sizeof(probe_scheduler_t));
+
+  if (scheduler == NULL) {
+    return NULL;
+  }
+
+  scheduler->engine = probe_engine_create(max_active, conf);
+  scheduler->wheel = probe_wheel_create(capacity, probe_now_ns() / NS_IN_MS);
+  scheduler->targets = probe_table_create(capacity);
+  scheduler->schedules = calloc(capacity, sizeof(schedule_t));
+  scheduler->slots = calloc(max_active, sizeof(probe_target_t));
+  scheduler->slot_ids = calloc(max_active, sizeof(uint32_t));
+  scheduler->free_slots = calloc(max_active, sizeof(uint32_t));
+  scheduler->queue = calloc(capacity, sizeof(uint32_t));
+  scheduler->capacity = capacity;
+  scheduler->rng = 0x9e3779b97f4a7c15ull;
+
+  if (scheduler->engine == NULL || scheduler->wheel == NULL ||
+      scheduler->targets == NULL || scheduler->schedules == NULL ||
+      scheduler->slots == NULL || scheduler->slot_ids == NULL ||
+      scheduler->free_slots == NULL || scheduler->queue == NULL) {
+    probe_scheduler_destroy(scheduler);
+    return NULL;
+  }
+
+  while (scheduler->free_count < max_active) {
+    scheduler->free_slots[scheduler->free_count] =
+      (uint32_t)scheduler->free_count;
+    scheduler->free_count++;
+  }
+
+  return scheduler;
+}
+
+void
+probe_scheduler_destroy(probe_scheduler_t* scheduler)
+{
+  if (scheduler == NULL) {
+    return;
+  }
+
+  probe_engine_destroy(scheduler->engine);
+  probe_wheel_destroy(scheduler->wheel);
+  free(scheduler->queue);
+  free(scheduler->free_slots);
+  free(scheduler->slot_ids);
+  free(scheduler->slots);
+  free(scheduler->schedules);
+  probe_table_destroy(scheduler->targets);
+  free(scheduler);
+}
+
+bool
+probe_scheduler_add(probe_scheduler_t* scheduler,
+                    const probe_target_t* target,
+                    uint32_t interval_ms,
+                    uint32_t jitter_ms)
+{
+  uint32_t id;
+  uint64_t offset = 0;
+
+  if (scheduler->count == scheduler->capacity ||
+      !probe_table_add(scheduler->targets, target)) {
+    return false;
+  }
+
+  id = (uint32_t)scheduler->count++;
+  scheduler->schedules[id].data = target->data;
+  scheduler->schedules[id].interval_ms = interval_ms;
+  scheduler->schedules[id].jitter_ms = jitter_ms;
+  scheduler->schedules[id].connect_timeout_ms = target->connect_timeout_ms;
+
+  // Golden ratio stride spreads consecutive ids evenly over the interval
+  if (interval_ms != 0) {
+    offset = ((uint64_t)id * 2654435761u) % interval_ms;
+  }
+
+  probe_wheel_schedule(scheduler->wheel,
+                       id,
+                       (probe_now_ns() + NS_IN_MS - 1) / NS_IN_MS + offset);
+
+  return true;
+}
+
+size_t
+probe_scheduler_count(probe_scheduler_t* scheduler)
+{
+  return scheduler->count;
+}
+
+void
+probe_scheduler_target(probe_scheduler_t* scheduler,
+                       size_t id,
+                       probe_target_t* target)
+{
+  expand_target(scheduler, (uint32_t)id, target);
+}
+
+size_t
+probe_scheduler_id(probe_scheduler_t* scheduler, const probe_target_t* target)
+{
+  return scheduler->slot_ids[target - scheduler->slots];
+}
+
+size_t
+probe_scheduler_run(probe_scheduler_t* scheduler,
+                    int timeout_ms,
+                    probe_done_fn done,
+                    void* data)
+{
+  uint64_t now_ms = probe_now_ns() / NS_IN_MS;
+  int64_t next;
+
+  if (scheduler->count == 0) {
+    return 0;
+  }
+
+  scheduler->done = done;
+  scheduler->done_data = data;
+
+  probe_wheel_advance(scheduler->wheel, now_ms, on_due, scheduler);
+
+  next = probe_wheel_next(scheduler->wheel, now_ms);
+
+  if (next >= 0 && (timeout_ms < 0 || next < timeout_ms)) {
+    timeout_ms = (int)next;
+  }
+
+  if (probe_engine_active(scheduler->engine) == 0) {
+    // Nothing in flight, just sleep till the next due target
+    poll(NULL, 0, timeout_ms);
+    return 0;
+  }
+
+  return probe_engine_run(scheduler->engine, timeout_ms, on_done, scheduler);
+}
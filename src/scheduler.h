@@ -0,0 +1,53 @@
+#ifndef PROBE_SCHEDULER_H
+#define PROBE_SCHEDULER_H
+
+#include "engine.h"
+
+typedef struct probe_scheduler probe_scheduler_t;
+
+// Continuous probing of up to `capacity` targets, each on its own interval.
+// At most `max_active` of them are probed at once, the rest wait their turn.
+// Targets are kept as compact table rows and expanded only while in flight
+probe_scheduler_t*
+probe_scheduler_create(size_t capacity,
+                       size_t max_active,
+                       const probe_engine_conf_t* conf);
+
+void
+probe_scheduler_destroy(probe_scheduler_t* scheduler);
+
+// Packs `target` in, its `data` & connect timeout included. First probes of
+// the targets are spread over their interval, every next one is
+// `interval_ms` plus up to `jitter_ms` later. TLS server names of targets in
+// flight point into the table, so targets are added before the first run.
+// Returns false when the scheduler is full
+bool
+probe_scheduler_add(probe_scheduler_t* scheduler,
+                    const probe_target_t* target,
+                    uint32_t interval_ms,
+                    uint32_t jitter_ms);
+
+size_t
+probe_scheduler_count(probe_scheduler_t* scheduler);
+
+// Targets are numbered in the order they were added. Expands target `id`
+// into `target`, of its last verdict only the state is kept
+void
+probe_scheduler_target(probe_scheduler_t* scheduler,
+                       size_t id,
+                       probe_target_t* target);
+
+// Id of a target passed to `done`
+size_t
+probe_scheduler_id(probe_scheduler_t* scheduler, const probe_target_t* target);
+
+// Starts due probes and waits up to `timeout_ms` (-1 for no limit) for
+// progress, `done` is called for every verdict with the target valid only for
+// the call. Returns the verdict count
+size_t
+probe_scheduler_run(probe_scheduler_t* scheduler,
+                    int timeout_ms,
+                    probe_done_fn done,
+                    void* data);
+
+#endif
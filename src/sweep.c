@@ -0,0 +1,506 @@
+#include "sweep.h"
+#include "deque.h"
+#include "limit.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_MAX_ACTIVE 4096
+#define DEFAULT_BATCH 64
+// Enough for the stolen partitions to even out the workers
+#define PARTITIONS_PER_WORKER 16
+
+typedef struct sweep sweep_t;
+
+// Everything a worker touches on its own, apart from the stolen batches
+typedef struct shard
+{
+  sweep_t* sweep;
+  size_t index;
+  probe_engine_t* engine;
+  probe_deque_t* deque;
+  pthread_t thread;
+  // Batches of range indexes or table rows of this worker nobody has claimed
+  uint64_t cursor;
+  uint64_t limit;
+  // Targets (or range indexes) of the current batch yet to be submitted
+  uint64_t next;
+  uint64_t end;
+  // The current batch is the partition with destination caps
+  uint64_t partition;
+  size_t probed;
+  // Range targets or table rows being probed, one per engine slot
+  probe_target_t* slots;
+  uint32_t* free_slots;
+  size_t free_count;
+  // Table row of every slot
+  uint64_t* slot_rows;
+} shard_t;
+
+struct sweep
+{
+  probe_target_t* targets;
+  // Targets are computed from the range when there is one
+  const probe_range_t* range;
+  // Or expanded from the table rows, verdicts are packed back
+  probe_table_t* table;
+  uint64_t count;
+  const probe_sweep_conf_t* conf;
+  // Limits of a single worker engine
+  probe_engine_conf_t engine_conf;
+  shard_t* shards;
+  size_t workers;
+  // Destinations are capped, every one of them is in a single partition that
+  // is taken or stolen whole, so it's probed by a single worker
+  bool partitioned;
+  uint64_t partitions;
+  // Targets & table rows sorted by partition, those of a partition are
+  // `order[offsets[p]]` to `order[offsets[p + 1] - 1]`. Ranges are
+  // partitioned on the fly instead
+  size_t* order;
+  size_t* offsets;
+  // Batches or partitions neither taken nor stolen yet
+  size_t unclaimed;
+  probe_done_fn done;
+  void* data;
+};
+
+// Range indexes & table rows are all alike, so instead of deques that would
+// grow with the range every worker has a slice of batches. A worker out of
+// its own batches steals from the slices of the others
+static bool
+claim_slice_batch(shard_t* shard)
+{
+  sweep_t* sweep = shard->sweep;
+
+  for (size_t i = 0; i < sweep->workers; ++i) {
+    shard_t* victim = &sweep->shards[(shard->index + i) % sweep->workers];
+    uint64_t batch =
+      __atomic_fetch_add(&victim->cursor, 1, __ATOMIC_RELAXED);
+
+    if (batch >= victim->limit) {
+      continue;
+    }
+
+    shard->next = batch * sweep->conf->batch;
+    shard->end = shard->next + sweep->conf->batch;
+
+    if (shard->end > sweep->count) {
+      shard->end = sweep->count;
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+// Takes an id of the own deque or steals one starting at the neighbour
+static bool
+claim_id(shard_t* shard, uint32_t* id)
+{
+  sweep_t* sweep = shard->sweep;
+  DEQUE_STATE state = probe_deque_take(shard->deque, id);
+  bool retry;
+
+  while (state != DEQUE_OK) {
+    retry = false;
+
+    for (size_t i = 1; i < sweep->workers && state != DEQUE_OK; ++i) {
+      shard_t* victim = &sweep->shards[(shard->index + i) % sweep->workers];
+
+      state = probe_deque_steal(victim->deque, id);
+      retry = retry || state == DEQUE_ABORT;
+    }
+
+    if (state != DEQUE_OK && !retry) {
+      return false;
+    }
+  }
+
+  __atomic_sub_fetch(&sweep->unclaimed, 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+static bool
+claim_batch(shard_t* shard)
+{
+  sweep_t* sweep = shard->sweep;
+  bool per_subnet = sweep->conf->engine.per_subnet != 0;
+  uint32_t id;
+
+  if (!sweep->partitioned && sweep->targets == NULL) {
+    return claim_slice_batch(shard);
+  }
+
+  // Partitions no destination falls into are skipped
+  do {
+    if (!claim_id(shard, &id)) {
+      return false;
+    }
+
+    if (sweep->partitioned && sweep->order != NULL) {
+      shard->next = sweep->offsets[id];
+      shard->end = sweep->offsets[id + 1];
+    } else if (sweep->partitioned) {
+      shard->partition = id;
+      shard->next = 0;
+      shard->end = probe_range_partition_size(
+        sweep->range, per_subnet, sweep->partitions, id);
+    } else {
+      shard->next = (uint64_t)id * sweep->conf->batch;
+      shard->end = shard->next + sweep->conf->batch;
+
+      if (shard->end > sweep->count) {
+        shard->end = sweep->count;
+      }
+    }
+  } while (shard->next == shard->end);
+
+  return true;
+}
+
+static void
+target_done(probe_target_t* target, void* data)
+{
+  shard_t* shard = data;
+  sweep_t* sweep = shard->sweep;
+  uint32_t slot = (uint32_t)(target - shard->slots);
+
+  if (sweep->table != NULL) {
+    probe_table_store(sweep->table, shard->slot_rows[slot], &target->result);
+  }
+
+  if (sweep->done != NULL) {
+    sweep->done(target, sweep->data);
+  }
+
+  if (sweep->range != NULL || sweep->table != NULL) {
+    shard->free_slots[shard->free_count++] = slot;
+  }
+}
+
+// NULL for targets failed on `probe_target_init`, they aren't probed
+static probe_target_t*
+next_target(shard_t* shard)
+{
+  sweep_t* sweep = shard->sweep;
+  uint64_t index = shard->next++;
+  probe_target_t* target;
+  uint32_t slot;
+
+  if (sweep->order != NULL) {
+    index = sweep->order[index];
+  }
+
+  if (sweep->targets != NULL) {
+    target = &sweep->targets[index];
+
+    return target->addrlen != 0 ? target : NULL;
+  }
+
+  // Engine has a free slot, so does the shard
+  slot = shard->free_slots[--shard->free_count];
+  target = &shard->slots[slot];
+
+  if (sweep->table != NULL) {
+    shard->slot_rows[slot] = index;
+    probe_table_target(sweep->table, index, target);
+  } else if (sweep->partitioned) {
+    probe_range_partition_target(sweep->range,
+                                 sweep->conf->engine.per_subnet != 0,
+                                 sweep->partitions,
+                                 shard->partition,
+                                 index,
+                                 target);
+  } else {
+    probe_range_target(sweep->range, index, target);
+  }
+
+  // Never submitted, so never given back by `target_done`
+  if (target->addrlen == 0) {
+    shard->free_slots[shard->free_count++] = slot;
+    return NULL;
+  }
+
+  return target;
+}
+
+static void*
+worker_run(void* arg)
+{
+  shard_t* shard = arg;
+  sweep_t* sweep = shard->sweep;
+  size_t max_active = sweep->conf->max_active;
+
+  for (;;) {
+    while (probe_engine_active(shard->engine) < max_active) {
+      if (shard->next == shard->end && !claim_batch(shard)) {
+        break;
+      }
+
+      probe_target_t* target = next_target(shard);
+
+      if (target != NULL) {
+        probe_engine_submit(shard->engine, target);
+      }
+    }
+
+    if (probe_engine_active(shard->engine) > 0) {
+      shard->probed +=
+        probe_engine_run(shard->engine, -1, target_done, shard);
+    } else if (__atomic_load_n(&sweep->unclaimed, __ATOMIC_ACQUIRE) == 0) {
+      break;
+    } else {
+      // A batch is being claimed by someone else right now
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+// Counting sort of the targets or table rows by the partition of their
+// destination, in the order they are given within a partition
+static void
+sort_partitions(sweep_t* sweep)
+{
+  uint32_t* partitions = malloc(sweep->count * sizeof(uint32_t) + 1);
+  probe_target_t row;
+
+  sweep->order = malloc(sweep->count * sizeof(size_t) + 1);
+  sweep->offsets = calloc(sweep->partitions + 1, sizeof(size_t));
+
+  if (partitions == NULL || sweep->order == NULL || sweep->offsets == NULL) {
+    perror("Partitions allocation in `probe_sweep` call");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < sweep->count; ++i) {
+    const probe_target_t* target = &row;
+
+    if (sweep->targets != NULL) {
+      target = &sweep->targets[i];
+    } else {
+      probe_table_target(sweep->table, i, &row);
+    }
+
+    partitions[i] =
+      (uint32_t)(probe_limiter_hash(&sweep->conf->engine, &target->addr) %
+                 sweep->partitions);
+    sweep->offsets[partitions[i] + 1]++;
+  }
+
+  for (size_t i = 0; i < sweep->partitions; ++i) {
+    sweep->offsets[i + 1] += sweep->offsets[i];
+  }
+
+  // Offsets are moved to the ends of the partitions & back
+  for (size_t i = 0; i < sweep->count; ++i) {
+    sweep->order[sweep->offsets[partitions[i]]++] = i;
+  }
+
+  memmove(&sweep->offsets[1],
+          &sweep->offsets[0],
+          sweep->partitions * sizeof(size_t));
+  sweep->offsets[0] = 0;
+
+  free(partitions);
+}
+
+void
+probe_sweep_conf_init(probe_sweep_conf_t* conf)
+{
+  probe_engine_conf_init(&conf->engine);
+  conf->workers = 0;
+  conf->max_active = DEFAULT_MAX_ACTIVE;
+  conf->batch = DEFAULT_BATCH;
+}
+
+static size_t
+sweep_run(sweep_t* sweep)
+{
+  const probe_sweep_conf_t* conf = sweep->conf;
+  size_t batches = (sweep->count + conf->batch - 1) / conf->batch;
+  // Targets are computed into slots unless there is an array of them
+  bool slotted = sweep->targets == NULL;
+  // Batches of target arrays & partitions are handed out through deques
+  bool dequed;
+  size_t ids, share, longer, probed = 0;
+
+  sweep->workers = conf->workers;
+
+  if (sweep->workers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    sweep->workers = cpus > 0 ? (size_t)cpus : 1;
+  }
+
+  // Idle workers would only spin on stealing
+  if (sweep->workers > batches) {
+    sweep->workers = batches > 0 ? batches : 1;
+  }
+
+  // The rate is shared, destination caps hold as the destinations are
+  sweep->engine_conf = conf->engine;
+  sweep->partitioned =
+    conf->engine.per_host != 0 || conf->engine.per_subnet != 0;
+
+  if (conf->engine.rate != 0) {
+    sweep->engine_conf.rate = conf->engine.rate / (uint32_t)sweep->workers;
+    sweep->engine_conf.burst = conf->engine.burst / (uint32_t)sweep->workers;
+
+    if (sweep->engine_conf.rate == 0) {
+      sweep->engine_conf.rate = 1;
+    }
+
+    if (sweep->engine_conf.burst == 0) {
+      sweep->engine_conf.burst = 1;
+    }
+  }
+
+  if (sweep->partitioned) {
+    sweep->partitions = sweep->workers * PARTITIONS_PER_WORKER;
+
+    if (sweep->range == NULL) {
+      sort_partitions(sweep);
+    }
+  }
+
+  dequed = sweep->partitioned || !slotted;
+  ids = sweep->partitioned ? sweep->partitions : batches;
+
+  share = batches / sweep->workers;
+  longer = batches % sweep->workers;
+  sweep->shards = calloc(sweep->workers, sizeof(shard_t));
+
+  if (sweep->shards == NULL) {
+    perror("Shards allocation in `probe_sweep` call");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < sweep->workers; ++i) {
+    shard_t* shard = &sweep->shards[i];
+
+    shard->sweep = sweep;
+    shard->index = i;
+    shard->engine = probe_engine_create(conf->max_active, &sweep->engine_conf);
+
+    if (slotted) {
+      shard->slots = calloc(conf->max_active, sizeof(probe_target_t));
+      shard->free_slots = calloc(conf->max_active, sizeof(uint32_t));
+      shard->slot_rows = calloc(conf->max_active, sizeof(uint64_t));
+    }
+
+    if (dequed) {
+      shard->deque = probe_deque_create(ids / sweep->workers + 1);
+    } else {
+      // Contiguous slices, the first `longer` ones a batch longer
+      shard->cursor = share * i + (i < longer ? i : longer);
+      shard->limit = shard->cursor + share + (i < longer ? 1 : 0);
+    }
+
+    if (shard->engine == NULL ||
+        (slotted && (shard->slots == NULL || shard->free_slots == NULL ||
+                     shard->slot_rows == NULL)) ||
+        (dequed && shard->deque == NULL)) {
+      perror("Shard creation in `probe_sweep` call");
+      exit(EXIT_FAILURE);
+    }
+
+    for (size_t j = 0; slotted && j < conf->max_active; ++j) {
+      shard->free_slots[shard->free_count++] = (uint32_t)j;
+    }
+  }
+
+  // Neighbour batches go to different workers, so slow subnets are shared
+  if (dequed) {
+    sweep->unclaimed = ids;
+
+    for (size_t i = 0; i < ids; ++i) {
+      probe_deque_push(sweep->shards[i % sweep->workers].deque, (uint32_t)i);
+    }
+  }
+
+  for (size_t i = 0; i < sweep->workers; ++i) {
+    if (pthread_create(&sweep->shards[i].thread,
+                       NULL,
+                       worker_run,
+                       &sweep->shards[i]) != 0) {
+      perror("Worker creation in `probe_sweep` call");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (size_t i = 0; i < sweep->workers; ++i) {
+    pthread_join(sweep->shards[i].thread, NULL);
+  }
+
+  // Deques are stolen from until the last worker is done
+  for (size_t i = 0; i < sweep->workers; ++i) {
+    shard_t* shard = &sweep->shards[i];
+
+    probed += shard->probed;
+    probe_engine_destroy(shard->engine);
+    probe_deque_destroy(shard->deque);
+    free(shard->free_slots);
+    free(shard->slot_rows);
+    free(shard->slots);
+  }
+
+  free(sweep->shards);
+  free(sweep->offsets);
+  free(sweep->order);
+
+  return probed;
+}
+
+size_t
+probe_sweep(probe_target_t* targets,
+            size_t count,
+            const probe_sweep_conf_t* conf,
+            probe_done_fn done,
+            void* data)
+{
+  sweep_t sweep = { .targets = targets,
+                    .count = count,
+                    .conf = conf,
+                    .done = done,
+                    .data = data };
+
+  return sweep_run(&sweep);
+}
+
+size_t
+probe_sweep_range(const probe_range_t* range,
+                  const probe_sweep_conf_t* conf,
+                  probe_done_fn done,
+                  void* data)
+{
+  sweep_t sweep = { .range = range,
+                    .count = range->size,
+                    .conf = conf,
+                    .done = done,
+                    .data = data };
+
+  return sweep_run(&sweep);
+}
+
+size_t
+probe_sweep_table(probe_table_t* table,
+                  const probe_sweep_conf_t* conf,
+                  probe_done_fn done,
+                  void* data)
+{
+  sweep_t sweep = { .table = table,
+                    .count = probe_table_count(table),
+                    .conf = conf,
+                    .done = done,
+                    .data = data };
+
+  return sweep_run(&sweep);
+}
@@ -0,0 +1,57 @@
+#ifndef PROBE_SWEEP_H
+#define PROBE_SWEEP_H
+
+#include "engine.h"
+#include "range.h"
+#include "table.h"
+
+typedef struct probe_sweep_conf
+{
+  // The rate is split between the workers. With destination caps every
+  // destination is probed by a single worker, so the caps & their adaptive
+  // narrowing hold for the whole sweep
+  probe_engine_conf_t engine;
+  // Threads with an engine each, 0 for one per online CPU
+  size_t workers;
+  // Targets probed at once by a single worker
+  size_t max_active;
+  // Targets handed out (and stolen) at once
+  size_t batch;
+} probe_sweep_conf_t;
+
+// Sweep configuration equivalent to the current `probe_config`
+void
+probe_sweep_conf_init(probe_sweep_conf_t* conf);
+
+// Probes all `targets` once on several threads. Targets are split in batches
+// spread over per worker queues, a worker out of batches steals from the
+// others. With destination caps the batches are partitions of destinations,
+// stolen whole. Targets failed on `probe_target_init` are skipped. `done` is
+// called from the workers concurrently. Returns the number of probed targets
+size_t
+probe_sweep(probe_target_t* targets,
+            size_t count,
+            const probe_sweep_conf_t* conf,
+            probe_done_fn done,
+            void* data);
+
+// Probes every target of `range` once in its randomized order, or in those of
+// its partitions with destination caps. Memory doesn't depend on the range
+// size: targets are computed into per worker slots right before the probe and
+// passed to `done` valid only for the call
+size_t
+probe_sweep_range(const probe_range_t* range,
+                  const probe_sweep_conf_t* conf,
+                  probe_done_fn done,
+                  void* data);
+
+// Probes every row of `table` once, rows are expanded into per worker slots
+// like range targets and their verdicts are packed back before `done` is
+// called. Rows failed on `probe_target_init` are skipped
+size_t
+probe_sweep_table(probe_table_t* table,
+                  const probe_sweep_conf_t* conf,
+                  probe_done_fn done,
+                  void* data);
+
+#endif
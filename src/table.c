@@ -0,0 +1,423 @@
+#include "table.h"
+#include "internal.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+
+#define MIN_CAPACITY 64
+#define MIN_ARENA 4096
+// Interned names hash set is kept at most half full
+#define MIN_SLOTS 256
+
+// Address family of a row in the low bits of its kind
+#define KIND_FAMILY_MASK 0x3
+#define KIND_NONE 0
+#define KIND_INET 1
+#define KIND_INET6 2
+#define KIND_UNIX 3
+#define KIND_SEQPACKET 0x4
+// The name is the TLS server name as well
+#define KIND_SERVER_NAME 0x8
+
+#define RESULT_STATE_MASK 0xf
+#define RESULT_ATTEMPTS_SHIFT 4
+#define RESULT_LATENCY_SHIFT 8
+
+typedef uint8_t addr_t[16];
+
+struct probe_table
+{
+  size_t count;
+  size_t capacity;
+  // One column per field, IPv4 addresses take the first 4 bytes
+  addr_t* addrs;
+  in_port_t* ports;
+  uint8_t* kinds;
+  // Arena offset of the name, 0 for none
+  uint32_t* names;
+  // State, attempts & latency of the last verdict, see `pack_result`
+  uint32_t* results;
+  // NUL terminated names, offset 0 is the empty one
+  char* arena;
+  size_t arena_len;
+  size_t arena_cap;
+  // Open addressing set of arena offsets, 0 is a free slot
+  uint32_t* slots;
+  size_t slot_count;
+  size_t interned;
+};
+
+static uint32_t
+hash_name(const char* name)
+{
+  uint32_t hash = 2166136261u;
+
+  while (*name != '\0') {
+    hash = (hash ^ (uint8_t)*name++) * 16777619u;
+  }
+
+  return hash;
+}
+
+static bool
+grow_slots(probe_table_t* table)
+{
+  size_t count = table->slot_count * 2;
+  uint32_t* slots = calloc(count, sizeof(uint32_t));
+
+  if (slots == NULL) {
+    return false;
+  }
+
+  for (size_t i = 0; i < table->slot_count; ++i) {
+    uint32_t offset = table->slots[i];
+
+    if (offset == 0) {
+      continue;
+    }
+
+    size_t slot = hash_name(table->arena + offset) & (count - 1);
+
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & (count - 1);
+    }
+
+    slots[slot] = offset;
+  }
+
+  free(table->slots);
+  table->slots = slots;
+  table->slot_count = count;
+
+  return true;
+}
+
+// Arena offset of `name`, added on the first sight. 0 when out of memory
+static uint32_t
+intern(probe_table_t* table, const char* name)
+{
+  size_t len = strlen(name) + 1;
+  size_t slot;
+
+  if ((table->interned + 1) * 2 > table->slot_count && !grow_slots(table)) {
+    return 0;
+  }
+
+  slot = hash_name(name) & (table->slot_count - 1);
+
+  for (; table->slots[slot] != 0; slot = (slot + 1) & (table->slot_count - 1)) {
+    if (strcmp(table->arena + table->slots[slot], name) == 0) {
+      return table->slots[slot];
+    }
+  }
+
+  if (table->arena_len + len > TABLE_ARENA_MAX) {
+    return 0;
+  }
+
+  if (table->arena_len + len > table->arena_cap) {
+    size_t cap = table->arena_cap * 2;
+
+    while (cap < table->arena_len + len) {
+      cap *= 2;
+    }
+
+    char* arena = realloc(table->arena, cap);
+
+    if (arena == NULL) {
+      return 0;
+    }
+
+    table->arena = arena;
+    table->arena_cap = cap;
+  }
+
+  memcpy(table->arena + table->arena_len, name, len);
+  table->slots[slot] = (uint32_t)table->arena_len;
+  table->arena_len += len;
+  table->interned++;
+
+  return table->slots[slot];
+}
+
+static bool
+grow_columns(probe_table_t* table, size_t capacity)
+{
+  void* columns[] = {
+    realloc(table->addrs, capacity * sizeof(addr_t)),
+    realloc(table->ports, capacity * sizeof(in_port_t)),
+    realloc(table->kinds, capacity * sizeof(uint8_t)),
+    realloc(table->names, capacity * sizeof(uint32_t)),
+    realloc(table->results, capacity * sizeof(uint32_t)),
+  };
+
+  // Moved columns are kept even when another one failed
+  table->addrs = columns[0] != NULL ? columns[0] : table->addrs;
+  table->ports = columns[1] != NULL ? columns[1] : table->ports;
+  table->kinds = columns[2] != NULL ? columns[2] : table->kinds;
+  table->names = columns[3] != NULL ? columns[3] : table->names;
+  table->results = columns[4] != NULL ? columns[4] : table->results;
+
+  for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); ++i) {
+    if (columns[i] == NULL) {
+      return false;
+    }
+  }
+
+  table->capacity = capacity;
+
+  return true;
+}
+
+static uint32_t
+pack_result(const probe_result_t* result)
+{
+  uint64_t latency_us = result->timings.total_ns / 1000;
+  size_t attempts = result->timings.attempts;
+
+  if (latency_us > TABLE_LATENCY_MAX_US) {
+    latency_us = TABLE_LATENCY_MAX_US;
+  }
+
+  if (attempts > TABLE_ATTEMPTS_MAX) {
+    attempts = TABLE_ATTEMPTS_MAX;
+  }
+
+  return ((uint32_t)result->state & RESULT_STATE_MASK) |
+         (uint32_t)attempts << RESULT_ATTEMPTS_SHIFT |
+         (uint32_t)latency_us << RESULT_LATENCY_SHIFT;
+}
+
+probe_table_t*
+probe_table_create(size_t capacity)
+{
+  probe_table_t* table = calloc(1, sizeof(probe_table_t));
+
+  if (table == NULL) {
+    return NULL;
+  }
+
+  table->arena_cap = MIN_ARENA;
+  table->arena = malloc(table->arena_cap);
+  table->slot_count = MIN_SLOTS;
+  table->slots = calloc(table->slot_count, sizeof(uint32_t));
+
+  if (table->arena == NULL || table->slots == NULL ||
+      !grow_columns(table, capacity > MIN_CAPACITY ? capacity : MIN_CAPACITY)) {
+    probe_table_destroy(table);
+    return NULL;
+  }
+
+  // Offset 0 stands for no name
+  table->arena[0] = '\0';
+  table->arena_len = 1;
+
+  return table;
+}
+
+void
+probe_table_destroy(probe_table_t* table)
+{
+  if (table == NULL) {
+    return;
+  }
+
+  free(table->addrs);
+  free(table->ports);
+  free(table->kinds);
+  free(table->names);
+  free(table->results);
+  free(table->arena);
+  free(table->slots);
+  free(table);
+}
+
+bool
+probe_table_add(probe_table_t* table, const probe_target_t* target)
+{
+  const struct sockaddr_in* sin = (const struct sockaddr_in*)&target->addr;
+  const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)&target->addr;
+  const struct sockaddr_un* un = (const struct sockaddr_un*)&target->addr;
+  char path[sizeof(un->sun_path) + 1];
+  const char* name = NULL;
+  size_t row = table->count;
+  uint8_t kind = KIND_NONE;
+
+  if (row == table->capacity && !grow_columns(table, table->capacity * 2)) {
+    return false;
+  }
+
+  memset(table->addrs[row], 0, sizeof(addr_t));
+  table->ports[row] = 0;
+
+  if (target->addrlen == 0) {
+    // Failed on init, only the state is kept
+  } else if (target->addr.ss_family == AF_INET) {
+    kind = KIND_INET;
+    memcpy(table->addrs[row], &sin->sin_addr, sizeof(sin->sin_addr));
+    table->ports[row] = sin->sin_port;
+  } else if (target->addr.ss_family == AF_INET6) {
+    kind = KIND_INET6;
+    memcpy(table->addrs[row], &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+    table->ports[row] = sin6->sin6_port;
+  } else if (target->addr.ss_family == AF_UNIX) {
+    size_t len = target->addrlen - offsetof(struct sockaddr_un, sun_path);
+
+    // Back to the `probe_target_init_unix` path, `@` for abstract names
+    kind = KIND_UNIX | (target->type == SOCK_SEQPACKET ? KIND_SEQPACKET : 0);
+    memcpy(path, un->sun_path, len);
+    path[len] = '\0';
+
+    if (path[0] == '\0') {
+      path[0] = '@';
+    }
+
+    name = path;
+  }
+
+  if (target->server_name != NULL &&
+      (kind & KIND_FAMILY_MASK) != KIND_UNIX) {
+    kind |= KIND_SERVER_NAME;
+    name = target->server_name;
+  }
+
+  table->names[row] = 0;
+
+  if (name != NULL && (table->names[row] = intern(table, name)) == 0) {
+    return false;
+  }
+
+  table->kinds[row] = kind;
+  table->results[row] = (uint32_t)target->result.state & RESULT_STATE_MASK;
+  table->count++;
+
+  return true;
+}
+
+size_t
+probe_table_count(const probe_table_t* table)
+{
+  return table->count;
+}
+
+void
+probe_table_target(const probe_table_t* table,
+                   size_t row,
+                   probe_target_t* target)
+{
+  struct sockaddr_in* sin = (struct sockaddr_in*)&target->addr;
+  struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&target->addr;
+  uint8_t kind = table->kinds[row];
+  const char* name = table->arena + table->names[row];
+
+  memset(target, 0, sizeof(probe_target_t));
+  target->result.state = probe_table_state(table, row);
+
+  switch (kind & KIND_FAMILY_MASK) {
+    case KIND_INET: {
+      sin->sin_family = AF_INET;
+      sin->sin_port = table->ports[row];
+      memcpy(&sin->sin_addr, table->addrs[row], sizeof(sin->sin_addr));
+      target->addrlen = sizeof(struct sockaddr_in);
+      break;
+    }
+    case KIND_INET6: {
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_port = table->ports[row];
+      memcpy(&sin6->sin6_addr, table->addrs[row], sizeof(sin6->sin6_addr));
+      target->addrlen = sizeof(struct sockaddr_in6);
+      break;
+    }
+    case KIND_UNIX: {
+      probe_unix_addr(name, &target->addr, &target->addrlen);
+      target->type = kind & KIND_SEQPACKET ? SOCK_SEQPACKET : SOCK_STREAM;
+      break;
+    }
+  }
+
+  if (kind & KIND_SERVER_NAME) {
+    target->server_name = name;
+  }
+}
+
+void
+probe_table_store(probe_table_t* table,
+                  size_t row,
+                  const probe_result_t* result)
+{
+  table->results[row] = pack_result(result);
+}
+
+SERVICE_STATE
+probe_table_state(const probe_table_t* table, size_t row)
+{
+  return (SERVICE_STATE)(table->results[row] & RESULT_STATE_MASK);
+}
+
+uint32_t
+probe_table_latency_us(const probe_table_t* table, size_t row)
+{
+  return table->results[row] >> RESULT_LATENCY_SHIFT;
+}
+
+uint32_t
+probe_table_attempts(const probe_table_t* table, size_t row)
+{
+  return table->results[row] >> RESULT_ATTEMPTS_SHIFT & TABLE_ATTEMPTS_MAX;
+}
+
+const char*
+probe_table_name(const probe_table_t* table, size_t row)
+{
+  return table->names[row] != 0 ? table->arena + table->names[row] : NULL;
+}
+
+bool
+probe_table_format(const probe_table_t* table,
+                   size_t row,
+                   char* buf,
+                   size_t len)
+{
+  const char* name = probe_table_name(table, row);
+  unsigned port = ntohs(table->ports[row]);
+  char addr[INET6_ADDRSTRLEN];
+
+  switch (table->kinds[row] & KIND_FAMILY_MASK) {
+    case KIND_INET: {
+      if (name == NULL) {
+        name = inet_ntop(AF_INET, table->addrs[row], addr, sizeof(addr));
+      }
+
+      snprintf(buf, len, "%s:%u", name, port);
+      return true;
+    }
+    case KIND_INET6: {
+      if (name != NULL) {
+        snprintf(buf, len, "%s:%u", name, port);
+      } else {
+        inet_ntop(AF_INET6, table->addrs[row], addr, sizeof(addr));
+        snprintf(buf, len, "[%s]:%u", addr, port);
+      }
+
+      return true;
+    }
+    case KIND_UNIX: {
+      snprintf(buf, len, "unix:%s", name);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+size_t
+probe_table_memory(const probe_table_t* table)
+{
+  size_t row = sizeof(addr_t) + sizeof(in_port_t) + sizeof(uint8_t) +
+               sizeof(uint32_t) + sizeof(uint32_t);
+
+  return sizeof(probe_table_t) + table->capacity * row + table->arena_cap +
+         table->slot_count * sizeof(uint32_t);
+}
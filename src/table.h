@@ -0,0 +1,75 @@
+#ifndef PROBE_TABLE_H
+#define PROBE_TABLE_H
+
+// Columnar store of targets for lists too long to keep as `probe_target_t`.
+// A row is an address, a port, a kind byte, a name offset & a packed result,
+// host names & socket paths are interned into one arena. Rows are expanded
+// into full targets right before the probe only
+
+#include "engine.h"
+
+// Latency saturates at 2^24 - 1 us & attempts at 15
+#define TABLE_LATENCY_MAX_US ((1u << 24) - 1)
+#define TABLE_ATTEMPTS_MAX 15
+// Names arena is addressed with 32 bits
+#define TABLE_ARENA_MAX UINT32_MAX
+
+typedef struct probe_table probe_table_t;
+
+// `capacity` rows are allocated upfront, the table grows past it
+probe_table_t*
+probe_table_create(size_t capacity);
+
+void
+probe_table_destroy(probe_table_t* table);
+
+// Packs `target` as a new row, its result state included, so targets failed
+// on `probe_target_init` are kept as such. The TLS server name of a host &
+// the path of a Unix socket are interned. Returns false on allocation failure
+bool
+probe_table_add(probe_table_t* table, const probe_target_t* target);
+
+size_t
+probe_table_count(const probe_table_t* table);
+
+// Expands `row` into a target ready to be probed, its `addrlen` is 0 when
+// the row failed on `probe_target_init`. The server name points into the
+// arena and is valid until the next add
+void
+probe_table_target(const probe_table_t* table,
+                   size_t row,
+                   probe_target_t* target);
+
+// Packs the verdict of `result` into `row`. Rows are separate words, so
+// different rows can be stored from several threads
+void
+probe_table_store(probe_table_t* table,
+                  size_t row,
+                  const probe_result_t* result);
+
+SERVICE_STATE
+probe_table_state(const probe_table_t* table, size_t row);
+
+uint32_t
+probe_table_latency_us(const probe_table_t* table, size_t row);
+
+uint32_t
+probe_table_attempts(const probe_table_t* table, size_t row);
+
+// Host name or socket path of `row`, NULL for address literals
+const char*
+probe_table_name(const probe_table_t* table, size_t row);
+
+// Writes `row` as `NAME:PORT`, `ADDRESS:PORT`, `[IPV6]:PORT` or `unix:PATH`
+// into `buf`. Returns false for rows failed on `probe_target_init`
+bool
+probe_table_format(const probe_table_t* table,
+                   size_t row,
+                   char* buf,
+                   size_t len);
+
+// Bytes held by the table, columns of the allocated rows included
+size_t
+probe_table_memory(const probe_table_t* table);
+
+#endif
@@ -0,0 +1,390 @@
+#include "tls.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PROBE_TLS
+
+#include <netinet/in.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <time.h>
+
+#define SESSION_SLOTS 256
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+struct probe_tls
+{
+  SSL* ssl;
+  // Session cache key, 0 when the session isn't cached
+  uint64_t key;
+  bool ticket;
+};
+
+// Direct mapped, a collision just costs a full handshake
+typedef struct session_slot
+{
+  uint64_t key;
+  SSL_SESSION* session;
+} session_slot_t;
+
+static SSL_CTX* ctx = NULL;
+static uint32_t expiry_days = 0;
+static session_slot_t sessions[SESSION_SLOTS];
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t
+fnv1a(uint64_t hash, const void* data, size_t len)
+{
+  const unsigned char* bytes = data;
+
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+
+  return hash;
+}
+
+static uint64_t
+session_key(const struct sockaddr_storage* peer, const char* server_name)
+{
+  uint64_t hash = FNV_OFFSET;
+
+  if (peer->ss_family == AF_INET6) {
+    const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)peer;
+
+    hash = fnv1a(hash, &in6->sin6_addr, sizeof(in6->sin6_addr));
+    hash = fnv1a(hash, &in6->sin6_port, sizeof(in6->sin6_port));
+  } else if (peer->ss_family == AF_UNIX) {
+    const struct sockaddr_un* un = (const struct sockaddr_un*)peer;
+
+    hash = fnv1a(hash, un->sun_path, sizeof(un->sun_path));
+  } else {
+    const struct sockaddr_in* in = (const struct sockaddr_in*)peer;
+
+    hash = fnv1a(hash, &in->sin_addr, sizeof(in->sin_addr));
+    hash = fnv1a(hash, &in->sin_port, sizeof(in->sin_port));
+  }
+
+  if (server_name != NULL) {
+    hash = fnv1a(hash, server_name, strlen(server_name));
+  }
+
+  return hash != 0 ? hash : 1;
+}
+
+static int
+on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+  probe_tls_t* tls = SSL_get_app_data(ssl);
+  session_slot_t* slot;
+
+  if (tls == NULL || tls->key == 0) {
+    return 0;
+  }
+
+  slot = &sessions[tls->key % SESSION_SLOTS];
+  pthread_mutex_lock(&sessions_lock);
+
+  if (slot->session != NULL) {
+    SSL_SESSION_free(slot->session);
+  }
+
+  slot->key = tls->key;
+  slot->session = session;
+  pthread_mutex_unlock(&sessions_lock);
+  tls->ticket = true;
+
+  // The cache took the reference
+  return 1;
+}
+
+// Sessions verified with the previous trust settings must not be resumed
+static void
+sessions_flush()
+{
+  pthread_mutex_lock(&sessions_lock);
+
+  for (size_t i = 0; i < SESSION_SLOTS; ++i) {
+    if (sessions[i].session != NULL) {
+      SSL_SESSION_free(sessions[i].session);
+    }
+
+    sessions[i].key = 0;
+    sessions[i].session = NULL;
+  }
+
+  pthread_mutex_unlock(&sessions_lock);
+}
+
+bool
+probe_tls_setup(const probe_conf_t* conf)
+{
+  X509_STORE* store;
+
+  if (ctx == NULL) {
+    ctx = SSL_CTX_new(TLS_client_method());
+
+    if (ctx == NULL) {
+      return false;
+    }
+
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_set_session_cache_mode(
+      ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, on_new_session);
+  }
+
+  expiry_days = conf->tls_expiry_days;
+  sessions_flush();
+
+  // Loading adds to the store, a new one forgets the previous CA file
+  if ((store = X509_STORE_new()) == NULL) {
+    return false;
+  }
+
+  SSL_CTX_set_cert_store(ctx, store);
+
+  if (conf->tls_ca_file != NULL) {
+    return SSL_CTX_load_verify_locations(ctx, conf->tls_ca_file, NULL) == 1;
+  }
+
+  return SSL_CTX_set_default_verify_paths(ctx) == 1;
+}
+
+probe_tls_t*
+probe_tls_new(socket_t sock,
+              const char* server_name,
+              const struct sockaddr_storage* peer)
+{
+  probe_tls_t* tls;
+
+  if (ctx == NULL || (tls = calloc(1, sizeof(probe_tls_t))) == NULL) {
+    return NULL;
+  }
+
+  tls->ssl = SSL_new(ctx);
+
+  if (tls->ssl == NULL || SSL_set_fd(tls->ssl, sock) != 1) {
+    probe_tls_free(tls);
+    return NULL;
+  }
+
+  SSL_set_app_data(tls->ssl, tls);
+
+  if (server_name != NULL) {
+    SSL_set_tlsext_host_name(tls->ssl, server_name);
+    SSL_set1_host(tls->ssl, server_name);
+  }
+
+  if (peer != NULL) {
+    session_slot_t* slot;
+
+    tls->key = session_key(peer, server_name);
+    slot = &sessions[tls->key % SESSION_SLOTS];
+    pthread_mutex_lock(&sessions_lock);
+
+    if (slot->key == tls->key && slot->session != NULL) {
+      SSL_set_session(tls->ssl, slot->session);
+    }
+
+    pthread_mutex_unlock(&sessions_lock);
+  }
+
+  return tls;
+}
+
+TLS_STEP
+probe_tls_handshake(probe_tls_t* tls)
+{
+  int res = SSL_connect(tls->ssl);
+
+  if (res == 1) {
+    return TLS_DONE;
+  }
+
+  switch (SSL_get_error(tls->ssl, res)) {
+    case SSL_ERROR_WANT_READ:
+      return TLS_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+      return TLS_WANT_WRITE;
+    default:
+      return TLS_FAILED;
+  }
+}
+
+static void
+handshake_error(probe_tls_t* tls, TLS_STEP step, probe_tls_info_t* info)
+{
+  long verify = tls != NULL ? SSL_get_verify_result(tls->ssl) : X509_V_OK;
+  unsigned long error = ERR_peek_last_error();
+
+  if (tls == NULL) {
+    snprintf(info->error, TLS_ERROR_LEN, "TLS is not set up");
+  } else if (verify != X509_V_OK) {
+    snprintf(info->error,
+             TLS_ERROR_LEN,
+             "%s",
+             X509_verify_cert_error_string(verify));
+  } else if (step == TLS_WANT_READ || step == TLS_WANT_WRITE) {
+    snprintf(info->error, TLS_ERROR_LEN, "handshake timed out");
+  } else if (error != 0) {
+    ERR_error_string_n(error, info->error, TLS_ERROR_LEN);
+  } else {
+    snprintf(info->error, TLS_ERROR_LEN, "connection closed by peer");
+  }
+
+  ERR_clear_error();
+}
+
+SERVICE_STATE
+probe_tls_verdict(probe_tls_t* tls, TLS_STEP step, probe_tls_info_t* info)
+{
+  X509* cert;
+  struct tm tm;
+  int days, seconds;
+
+  memset(info, 0, sizeof(probe_tls_info_t));
+
+  if (step != TLS_DONE) {
+    handshake_error(tls, step, info);
+    return HANDSHAKE_FAILED;
+  }
+
+  info->valid = true;
+  info->resumed = SSL_session_reused(tls->ssl) == 1;
+  snprintf(info->version, TLS_VERSION_LEN, "%s", SSL_get_version(tls->ssl));
+  snprintf(
+    info->cipher, TLS_CIPHER_LEN, "%s", SSL_get_cipher_name(tls->ssl));
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  cert = SSL_get1_peer_certificate(tls->ssl);
+#else
+  cert = SSL_get_peer_certificate(tls->ssl);
+#endif
+
+  if (cert == NULL) {
+    return AVAILABLE;
+  }
+
+  const ASN1_TIME* not_after = X509_get0_notAfter(cert);
+
+  if (ASN1_TIME_to_tm(not_after, &tm) == 1) {
+    info->not_after = (int64_t)timegm(&tm);
+  }
+
+  if (ASN1_TIME_diff(&days, &seconds, NULL, not_after) == 1) {
+    info->days_left = days;
+  }
+
+  X509_free(cert);
+
+  if (info->days_left < (int64_t)expiry_days) {
+    snprintf(info->error,
+             TLS_ERROR_LEN,
+             "certificate expires in %lld days",
+             (long long)info->days_left);
+    return CERTIFICATE_EXPIRING;
+  }
+
+  return AVAILABLE;
+}
+
+bool
+probe_tls_wait_ticket(probe_tls_t* tls)
+{
+  char byte;
+  int res;
+
+  // Sessions of older versions are complete with the handshake
+  if (tls->key == 0 || tls->ticket ||
+      SSL_version(tls->ssl) < TLS1_3_VERSION) {
+    return false;
+  }
+
+  res = SSL_read(tls->ssl, &byte, 1);
+
+  return !tls->ticket && res <= 0 &&
+         SSL_get_error(tls->ssl, res) == SSL_ERROR_WANT_READ;
+}
+
+void
+probe_tls_free(probe_tls_t* tls)
+{
+  if (tls == NULL) {
+    return;
+  }
+
+  if (tls->ssl != NULL) {
+    // No close_notify, the peer may be gone already and it isn't worth a
+    // write. Freeing without a shutdown would make the session non resumable
+    SSL_set_quiet_shutdown(tls->ssl, 1);
+    SSL_shutdown(tls->ssl);
+    SSL_free(tls->ssl);
+  }
+
+  ERR_clear_error();
+  free(tls);
+}
+
+#else
+
+bool
+probe_tls_setup(const probe_conf_t* conf)
+{
+  (void)conf;
+
+  return false;
+}
+
+probe_tls_t*
+probe_tls_new(socket_t sock,
+              const char* server_name,
+              const struct sockaddr_storage* peer)
+{
+  (void)sock;
+  (void)server_name;
+  (void)peer;
+
+  return NULL;
+}
+
+TLS_STEP
+probe_tls_handshake(probe_tls_t* tls)
+{
+  (void)tls;
+
+  return TLS_FAILED;
+}
+
+SERVICE_STATE
+probe_tls_verdict(probe_tls_t* tls, TLS_STEP step, probe_tls_info_t* info)
+{
+  (void)tls;
+  (void)step;
+
+  memset(info, 0, sizeof(probe_tls_info_t));
+  strcpy(info->error, "built without TLS support");
+
+  return HANDSHAKE_FAILED;
+}
+
+bool
+probe_tls_wait_ticket(probe_tls_t* tls)
+{
+  (void)tls;
+
+  return false;
+}
+
+void
+probe_tls_free(probe_tls_t* tls)
+{
+  (void)tls;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef PROBE_TLS_H
+#define PROBE_TLS_H
+
+// TLS client side of the probes, stubs when built without OpenSSL
+
+#include "probe.h"
+#include <sys/socket.h>
+
+typedef struct probe_tls probe_tls_t;
+
+typedef enum TLS_STEP
+{
+  TLS_DONE,
+  // Non blocking socket has to become readable or writable first
+  TLS_WANT_READ,
+  TLS_WANT_WRITE,
+  TLS_FAILED,
+} TLS_STEP;
+
+// (Re)configures the shared client context from `conf` & forgets cached
+// sessions, not while probing. False on failure
+bool
+probe_tls_setup(const probe_conf_t* conf);
+
+// Client over connected `sock`. When `peer` is not NULL the session is cached
+// per peer & `server_name` and resumed by the next probe of it
+probe_tls_t*
+probe_tls_new(socket_t sock,
+              const char* server_name,
+              const struct sockaddr_storage* peer);
+
+// Handshake step, blocking sockets complete the handshake in one call
+TLS_STEP
+probe_tls_handshake(probe_tls_t* tls);
+
+// Fills `info` after the last `step`, `tls` may be NULL when creation failed.
+// Returns the probe verdict
+SERVICE_STATE
+probe_tls_verdict(probe_tls_t* tls, TLS_STEP step, probe_tls_info_t* info);
+
+// TLS 1.3 session tickets arrive after the handshake. Processes what was
+// received, true while a ticket for the session cache is still expected
+bool
+probe_tls_wait_ticket(probe_tls_t* tls);
+
+void
+probe_tls_free(probe_tls_t* tls);
+
+#endif
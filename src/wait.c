@@ -0,0 +1,252 @@
+#include "wait.h"
+#include "internal.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define NO_DEADLINE UINT64_MAX
+
+// Per target retry state, the target itself lives in `targets`
+typedef struct waiter
+{
+  // Next attempt, meaningless while probing or once available
+  uint64_t due_ns;
+  uint64_t backoff_ms;
+  // Watch of the socket directory, -1 without one
+  int wd;
+  bool active;
+  bool ready;
+} waiter_t;
+
+typedef struct wait
+{
+  probe_target_t* targets;
+  waiter_t* waiters;
+  size_t count;
+  size_t ready;
+  int inotify;
+  probe_done_fn done;
+  void* done_data;
+} wait_t;
+
+static void
+on_done(probe_target_t* target, void* data)
+{
+  wait_t* wait = data;
+  waiter_t* waiter = &wait->waiters[target - wait->targets];
+
+  waiter->active = false;
+
+  if (target->result.state == AVAILABLE) {
+    waiter->ready = true;
+    wait->ready++;
+
+    if (wait->done != NULL) {
+      wait->done(target, wait->done_data);
+    }
+
+    return;
+  }
+
+  waiter->due_ns = probe_now_ns() + waiter->backoff_ms * NS_IN_MS;
+
+  if (waiter->backoff_ms < WAIT_BACKOFF_MAX_MS) {
+    waiter->backoff_ms *= 2;
+  }
+}
+
+static const char*
+socket_path(const probe_target_t* target)
+{
+  const struct sockaddr_un* un = (const struct sockaddr_un*)&target->addr;
+
+  // Abstract sockets have no file to watch
+  if (target->addr.ss_family != AF_UNIX || un->sun_path[0] == '\0') {
+    return NULL;
+  }
+
+  return un->sun_path;
+}
+
+// Socket files show up in their directory on bind, before the listener is
+// ready, so a refused attempt right after is retried with the least backoff
+static void
+watch_sockets(wait_t* wait)
+{
+  char dir[sizeof(((struct sockaddr_un*)NULL)->sun_path)];
+
+  for (size_t i = 0; i < wait->count; ++i) {
+    const char* path = socket_path(&wait->targets[i]);
+    char* slash;
+
+    wait->waiters[i].wd = -1;
+
+    if (path == NULL) {
+      continue;
+    }
+
+    if (wait->inotify == -1) {
+      wait->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+
+    if (wait->inotify == -1) {
+      return;
+    }
+
+    strcpy(dir, path);
+    slash = strrchr(dir, '/');
+
+    if (slash == NULL) {
+      strcpy(dir, ".");
+    } else if (slash == dir) {
+      dir[1] = '\0';
+    } else {
+      *slash = '\0';
+    }
+
+    // A directory that doesn't exist yet leaves the target to polling
+    wait->waiters[i].wd =
+      inotify_add_watch(wait->inotify, dir, IN_CREATE | IN_MOVED_TO);
+  }
+}
+
+// Makes targets of the created socket files due right away
+static void
+read_events(wait_t* wait)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  uint64_t now = probe_now_ns();
+  ssize_t len;
+
+  while ((len = read(wait->inotify, buf, sizeof(buf))) > 0) {
+    for (char* p = buf; p < buf + len;) {
+      struct inotify_event* event = (struct inotify_event*)p;
+
+      for (size_t i = 0; event->len > 0 && i < wait->count; ++i) {
+        const char* path = socket_path(&wait->targets[i]);
+        const char* name = path != NULL ? strrchr(path, '/') : NULL;
+        waiter_t* waiter = &wait->waiters[i];
+
+        name = name != NULL ? name + 1 : path;
+
+        if (waiter->wd == event->wd && !waiter->ready &&
+            strcmp(name, event->name) == 0) {
+          waiter->due_ns = now;
+          waiter->backoff_ms = WAIT_BACKOFF_MIN_MS;
+        }
+      }
+
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+// Submits due targets, returns the closest due time of the rest
+static uint64_t
+submit_due(wait_t* wait, probe_engine_t* engine, uint64_t now)
+{
+  uint64_t next = NO_DEADLINE;
+
+  for (size_t i = 0; i < wait->count; ++i) {
+    waiter_t* waiter = &wait->waiters[i];
+
+    if (waiter->active || waiter->ready) {
+      continue;
+    }
+
+    if (waiter->due_ns <= now) {
+      waiter->active = probe_engine_submit(engine, &wait->targets[i]);
+    } else if (waiter->due_ns < next) {
+      next = waiter->due_ns;
+    }
+  }
+
+  return next;
+}
+
+bool
+probe_wait(probe_target_t* targets,
+           size_t count,
+           uint64_t timeout_ms,
+           const probe_engine_conf_t* conf,
+           probe_done_fn done,
+           void* data)
+{
+  wait_t wait = { .targets = targets,
+                  .count = count,
+                  .inotify = -1,
+                  .done = done,
+                  .done_data = data };
+  probe_engine_conf_t engine_conf = *conf;
+  uint64_t now = probe_now_ns();
+  uint64_t deadline =
+    timeout_ms != 0 ? now + timeout_ms * NS_IN_MS : NO_DEADLINE;
+  probe_engine_t* engine;
+  bool all_ready;
+
+  // Retries are paced here, an attempt is a single connect
+  engine_conf.retry_count = 1;
+  engine = probe_engine_create(count, &engine_conf);
+  wait.waiters = calloc(count, sizeof(waiter_t));
+
+  if (engine == NULL || wait.waiters == NULL) {
+    probe_engine_destroy(engine);
+    free(wait.waiters);
+    return false;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    wait.waiters[i].backoff_ms = WAIT_BACKOFF_MIN_MS;
+  }
+
+  watch_sockets(&wait);
+
+  while (wait.ready < count && now < deadline) {
+    uint64_t next = submit_due(&wait, engine, now);
+    uint64_t wake = next < deadline ? next : deadline;
+    int timeout = -1;
+
+    // Rounded up, waking early would just spin
+    if (wake != NO_DEADLINE) {
+      uint64_t wait_ms = (wake - now + NS_IN_MS - 1) / NS_IN_MS;
+
+      timeout = wait_ms > INT_MAX ? INT_MAX : (int)wait_ms;
+    }
+
+    // Socket files showing up are only noticed in between connects, which
+    // are immediate for Unix sockets
+    if (probe_engine_active(engine) > 0) {
+      probe_engine_run(engine, timeout, on_done, &wait);
+    } else {
+      struct pollfd pfd = { .fd = wait.inotify, .events = POLLIN };
+
+      if (poll(&pfd, wait.inotify != -1, timeout) == -1 && errno != EINTR) {
+        break;
+      }
+    }
+
+    if (wait.inotify != -1) {
+      read_events(&wait);
+    }
+
+    now = probe_now_ns();
+  }
+
+  all_ready = wait.ready == count;
+
+  // Probes still in flight are cut by the deadline
+  probe_engine_destroy(engine);
+
+  if (wait.inotify != -1) {
+    close(wait.inotify);
+  }
+
+  free(wait.waiters);
+
+  return all_ready;
+}
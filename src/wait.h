@@ -0,0 +1,23 @@
+#ifndef PROBE_WAIT_H
+#define PROBE_WAIT_H
+
+#include "engine.h"
+
+// First retry of a failed target is that soon, every next one twice as late
+// up to the cap
+#define WAIT_BACKOFF_MIN_MS 1
+#define WAIT_BACKOFF_MAX_MS 64
+
+// Probes initialized `targets` until every one of them is available or
+// `timeout_ms` (0 for no limit) passes. Targets on filesystem Unix sockets
+// are retried as soon as their socket file shows up. `done` is called once
+// per target that got available. Returns true when all of them did
+bool
+probe_wait(probe_target_t* targets,
+           size_t count,
+           uint64_t timeout_ms,
+           const probe_engine_conf_t* conf,
+           probe_done_fn done,
+           void* data);
+
+#endif
@@ -0,0 +1,271 @@
+#include "wheel.h"
+#include <stdlib.h>
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+#define NOT_PENDING UINT16_MAX
+// Farther timers are parked in the top level and cascaded again
+#define MAX_DELTA ((1ull << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+// Timers of the tick being fired, callbacks may still cancel them
+#define EXPIRED_BUCKET (WHEEL_LEVELS * WHEEL_SLOTS)
+
+typedef struct wheel_node
+{
+  uint64_t expires;
+  uint32_t next;
+  uint32_t prev;
+  // `level * WHEEL_SLOTS + slot`, `EXPIRED_BUCKET` or `NOT_PENDING`
+  uint16_t bucket;
+} wheel_node_t;
+
+struct probe_wheel
+{
+  uint64_t current;
+  uint64_t occupied[WHEEL_LEVELS];
+  uint32_t heads[WHEEL_LEVELS * WHEEL_SLOTS + 1];
+  wheel_node_t* nodes;
+  size_t capacity;
+};
+
+static uint64_t
+rotate_right(uint64_t bits, unsigned shift)
+{
+  shift &= 63;
+
+  return shift == 0 ? bits : (bits >> shift) | (bits << (64 - shift));
+}
+
+static void
+unlink_node(probe_wheel_t* wheel, uint32_t id)
+{
+  wheel_node_t* node = &wheel->nodes[id];
+  uint16_t bucket = node->bucket;
+
+  if (node->prev != WHEEL_NIL) {
+    wheel->nodes[node->prev].next = node->next;
+  } else {
+    wheel->heads[bucket] = node->next;
+  }
+
+  if (node->next != WHEEL_NIL) {
+    wheel->nodes[node->next].prev = node->prev;
+  }
+
+  if (wheel->heads[bucket] == WHEEL_NIL && bucket != EXPIRED_BUCKET) {
+    wheel->occupied[bucket / WHEEL_SLOTS] &= ~(1ull << (bucket & SLOT_MASK));
+  }
+
+  node->bucket = NOT_PENDING;
+}
+
+// Expiry must not be before `current`
+static void
+link_node(probe_wheel_t* wheel, uint32_t id)
+{
+  wheel_node_t* node = &wheel->nodes[id];
+  uint64_t delta = node->expires - wheel->current;
+  uint64_t expires = node->expires;
+  unsigned level = 0;
+
+  if (delta > MAX_DELTA) {
+    delta = MAX_DELTA;
+    expires = wheel->current + MAX_DELTA;
+  }
+
+  while (level < WHEEL_LEVELS - 1 &&
+         delta >= (1ull << (WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+
+  unsigned slot = (expires >> (WHEEL_BITS * level)) & SLOT_MASK;
+  uint16_t bucket = (uint16_t)(level * WHEEL_SLOTS + slot);
+
+  node->bucket = bucket;
+  node->prev = WHEEL_NIL;
+  node->next = wheel->heads[bucket];
+
+  if (node->next != WHEEL_NIL) {
+    wheel->nodes[node->next].prev = id;
+  }
+
+  wheel->heads[bucket] = id;
+  wheel->occupied[level] |= 1ull << slot;
+}
+
+// Detaches the whole bucket list, returns its head
+static uint32_t
+take_bucket(probe_wheel_t* wheel, unsigned level, unsigned slot)
+{
+  unsigned bucket = level * WHEEL_SLOTS + slot;
+  uint32_t head = wheel->heads[bucket];
+
+  wheel->heads[bucket] = WHEEL_NIL;
+  wheel->occupied[level] &= ~(1ull << slot);
+
+  return head;
+}
+
+// The first tick after `current` something is due at: an expiry in the
+// lowest level or a cascade of an upper one
+static uint64_t
+next_event(probe_wheel_t* wheel)
+{
+  uint64_t closest = UINT64_MAX;
+
+  for (unsigned level = 0; level < WHEEL_LEVELS; ++level) {
+    uint64_t occupied = wheel->occupied[level];
+
+    if (occupied == 0) {
+      continue;
+    }
+
+    unsigned shift = WHEEL_BITS * level;
+    uint64_t base = (wheel->current >> shift) + 1;
+    uint64_t offset =
+      __builtin_ctzll(rotate_right(occupied, base & SLOT_MASK));
+    uint64_t tick = (base + offset) << shift;
+
+    closest = tick < closest ? tick : closest;
+  }
+
+  return closest;
+}
+
+probe_wheel_t*
+probe_wheel_create(size_t capacity, uint64_t now_ms)
+{
+  probe_wheel_t* wheel = calloc(1, sizeof(probe_wheel_t));
+
+  if (wheel == NULL) {
+    return NULL;
+  }
+
+  wheel->nodes = calloc(capacity, sizeof(wheel_node_t));
+
+  if (wheel->nodes == NULL) {
+    free(wheel);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < capacity; ++i) {
+    wheel->nodes[i].bucket = NOT_PENDING;
+  }
+
+  for (size_t i = 0; i <= EXPIRED_BUCKET; ++i) {
+    wheel->heads[i] = WHEEL_NIL;
+  }
+
+  wheel->current = now_ms;
+  wheel->capacity = capacity;
+
+  return wheel;
+}
+
+void
+probe_wheel_destroy(probe_wheel_t* wheel)
+{
+  if (wheel == NULL) {
+    return;
+  }
+
+  free(wheel->nodes);
+  free(wheel);
+}
+
+void
+probe_wheel_schedule(probe_wheel_t* wheel, uint32_t id, uint64_t expires_ms)
+{
+  if (wheel->nodes[id].bucket != NOT_PENDING) {
+    unlink_node(wheel, id);
+  }
+
+  // The current tick is already processed
+  if (expires_ms <= wheel->current) {
+    expires_ms = wheel->current + 1;
+  }
+
+  wheel->nodes[id].expires = expires_ms;
+  link_node(wheel, id);
+}
+
+void
+probe_wheel_cancel(probe_wheel_t* wheel, uint32_t id)
+{
+  if (wheel->nodes[id].bucket != NOT_PENDING) {
+    unlink_node(wheel, id);
+  }
+}
+
+bool
+probe_wheel_pending(probe_wheel_t* wheel, uint32_t id)
+{
+  return wheel->nodes[id].bucket != NOT_PENDING;
+}
+
+size_t
+probe_wheel_advance(probe_wheel_t* wheel,
+                    uint64_t now_ms,
+                    probe_timer_fn fn,
+                    void* data)
+{
+  size_t fired = 0;
+
+  while (wheel->current < now_ms) {
+    uint64_t tick = next_event(wheel);
+
+    // Nothing happens in between, jump right to it
+    if (tick > now_ms) {
+      wheel->current = now_ms;
+      break;
+    }
+
+    wheel->current = tick;
+
+    // Upper levels go first, they may refill the lower ones at this tick
+    unsigned top = 0;
+
+    while (top + 1 < WHEEL_LEVELS &&
+           (tick & ((1ull << (WHEEL_BITS * (top + 1))) - 1)) == 0) {
+      top++;
+    }
+
+    for (unsigned level = top; level > 0; --level) {
+      unsigned slot = (tick >> (WHEEL_BITS * level)) & SLOT_MASK;
+      uint32_t id = take_bucket(wheel, level, slot);
+
+      while (id != WHEEL_NIL) {
+        uint32_t next = wheel->nodes[id].next;
+
+        link_node(wheel, id);
+        id = next;
+      }
+    }
+
+    uint32_t id = take_bucket(wheel, 0, tick & SLOT_MASK);
+
+    wheel->heads[EXPIRED_BUCKET] = id;
+
+    for (; id != WHEEL_NIL; id = wheel->nodes[id].next) {
+      wheel->nodes[id].bucket = EXPIRED_BUCKET;
+    }
+
+    while ((id = wheel->heads[EXPIRED_BUCKET]) != WHEEL_NIL) {
+      unlink_node(wheel, id);
+      fired++;
+      fn(id, data);
+    }
+  }
+
+  return fired;
+}
+
+int64_t
+probe_wheel_next(probe_wheel_t* wheel, uint64_t now_ms)
+{
+  uint64_t tick = next_event(wheel);
+
+  if (tick == UINT64_MAX) {
+    return -1;
+  }
+
+  return tick <= now_ms ? 0 : (int64_t)(tick - now_ms);
+}
@@ -0,0 +1,52 @@
+#ifndef PROBE_WHEEL_H
+#define PROBE_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timing wheel with millisecond ticks: every level has
+// `WHEEL_SLOTS` slots, each one `WHEEL_SLOTS` times wider than a slot of the
+// level below. Insert and cancel are O(1), far timers are cascaded down
+// as their time comes
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1u << WHEEL_BITS)
+#define WHEEL_LEVELS 5
+#define WHEEL_NIL UINT32_MAX
+
+typedef struct probe_wheel probe_wheel_t;
+
+// Called for every expired timer, it may schedule the timer again
+typedef void (*probe_timer_fn)(uint32_t id, void* data);
+
+// Timers are identified by `[0, capacity)` ids, usually arena indexes
+probe_wheel_t*
+probe_wheel_create(size_t capacity, uint64_t now_ms);
+
+void
+probe_wheel_destroy(probe_wheel_t* wheel);
+
+// (Re)schedules timer `id`, expiry in the past fires on the next advance
+void
+probe_wheel_schedule(probe_wheel_t* wheel, uint32_t id, uint64_t expires_ms);
+
+void
+probe_wheel_cancel(probe_wheel_t* wheel, uint32_t id);
+
+bool
+probe_wheel_pending(probe_wheel_t* wheel, uint32_t id);
+
+// Moves the wheel to `now_ms` firing everything expired on the way.
+// Returns the number of fired timers
+size_t
+probe_wheel_advance(probe_wheel_t* wheel,
+                    uint64_t now_ms,
+                    probe_timer_fn fn,
+                    void* data);
+
+// Milliseconds the wheel can sleep from `now_ms` without missing a timer,
+// -1 when there are no timers
+int64_t
+probe_wheel_next(probe_wheel_t* wheel, uint64_t now_ms);
+
+#endif
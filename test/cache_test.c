@@ -0,0 +1,129 @@
+#include "cache.h"
+#include "probe.h"
+#include "test.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_PATH "./probe_cache_test.bin"
+
+static struct in_addr
+addr_of(char* ipv4)
+{
+  struct in_addr addr;
+
+  inet_aton(ipv4, &addr);
+
+  return addr;
+}
+
+START_TEST(cache_entry_test)
+{
+  struct in_addr addrs[2] = { addr_of("127.0.0.2"), addr_of("127.0.0.1") };
+  probe_cache_entry_t entry;
+
+  unlink(CACHE_PATH);
+
+  ck_assert(!probe_cache_lookup("localhost", 80, &entry));
+  ck_assert(probe_cache_open(CACHE_PATH, 30));
+  ck_assert(!probe_cache_lookup("localhost", 80, &entry));
+
+  probe_cache_store_addrs("localhost", 80, addrs, 2);
+  ck_assert(probe_cache_lookup("localhost", 80, &entry));
+  ck_assert(!probe_cache_lookup("localhost", 81, &entry));
+  ck_assert(probe_cache_fresh(&entry));
+  ck_assert_uint_eq(entry.addr_count, 2);
+  ck_assert_uint_eq(entry.last_good, NO_LAST_GOOD);
+
+  probe_cache_store_result("localhost", 80, addrs[1], AVAILABLE, 42);
+  probe_cache_store_result("localhost", 80, addrs[1], UNAVAILABLE, 0);
+  probe_cache_store_result("localhost", 80, addrs[1], UNAVAILABLE, 0);
+  ck_assert(probe_cache_lookup("localhost", 80, &entry));
+  ck_assert_uint_eq(entry.last_good, 1);
+  ck_assert_uint_eq(entry.latency_us, 42);
+  ck_assert_uint_eq(entry.failure_streak, 2);
+
+  // Survives reopening and keeps the good address over a new resolution
+  probe_cache_close();
+  ck_assert(probe_cache_open(CACHE_PATH, 0));
+  probe_cache_store_addrs("localhost", 80, &addrs[1], 1);
+  ck_assert(probe_cache_lookup("localhost", 80, &entry));
+  ck_assert_uint_eq(entry.last_good, 0);
+  ck_assert(!probe_cache_fresh(&entry));
+
+  probe_cache_close();
+  unlink(CACHE_PATH);
+}
+END_TEST
+
+START_TEST(cache_probe_test)
+{
+  struct in_addr addrs[2] = { addr_of("127.0.0.2"), addr_of("127.0.0.1") };
+  probe_result_t result;
+  probe_cache_entry_t entry;
+  in_port_t port;
+  int sock = listen_loopback(&port);
+
+  unlink(CACHE_PATH);
+  ck_assert(probe_cache_open(CACHE_PATH, 30));
+  probe_config(2, 0);
+
+  ck_assert_int_eq(host_port_probe_r("localhost", port, NULL, &result),
+                   AVAILABLE);
+  ck_assert(probe_cache_lookup("localhost", port, &entry));
+  ck_assert(probe_cache_fresh(&entry));
+  ck_assert_uint_lt(entry.last_good, entry.addr_count);
+
+  // Fresh entry is used instead of the resolution
+  probe_cache_store_addrs("4321example1234.", port, addrs, 2);
+  ck_assert_int_eq(
+    host_port_probe_r("4321example1234.", port, NULL, &result), AVAILABLE);
+  ck_assert_uint_eq(result.timings.attempts, 2);
+
+  // Known good address goes first
+  ck_assert_int_eq(
+    host_port_probe_r("4321example1234.", port, NULL, &result), AVAILABLE);
+  ck_assert_uint_eq(result.timings.attempts, 1);
+
+  probe_cache_close();
+  ck_assert_int_eq(host_port_probe("4321example1234.", port, NULL),
+                   UNKNOWN_HOST);
+
+  unlink(CACHE_PATH);
+  close(sock);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe cache test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, cache_entry_test);
+  tcase_add_test(t, cache_probe_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
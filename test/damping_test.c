@@ -0,0 +1,203 @@
+#include "damping.h"
+#include "test.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool
+feed(probe_damper_t* damper,
+     const probe_damping_conf_t* conf,
+     SERVICE_STATE state,
+     uint64_t now_ms)
+{
+  probe_result_t result;
+
+  memset(&result, 0, sizeof(result));
+  result.state = state;
+  result.timings.total_ns = now_ms * 1000;
+
+  return probe_damper_update(damper, conf, &result, now_ms);
+}
+
+START_TEST(hysteresis_test)
+{
+  probe_damping_conf_t conf = { .down_after = 3, .up_after = 2 };
+  probe_damper_t damper;
+
+  probe_damper_init(&damper);
+
+  // The first verdict is an event on its own
+  ck_assert(feed(&damper, &conf, AVAILABLE, 0));
+  ck_assert_int_eq(damper.reported, DAMPER_UP);
+  ck_assert(!feed(&damper, &conf, AVAILABLE, 1));
+
+  // Blips shorter than `down_after` never show
+  ck_assert(!feed(&damper, &conf, UNAVAILABLE, 2));
+  ck_assert(!feed(&damper, &conf, UNAVAILABLE, 3));
+  ck_assert(!feed(&damper, &conf, AVAILABLE, 4));
+  ck_assert(!feed(&damper, &conf, UNAVAILABLE, 5));
+  ck_assert(!feed(&damper, &conf, NOT_SERVING, 6));
+  ck_assert(feed(&damper, &conf, UNAVAILABLE, 7));
+  ck_assert_int_eq(damper.reported, DAMPER_DOWN);
+  ck_assert(!feed(&damper, &conf, UNAVAILABLE, 8));
+
+  ck_assert(!feed(&damper, &conf, AVAILABLE, 9));
+  ck_assert(feed(&damper, &conf, AVAILABLE, 10));
+  ck_assert_int_eq(damper.reported, DAMPER_UP);
+
+  // No half life, no penalty
+  ck_assert(!damper.suppressed);
+  ck_assert(probe_damper_penalty(&damper, &conf, 10) == 0);
+}
+END_TEST
+
+START_TEST(flap_damping_test)
+{
+  probe_damping_conf_t conf;
+  probe_damper_t damper;
+  uint64_t now = 0;
+
+  probe_damping_conf_init(&conf);
+  conf.half_life_ms = 1000;
+  probe_damper_init(&damper);
+
+  ck_assert(feed(&damper, &conf, AVAILABLE, now));
+  ck_assert(feed(&damper, &conf, UNAVAILABLE, now += 10));
+  ck_assert(feed(&damper, &conf, AVAILABLE, now += 10));
+
+  // The third flip in a row crosses the suppress threshold
+  ck_assert(feed(&damper, &conf, UNAVAILABLE, now += 10));
+  ck_assert(damper.suppressed);
+  ck_assert_int_eq(damper.state, DAMPER_DOWN);
+  ck_assert_int_eq(damper.reported, DAMPER_DOWN);
+  ck_assert(!feed(&damper, &conf, AVAILABLE, now += 10));
+  ck_assert(!feed(&damper, &conf, UNAVAILABLE, now += 10));
+
+  // 5 penalties take more than 2 half lives to decay below 750
+  ck_assert(!feed(&damper, &conf, UNAVAILABLE, now += 2000));
+  ck_assert(damper.suppressed);
+  ck_assert(!feed(&damper, &conf, UNAVAILABLE, now += 1000));
+  ck_assert(!damper.suppressed);
+  ck_assert_int_eq(damper.reported, DAMPER_DOWN);
+
+  // Coming back up while suppressed is reported on reuse only
+  probe_damper_init(&damper);
+  now = 0;
+  ck_assert(feed(&damper, &conf, AVAILABLE, now));
+
+  for (int i = 0; i < 3; ++i) {
+    feed(&damper, &conf, UNAVAILABLE, now += 10);
+    feed(&damper, &conf, AVAILABLE, now += 10);
+  }
+
+  ck_assert(damper.suppressed);
+  ck_assert_int_eq(damper.state, DAMPER_UP);
+  ck_assert_int_eq(damper.reported, DAMPER_DOWN);
+  ck_assert(feed(&damper, &conf, AVAILABLE, now += 10000));
+  ck_assert(!damper.suppressed);
+  ck_assert_int_eq(damper.reported, DAMPER_UP);
+  ck_assert(probe_damper_penalty(&damper, &conf, now) < conf.reuse);
+}
+END_TEST
+
+START_TEST(flap_held_down_test)
+{
+  probe_damping_conf_t conf;
+  probe_damper_t damper;
+  uint64_t now = 0;
+  bool up_shown = false;
+
+  probe_damping_conf_init(&conf);
+  probe_damper_init(&damper);
+  ck_assert(feed(&damper, &conf, AVAILABLE, now));
+
+  // Flaps ending up, the last flip to down enters suppression
+  feed(&damper, &conf, UNAVAILABLE, now += 1000);
+  feed(&damper, &conf, AVAILABLE, now += 1000);
+  ck_assert(feed(&damper, &conf, UNAVAILABLE, now += 1000));
+  ck_assert(damper.suppressed);
+  ck_assert_int_eq(damper.reported, DAMPER_DOWN);
+
+  // Then stays down: never shown up while the penalty decays
+  while (damper.suppressed) {
+    up_shown = feed(&damper, &conf, UNAVAILABLE, now += 1000) || up_shown;
+    ck_assert_int_eq(damper.reported, DAMPER_DOWN);
+  }
+
+  ck_assert(!up_shown);
+
+  // Entering suppression on a flip to up still reports down
+  probe_damper_init(&damper);
+  now = 0;
+  ck_assert(feed(&damper, &conf, UNAVAILABLE, now));
+  feed(&damper, &conf, AVAILABLE, now += 10);
+  feed(&damper, &conf, UNAVAILABLE, now += 10);
+  ck_assert(!feed(&damper, &conf, AVAILABLE, now += 10));
+  ck_assert(damper.suppressed);
+  ck_assert_int_eq(damper.reported, DAMPER_DOWN);
+}
+END_TEST
+
+START_TEST(history_test)
+{
+  probe_damping_conf_t conf;
+  probe_damper_t damper;
+  probe_history_entry_t entries[DAMPING_HISTORY + 1];
+
+  probe_damping_conf_init(&conf);
+  probe_damper_init(&damper);
+
+  ck_assert_uint_eq(probe_damper_history(&damper, entries, 4), 0);
+
+  for (uint64_t i = 0; i < DAMPING_HISTORY + 5; ++i) {
+    feed(&damper, &conf, i % 2 == 0 ? AVAILABLE : UNAVAILABLE, i);
+  }
+
+  ck_assert_uint_eq(probe_damper_history(&damper, entries, 4), 4);
+  ck_assert_uint_eq(entries[0].at_ms, DAMPING_HISTORY + 4);
+  ck_assert_int_eq(entries[0].state, AVAILABLE);
+  ck_assert_uint_eq(entries[1].at_ms, DAMPING_HISTORY + 3);
+  ck_assert_int_eq(entries[1].state, UNAVAILABLE);
+  ck_assert_uint_eq(entries[1].total_us, DAMPING_HISTORY + 3);
+
+  // Only the most recent ones are kept
+  ck_assert_uint_eq(
+    probe_damper_history(&damper, entries, DAMPING_HISTORY + 1),
+    DAMPING_HISTORY);
+  ck_assert_uint_eq(entries[DAMPING_HISTORY - 1].at_ms, 5);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe damping test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, hysteresis_test);
+  tcase_add_test(t, flap_damping_test);
+  tcase_add_test(t, flap_held_down_test);
+  tcase_add_test(t, history_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
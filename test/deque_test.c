@@ -0,0 +1,149 @@
+#include "deque.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define IDS 100000
+#define THIEVES 3
+
+typedef struct stress
+{
+  probe_deque_t* deque;
+  // How many times every id was taken or stolen
+  uint8_t* seen;
+  size_t stolen;
+  bool pushing;
+} stress_t;
+
+START_TEST(deque_test)
+{
+  probe_deque_t* deque = probe_deque_create(3);
+  uint32_t id;
+
+  ck_assert_ptr_nonnull(deque);
+  ck_assert_int_eq(probe_deque_take(deque, &id), DEQUE_EMPTY);
+  ck_assert_int_eq(probe_deque_steal(deque, &id), DEQUE_EMPTY);
+
+  // Rounded up to 4
+  for (uint32_t i = 0; i < 4; ++i) {
+    ck_assert(probe_deque_push(deque, i));
+  }
+
+  ck_assert(!probe_deque_push(deque, 4));
+
+  // Owner is LIFO, thieves are FIFO
+  ck_assert_int_eq(probe_deque_take(deque, &id), DEQUE_OK);
+  ck_assert_uint_eq(id, 3);
+  ck_assert_int_eq(probe_deque_steal(deque, &id), DEQUE_OK);
+  ck_assert_uint_eq(id, 0);
+  ck_assert_int_eq(probe_deque_steal(deque, &id), DEQUE_OK);
+  ck_assert_uint_eq(id, 1);
+  ck_assert_int_eq(probe_deque_take(deque, &id), DEQUE_OK);
+  ck_assert_uint_eq(id, 2);
+  ck_assert_int_eq(probe_deque_take(deque, &id), DEQUE_EMPTY);
+
+  // Room is reused after wrapping around
+  ck_assert(probe_deque_push(deque, 5));
+  ck_assert_int_eq(probe_deque_steal(deque, &id), DEQUE_OK);
+  ck_assert_uint_eq(id, 5);
+
+  probe_deque_destroy(deque);
+}
+END_TEST
+
+static void*
+thief_run(void* arg)
+{
+  stress_t* stress = arg;
+  uint32_t id;
+  DEQUE_STATE state;
+
+  while ((state = probe_deque_steal(stress->deque, &id)) != DEQUE_EMPTY ||
+         __atomic_load_n(&stress->pushing, __ATOMIC_ACQUIRE)) {
+    if (state == DEQUE_OK) {
+      __atomic_add_fetch(&stress->seen[id], 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&stress->stolen, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  return NULL;
+}
+
+START_TEST(deque_stress_test)
+{
+  stress_t stress = { .deque = probe_deque_create(1024),
+                      .seen = calloc(IDS, 1),
+                      .pushing = true };
+  pthread_t thieves[THIEVES];
+  uint32_t id;
+
+  for (size_t i = 0; i < THIEVES; ++i) {
+    ck_assert_int_eq(
+      pthread_create(&thieves[i], NULL, thief_run, &stress), 0);
+  }
+
+  // Owner keeps pushing & taking every other id while thieves steal
+  for (uint32_t i = 0; i < IDS; ++i) {
+    while (!probe_deque_push(stress.deque, i)) {
+      if (probe_deque_take(stress.deque, &id) == DEQUE_OK) {
+        __atomic_add_fetch(&stress.seen[id], 1, __ATOMIC_RELAXED);
+      }
+    }
+
+    if (i % 2 == 0 && probe_deque_take(stress.deque, &id) == DEQUE_OK) {
+      __atomic_add_fetch(&stress.seen[id], 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  while (probe_deque_take(stress.deque, &id) == DEQUE_OK) {
+    __atomic_add_fetch(&stress.seen[id], 1, __ATOMIC_RELAXED);
+  }
+
+  __atomic_store_n(&stress.pushing, false, __ATOMIC_RELEASE);
+
+  for (size_t i = 0; i < THIEVES; ++i) {
+    pthread_join(thieves[i], NULL);
+  }
+
+  // Every id is handed out exactly once
+  for (size_t i = 0; i < IDS; ++i) {
+    ck_assert_uint_eq(stress.seen[i], 1);
+  }
+
+  free(stress.seen);
+  probe_deque_destroy(stress.deque);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe deque test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, deque_test);
+  tcase_add_test(t, deque_stress_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
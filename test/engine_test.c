@@ -0,0 +1,254 @@
+#include "engine.h"
+#include "test.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+START_TEST(target_init_test)
+{
+  probe_target_t target;
+  struct sockaddr_in* addr = (struct sockaddr_in*)&target.addr;
+
+  ck_assert_int_eq(probe_target_init(&target, "127.0.0.1", "8080", NULL),
+                   CANCELLED);
+  ck_assert_int_eq(addr->sin_family, AF_INET);
+  ck_assert_int_eq(ntohs(addr->sin_port), 8080);
+  ck_assert_int_eq(ntohl(addr->sin_addr.s_addr), INADDR_LOOPBACK);
+
+  ck_assert_int_eq(probe_target_init(&target, "localhost", "1", "tcp"),
+                   CANCELLED);
+  ck_assert_int_eq(probe_target_init(&target, "localhost", "1", "udp"),
+                   UNKNOWN_PROTOCOL);
+  ck_assert_int_eq(probe_target_init(&target, "localhost", "65536", NULL),
+                   UNKNOWN_SERVICE);
+  ck_assert_int_eq(
+    probe_target_init(&target, "localhost", "4321https1234", NULL),
+    UNKNOWN_SERVICE);
+  ck_assert_int_eq(probe_target_init(&target, "4321example1234.", "1", NULL),
+                   UNKNOWN_HOST);
+}
+END_TEST
+
+START_TEST(engine_test)
+{
+  probe_engine_conf_t conf = { .retry_count = 3,
+                               .connect_timeout_ms = 100,
+                               .backoff_ms = 50 };
+  probe_engine_t* engine = probe_engine_create(2, &conf);
+  probe_target_t up, down, extra;
+  in_port_t port;
+  int sock = listen_loopback(&port);
+  char port_str[8];
+  size_t done = 0;
+
+  ck_assert_ptr_nonnull(engine);
+
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  probe_target_init(&up, "127.0.0.1", port_str, NULL);
+  close(listen_loopback(&port));
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  probe_target_init(&down, "127.0.0.1", port_str, NULL);
+
+  ck_assert(probe_engine_submit(engine, &up));
+  ck_assert(probe_engine_submit(engine, &down));
+  ck_assert(!probe_engine_submit(engine, &extra));
+  ck_assert_uint_eq(probe_engine_active(engine), 2);
+
+  while (probe_engine_active(engine) > 0) {
+    done += probe_engine_run(engine, -1, NULL, NULL);
+  }
+
+  ck_assert_uint_eq(done, 2);
+  ck_assert_int_eq(up.result.state, AVAILABLE);
+  ck_assert_uint_eq(up.result.timings.attempts, 1);
+  ck_assert_int_eq(down.result.state, UNAVAILABLE);
+  ck_assert_uint_eq(down.result.timings.attempts, 3);
+  ck_assert_uint_ge(down.result.timings.phase_ns[PHASE_BACKOFF],
+                    2 * 50 * 1000000ull);
+
+  probe_engine_destroy(engine);
+  close(sock);
+}
+END_TEST
+
+START_TEST(engine_unix_test)
+{
+  probe_engine_conf_t conf = { .retry_count = 2,
+                               .connect_timeout_ms = 100,
+                               .backoff_ms = 10,
+                               .per_host = 1 };
+  probe_engine_t* engine = probe_engine_create(3, &conf);
+  probe_target_t stream, seqpacket, missing;
+  char path[64];
+  int stream_sock, seqpacket_sock;
+
+  snprintf(path, sizeof(path), "/tmp/engine_test_%d.sock", getpid());
+  stream_sock = listen_unix(path, SOCK_STREAM);
+  seqpacket_sock = listen_unix("@engine_test_seqpacket", SOCK_SEQPACKET);
+
+  ck_assert_int_eq(probe_target_init_unix(&stream, path, SOCK_STREAM),
+                   CANCELLED);
+  ck_assert_int_eq(stream.addr.ss_family, AF_UNIX);
+  ck_assert_int_eq(probe_target_init_unix(
+                     &seqpacket, "@engine_test_seqpacket", SOCK_SEQPACKET),
+                   CANCELLED);
+  ck_assert_int_eq(
+    probe_target_init_unix(&missing, "@engine_test_missing", SOCK_STREAM),
+    CANCELLED);
+  ck_assert_int_eq(probe_target_init_unix(&missing, "", SOCK_STREAM),
+                   INVALID_PATH);
+  ck_assert_int_eq(probe_target_init_unix(&missing, path, SOCK_DGRAM),
+                   UNKNOWN_PROTOCOL);
+  probe_target_init_unix(&missing, "@engine_test_missing", SOCK_STREAM);
+
+  ck_assert(probe_engine_submit(engine, &stream));
+  ck_assert(probe_engine_submit(engine, &seqpacket));
+  ck_assert(probe_engine_submit(engine, &missing));
+
+  while (probe_engine_active(engine) > 0) {
+    probe_engine_run(engine, -1, NULL, NULL);
+  }
+
+  ck_assert_int_eq(stream.result.state, AVAILABLE);
+  ck_assert_int_eq(seqpacket.result.state, AVAILABLE);
+  ck_assert_int_eq(missing.result.state, UNAVAILABLE);
+  ck_assert_uint_eq(missing.result.timings.attempts, 2);
+
+  probe_engine_destroy(engine);
+  close(stream_sock);
+  close(seqpacket_sock);
+  unlink(path);
+}
+END_TEST
+
+START_TEST(engine_limits_test)
+{
+  probe_engine_conf_t conf = { .retry_count = 1,
+                               .connect_timeout_ms = 100,
+                               .rate = 100,
+                               .burst = 1,
+                               .per_host = 1 };
+  probe_engine_t* engine = probe_engine_create(10, &conf);
+  probe_target_t targets[10];
+  in_port_t port;
+  int sock = listen_loopback(&port);
+  char port_str[8];
+  uint64_t pacing = 0;
+  time_t start = time(NULL);
+  size_t done = 0;
+
+  snprintf(port_str, sizeof(port_str), "%u", port);
+
+  for (size_t i = 0; i < 10; ++i) {
+    probe_target_init(&targets[i], "127.0.0.1", port_str, NULL);
+    ck_assert(probe_engine_submit(engine, &targets[i]));
+  }
+
+  while (probe_engine_active(engine) > 0) {
+    done += probe_engine_run(engine, -1, NULL, NULL);
+  }
+
+  ck_assert_uint_eq(done, 10);
+
+  for (size_t i = 0; i < 10; ++i) {
+    ck_assert_int_eq(targets[i].result.state, AVAILABLE);
+    pacing += targets[i].result.timings.phase_ns[PHASE_PACING];
+  }
+
+  // The n-th connect waits n * 10 ms, 450 ms in total
+  ck_assert_uint_ge(pacing, 400 * 1000000ull);
+  ck_assert_int_le(time(NULL) - start, 1);
+
+  probe_engine_destroy(engine);
+  close(sock);
+}
+END_TEST
+
+START_TEST(quorum_test)
+{
+  probe_target_t targets[3];
+  in_port_t port;
+  int sock = listen_loopback(&port);
+  char up[8], down[8];
+  time_t start;
+
+  snprintf(up, sizeof(up), "%u", port);
+  close(listen_loopback(&port));
+  snprintf(down, sizeof(down), "%u", port);
+
+  probe_config(5, 1);
+
+  probe_target_init(&targets[0], "127.0.0.1", up, NULL);
+  probe_target_init(&targets[1], "localhost", up, NULL);
+  ck_assert(probe_quorum(targets, 2, 2));
+  ck_assert_int_eq(targets[0].result.state, AVAILABLE);
+  ck_assert_int_eq(targets[1].result.state, AVAILABLE);
+
+  // Short circuits without waiting for the retries of the failing target
+  start = time(NULL);
+  probe_target_init(&targets[0], "127.0.0.1", down, NULL);
+  probe_target_init(&targets[1], "127.0.0.1", up, NULL);
+  probe_target_init(&targets[2], "127.0.0.1", up, NULL);
+  ck_assert(probe_quorum(targets, 3, 2));
+  ck_assert_int_le(time(NULL) - start, 1);
+  ck_assert_int_eq(targets[0].result.state, CANCELLED);
+
+  // Can't be met after the unresolvable target
+  start = time(NULL);
+  probe_target_init(&targets[0], "127.0.0.1", down, NULL);
+  probe_target_init(&targets[1], "4321example1234.", up, NULL);
+  ck_assert(!probe_quorum(targets, 2, 2));
+  ck_assert_int_le(time(NULL) - start, 1);
+  ck_assert_int_eq(targets[1].result.state, UNKNOWN_HOST);
+
+  // Worst case is the slowest target, not the sum
+  probe_config(3, 1);
+  start = time(NULL);
+  probe_target_init(&targets[0], "127.0.0.1", down, NULL);
+  probe_target_init(&targets[1], "127.0.0.1", down, NULL);
+  probe_target_init(&targets[2], "127.0.0.1", down, NULL);
+  ck_assert(!probe_quorum(targets, 3, 1));
+  ck_assert_int_ge(time(NULL) - start, 2);
+  ck_assert_int_le(time(NULL) - start, 3);
+
+  close(sock);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe engine test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, target_init_test);
+  tcase_add_test(t, engine_test);
+  tcase_add_test(t, engine_unix_test);
+  tcase_add_test(t, engine_limits_test);
+  tcase_add_test(t, quorum_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
@@ -0,0 +1,327 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+// Scripted network faults on loopback. The test binary defines `connect`, so
+// the library calls it instead of the libc one: every connect to the fault
+// port takes the next step of the script (the last one repeats) and is sent
+// to a loopback socket of that step misbehaving for real in the kernel
+
+#include "test.h"
+#include <check.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FAULT_MAX_STEPS 16
+#define FAULT_NO_DUE UINT64_MAX
+
+typedef enum FAULT
+{
+  // Accepted right away
+  FAULT_ACCEPT,
+  // Closed port, the SYN is answered with a reset
+  FAULT_REFUSE,
+  // Listener with a full accept queue, the SYN is dropped
+  FAULT_BLACKHOLE,
+  // Dropped SYN like a blackhole, the queue is drained after `delay_ms`, so
+  // the SYN retransmission (a second after the first SYN) gets the SYN-ACK
+  FAULT_DELAY,
+  // Accepted, then reset
+  FAULT_RESET,
+  // Accepted, the banner is written after `delay_ms`
+  FAULT_SLOW_BANNER,
+} FAULT;
+
+typedef struct fault_step
+{
+  FAULT fault;
+  uint32_t delay_ms;
+  // Listener of the step, or the closed port to refuse
+  int sock;
+  in_port_t port;
+  // Connection filling the accept queue of a blackhole or delay
+  int filler;
+  // Delay queue drain, banner write
+  uint64_t due_ns;
+  int conn;
+} fault_step_t;
+
+typedef struct fault_script
+{
+  in_port_t port;
+  fault_step_t steps[FAULT_MAX_STEPS];
+  size_t count;
+  size_t next;
+  const char* banner;
+  bool stop;
+  pthread_t thread;
+} fault_script_t;
+
+static fault_script_t fault_script;
+
+static uint64_t
+fault_now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int
+connect(int sock, const struct sockaddr* addr, socklen_t addrlen)
+{
+  const struct sockaddr_in* sin = (const struct sockaddr_in*)addr;
+  struct sockaddr_in redirect;
+  fault_step_t* step;
+  size_t next;
+
+  if (sin->sin_family != AF_INET ||
+      sin->sin_addr.s_addr != htonl(INADDR_LOOPBACK) ||
+      fault_script.count == 0 || ntohs(sin->sin_port) != fault_script.port) {
+    return (int)syscall(SYS_connect, sock, addr, addrlen);
+  }
+
+  next = __atomic_fetch_add(&fault_script.next, 1, __ATOMIC_RELAXED);
+  step = &fault_script.steps[next < fault_script.count
+                               ? next
+                               : fault_script.count - 1];
+  redirect = *sin;
+  redirect.sin_port = htons(step->port);
+
+  if (step->fault == FAULT_DELAY &&
+      __atomic_load_n(&step->due_ns, __ATOMIC_ACQUIRE) == FAULT_NO_DUE) {
+    __atomic_store_n(&step->due_ns,
+                     fault_now_ns() + step->delay_ms * 1000000ull,
+                     __ATOMIC_RELEASE);
+  }
+
+  return (int)syscall(
+    SYS_connect, sock, (const struct sockaddr*)&redirect, sizeof(redirect));
+}
+
+// Connects until one isn't accepted at once, the rest of them queue up
+static int
+fill_queue(in_port_t port)
+{
+  struct sockaddr_in addr = { .sin_family = AF_INET,
+                              .sin_port = htons(port),
+                              .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  int filler = -1;
+
+  for (;;) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+
+    syscall(SYS_connect, sock, (struct sockaddr*)&addr, sizeof(addr));
+
+    if (poll(&pfd, 1, 50) == 0) {
+      close(sock);
+      break;
+    }
+
+    // Backlog of 0 takes one connection, more aren't expected
+    ck_assert_int_eq(filler, -1);
+    filler = sock;
+  }
+
+  return filler;
+}
+
+static void
+fault_step_open(fault_step_t* step)
+{
+  step->sock = -1;
+  step->filler = -1;
+  step->conn = -1;
+  step->due_ns = FAULT_NO_DUE;
+
+  switch (step->fault) {
+    case FAULT_REFUSE: {
+      close(listen_loopback(&step->port));
+      break;
+    }
+    case FAULT_BLACKHOLE:
+    case FAULT_DELAY: {
+      step->sock = listen_loopback(&step->port);
+      ck_assert_int_eq(listen(step->sock, 0), 0);
+      step->filler = fill_queue(step->port);
+      break;
+    }
+    default: {
+      step->sock = listen_loopback(&step->port);
+      break;
+    }
+  }
+}
+
+// Accepted connection of `step`
+static void
+fault_accepted(fault_step_t* step, int conn)
+{
+  struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+
+  switch (step->fault) {
+    case FAULT_RESET: {
+      setsockopt(conn, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+      close(conn);
+      break;
+    }
+    case FAULT_SLOW_BANNER: {
+      // One connection per step, the script repeats the step otherwise
+      if (step->conn != -1) {
+        close(step->conn);
+      }
+
+      step->conn = conn;
+      step->due_ns = fault_now_ns() + step->delay_ms * 1000000ull;
+      break;
+    }
+    default: {
+      close(conn);
+      break;
+    }
+  }
+}
+
+// Runs due delays & banners, returns the poll timeout till the next one
+static int
+fault_due(uint64_t now)
+{
+  uint64_t next = FAULT_NO_DUE;
+
+  for (size_t i = 0; i < fault_script.count; ++i) {
+    fault_step_t* step = &fault_script.steps[i];
+    uint64_t due = __atomic_load_n(&step->due_ns, __ATOMIC_ACQUIRE);
+
+    if (due > now) {
+      next = due < next ? due : next;
+      continue;
+    }
+
+    if (step->fault == FAULT_DELAY && step->filler != -1) {
+      // The filler leaves the queue, the retransmitted SYN takes its place
+      close(accept(step->sock, NULL, NULL));
+      close(step->filler);
+      step->filler = -1;
+    } else if (step->fault == FAULT_SLOW_BANNER && step->conn != -1) {
+      ck_assert_int_gt(
+        write(step->conn, fault_script.banner, strlen(fault_script.banner)),
+        0);
+    }
+
+    __atomic_store_n(&step->due_ns, FAULT_NO_DUE, __ATOMIC_RELEASE);
+  }
+
+  // Connects of the probe set new due times, they are picked up this often
+  return next == FAULT_NO_DUE || next - now > 5000000ull
+           ? 5
+           : (int)((next - now + 999999) / 1000000);
+}
+
+static void*
+fault_serve(void* data)
+{
+  struct pollfd pfds[FAULT_MAX_STEPS];
+
+  (void)data;
+
+  while (!__atomic_load_n(&fault_script.stop, __ATOMIC_ACQUIRE)) {
+    int timeout = fault_due(fault_now_ns());
+    size_t count = 0;
+
+    // Drained delays are listening like any other step
+    for (size_t i = 0; i < fault_script.count; ++i) {
+      fault_step_t* step = &fault_script.steps[i];
+
+      pfds[i].fd = step->sock != -1 && step->filler == -1 ? step->sock : -1;
+      pfds[i].events = POLLIN;
+      count++;
+    }
+
+    if (poll(pfds, count, timeout) <= 0) {
+      continue;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      if (pfds[i].revents & POLLIN) {
+        int conn = accept(pfds[i].fd, NULL, NULL);
+
+        if (conn != -1) {
+          fault_accepted(&fault_script.steps[i], conn);
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+// Starts serving the `count` steps of the script, `banner` is written by
+// slow banner steps. Returns the fault port
+static in_port_t
+fault_start(const fault_step_t* steps, size_t count, const char* banner)
+{
+  ck_assert_uint_gt(count, 0);
+  ck_assert_uint_le(count, FAULT_MAX_STEPS);
+
+  memset(&fault_script, 0, sizeof(fault_script));
+  close(listen_loopback(&fault_script.port));
+  fault_script.banner = banner != NULL ? banner : "";
+
+  for (size_t i = 0; i < count; ++i) {
+    fault_script.steps[i].fault = steps[i].fault;
+    fault_script.steps[i].delay_ms = steps[i].delay_ms;
+    fault_step_open(&fault_script.steps[i]);
+  }
+
+  fault_script.count = count;
+  ck_assert_int_eq(
+    pthread_create(&fault_script.thread, NULL, fault_serve, NULL), 0);
+
+  return fault_script.port;
+}
+
+// Steps taken so far
+static size_t
+fault_stop()
+{
+  size_t taken = __atomic_load_n(&fault_script.next, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&fault_script.stop, true, __ATOMIC_RELEASE);
+  pthread_join(fault_script.thread, NULL);
+
+  for (size_t i = 0; i < fault_script.count; ++i) {
+    fault_step_t* step = &fault_script.steps[i];
+
+    close(step->sock);
+    close(step->filler);
+    close(step->conn);
+  }
+
+  fault_script.count = 0;
+
+  return taken;
+}
+
+// Time to verdict of a scenario, printed to be tracked between runs
+static uint64_t
+fault_report(const char* scenario, uint64_t start_ns)
+{
+  uint64_t elapsed_ms = (fault_now_ns() - start_ns) / 1000000ull;
+
+  fprintf(stderr,
+          "time-to-verdict %s: %llu ms\n",
+          scenario,
+          (unsigned long long)elapsed_ms);
+
+  return elapsed_ms;
+}
+
+#endif
@@ -0,0 +1,212 @@
+#include "engine.h"
+#include "fault.h"
+#include "probe.h"
+#include "test.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Slack over the worst case of a policy: scheduling, loopback & the harness
+// poll granularity
+#define SLACK_MS 100
+
+typedef struct scenario
+{
+  const char* name;
+  fault_step_t steps[FAULT_MAX_STEPS];
+  size_t count;
+  SERVICE_STATE state;
+  // Connect attempts it takes to the verdict
+  size_t attempts;
+  // Time to verdict is within `[min_ms, min_ms + SLACK_MS]`
+  uint64_t min_ms;
+} scenario_t;
+
+// Blocking `probe()` with 3 attempts & 1 second timeouts
+static const scenario_t blocking_scenarios[] = {
+  { "blocking refused twice",
+    { { FAULT_REFUSE }, { FAULT_REFUSE }, { FAULT_ACCEPT } },
+    3,
+    AVAILABLE,
+    3,
+    2000 },
+  // Connects are cut by the timeout, every attempt waits it out
+  { "blocking blackhole", { { FAULT_BLACKHOLE } }, 1, UNAVAILABLE, 3, 5000 },
+  { "blocking reset after accept", { { FAULT_RESET } }, 1, AVAILABLE, 1, 0 },
+};
+
+// Engine with 3 attempts, 100 ms connect timeouts & 50 ms backoff
+static const scenario_t engine_scenarios[] = {
+  { "engine blackhole then refused",
+    { { FAULT_BLACKHOLE }, { FAULT_REFUSE }, { FAULT_ACCEPT } },
+    3,
+    AVAILABLE,
+    3,
+    200 },
+  { "engine blackhole", { { FAULT_BLACKHOLE } }, 1, UNAVAILABLE, 3, 400 },
+  { "engine refused", { { FAULT_REFUSE } }, 1, UNAVAILABLE, 3, 100 },
+};
+
+static void
+run_blocking(const scenario_t* scenario)
+{
+  in_port_t port = fault_start(scenario->steps, scenario->count, NULL);
+  uint64_t start = fault_now_ns(), elapsed_ms;
+  probe_result_t result;
+
+  probe_config(3, 1);
+
+  ck_assert_int_eq(ipv4_port_probe_r("127.0.0.1", port, NULL, &result),
+                   scenario->state);
+  elapsed_ms = fault_report(scenario->name, start);
+  ck_assert_uint_eq(fault_stop(), scenario->attempts);
+  ck_assert_uint_eq(result.timings.attempts, scenario->attempts);
+  ck_assert_uint_ge(elapsed_ms, scenario->min_ms);
+  ck_assert_uint_le(elapsed_ms, scenario->min_ms + SLACK_MS);
+}
+
+// Verdict of a single target of the fault port, the engine clock starts
+// with the submit
+static uint64_t
+engine_verdict(const probe_engine_conf_t* conf,
+               const char* scenario,
+               in_port_t port,
+               probe_target_t* target)
+{
+  probe_engine_t* engine = probe_engine_create(1, conf);
+  char port_str[8];
+  uint64_t start;
+
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  ck_assert_int_eq(probe_target_init(target, "127.0.0.1", port_str, NULL),
+                   CANCELLED);
+
+  start = fault_now_ns();
+  ck_assert(probe_engine_submit(engine, target));
+
+  while (probe_engine_active(engine) > 0) {
+    probe_engine_run(engine, -1, NULL, NULL);
+  }
+
+  probe_engine_destroy(engine);
+
+  return fault_report(scenario, start);
+}
+
+static void
+run_engine(const scenario_t* scenario)
+{
+  probe_engine_conf_t conf = { .retry_count = 3,
+                               .connect_timeout_ms = 100,
+                               .backoff_ms = 50 };
+  in_port_t port = fault_start(scenario->steps, scenario->count, NULL);
+  probe_target_t target;
+  uint64_t elapsed_ms = engine_verdict(&conf, scenario->name, port, &target);
+
+  ck_assert_uint_eq(fault_stop(), scenario->attempts);
+  ck_assert_int_eq(target.result.state, scenario->state);
+  ck_assert_uint_eq(target.result.timings.attempts, scenario->attempts);
+  ck_assert_uint_ge(elapsed_ms, scenario->min_ms);
+  ck_assert_uint_le(elapsed_ms, scenario->min_ms + SLACK_MS);
+}
+
+START_TEST(fault_blocking_test)
+{
+  size_t count = sizeof(blocking_scenarios) / sizeof(scenario_t);
+
+  for (size_t i = 0; i < count; ++i) {
+    run_blocking(&blocking_scenarios[i]);
+  }
+}
+END_TEST
+
+START_TEST(fault_engine_test)
+{
+  size_t count = sizeof(engine_scenarios) / sizeof(scenario_t);
+
+  for (size_t i = 0; i < count; ++i) {
+    run_engine(&engine_scenarios[i]);
+  }
+}
+END_TEST
+
+START_TEST(fault_delay_test)
+{
+  probe_engine_conf_t conf = { .retry_count = 1, .connect_timeout_ms = 2000 };
+  fault_step_t steps[] = { { FAULT_DELAY, 200 } };
+  in_port_t port = fault_start(steps, 1, NULL);
+  probe_target_t target;
+  uint64_t elapsed_ms =
+    engine_verdict(&conf, "engine delayed SYN-ACK", port, &target);
+
+  fault_stop();
+
+  // The dropped SYN is retransmitted after the initial RTO of a second
+  ck_assert_int_eq(target.result.state, AVAILABLE);
+  ck_assert_uint_ge(elapsed_ms, 1000);
+  ck_assert_uint_le(elapsed_ms, 1000 + SLACK_MS);
+}
+END_TEST
+
+START_TEST(fault_grpc_test)
+{
+  probe_engine_conf_t conf = { .retry_count = 1,
+                               .connect_timeout_ms = 200,
+                               .grpc = true };
+  fault_step_t reset[] = { { FAULT_RESET } };
+  fault_step_t slow[] = { { FAULT_SLOW_BANNER, 500 } };
+  probe_target_t target;
+  uint64_t elapsed_ms;
+
+  // Reset mid call fails right away
+  elapsed_ms = engine_verdict(
+    &conf, "grpc reset after accept", fault_start(reset, 1, NULL), &target);
+  fault_stop();
+  ck_assert_int_eq(target.result.state, NOT_SERVING);
+  ck_assert_uint_le(elapsed_ms, SLACK_MS);
+
+  // A reply slower than the deadline is never waited for
+  elapsed_ms = engine_verdict(&conf,
+                              "grpc slow banner",
+                              fault_start(slow, 1, "HTTP/1.1 200 OK\r\n"),
+                              &target);
+  fault_stop();
+  ck_assert_int_eq(target.result.state, NOT_SERVING);
+  ck_assert_uint_ge(elapsed_ms, 200);
+  ck_assert_uint_le(elapsed_ms, 200 + SLACK_MS);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe fault injection test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, fault_blocking_test);
+  tcase_add_test(t, fault_engine_test);
+  tcase_add_test(t, fault_delay_test);
+  tcase_add_test(t, fault_grpc_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
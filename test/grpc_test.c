@@ -0,0 +1,352 @@
+#include "engine.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef enum SERVER_MODE
+{
+  // Answers by the requested service name, see `respond`
+  SERVER_GRPC,
+  SERVER_HTTP1,
+  SERVER_SILENT,
+} SERVER_MODE;
+
+typedef struct server
+{
+  int sock;
+  in_port_t port;
+  SERVER_MODE mode;
+  size_t connections;
+  pthread_t thread;
+} server_t;
+
+// `:status: 200` & `content-type: application/grpc`
+static const uint8_t response_headers[] = {
+  0x88, 0x0f, 0x10, 16, 'a', 'p', 'p', 'l', 'i', 'c', 'a', 't',
+  'i',  'o',  'n',  '/', 'g', 'r', 'p', 'c',
+};
+
+// `grpc-status: 0`
+static const uint8_t ok_trailers[] = { 0x00, 11,  'g', 'r', 'p', 'c', '-',
+                                       's',  't', 'a', 't', 'u', 's', 1,
+                                       '0' };
+
+// The same Huffman encoded, RFC 7541 Appendix B
+static const uint8_t ok_trailers_huffman[] = { 0x00, 0x88, 0x9a, 0xca, 0xc8,
+                                               0xb2, 0x12, 0x34, 0xda, 0x8f,
+                                               0x81, 0x07 };
+
+// `grpc-status: 5` & Huffman encoded `grpc-message` of RFC 7541 C.4.3
+static const uint8_t not_found_trailers[] = {
+  0x00, 11,   'g',  'r',  'p',  'c',  '-',  's',  't',  'a',  't',  'u',
+  's',  1,    '5',  0x00, 12,   'g',  'r',  'p',  'c',  '-',  'm',  'e',
+  's',  's',  'a',  'g',  'e',  0x91, 0x9d, 0x29, 0xad, 0x17, 0x18, 0x63,
+  0xc7, 0x8f, 0x0b, 0x97, 0xc8, 0xe9, 0xae, 0x82, 0xae, 0x43, 0xd3,
+};
+
+static void
+read_full(int sock, uint8_t* buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = read(sock, buf, len);
+
+    ck_assert_int_gt(n, 0);
+    buf += n;
+    len -= (size_t)n;
+  }
+}
+
+static void
+write_frame(int sock,
+            uint8_t type,
+            uint8_t flags,
+            const uint8_t* payload,
+            size_t len)
+{
+  uint8_t frame[512] = { (uint8_t)(len >> 16), (uint8_t)(len >> 8),
+                         (uint8_t)len,         type,
+                         flags,                0,
+                         0,                    0,
+                         type == 0x4 || type == 0x6 ? 0 : 1 };
+
+  memcpy(frame + 9, payload, len);
+  ck_assert_int_eq(write(sock, frame, 9 + len), (ssize_t)(9 + len));
+}
+
+// Reads the preface & the call, returns the requested service name
+static void
+read_call(int sock, char* service)
+{
+  uint8_t buf[512];
+  uint32_t len;
+
+  read_full(sock, buf, 24);
+  ck_assert_int_eq(memcmp(buf, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24), 0);
+
+  for (;;) {
+    read_full(sock, buf, 9);
+    len = (uint32_t)buf[0] << 16 | (uint32_t)buf[1] << 8 | buf[2];
+    ck_assert_uint_le(len, sizeof(buf));
+
+    uint8_t type = buf[3], flags = buf[4];
+
+    read_full(sock, buf, len);
+
+    if (type == 0x0 && flags & 0x1) {
+      size_t name_len = 0, at = 6;
+
+      // Field tag, then the varint length of the name
+      for (unsigned shift = 0; len > 5 && at < len; shift += 7) {
+        name_len |= (size_t)(buf[at] & 0x7f) << shift;
+
+        if (!(buf[at++] & 0x80)) {
+          break;
+        }
+      }
+
+      ck_assert_uint_eq(len, len > 5 ? at + name_len : 5);
+      ck_assert_uint_lt(name_len, 256);
+      memcpy(service, buf + at, name_len);
+      service[name_len] = '\0';
+      return;
+    }
+  }
+}
+
+static void
+respond(int sock, const char* service)
+{
+  uint8_t serving[] = { 0, 0, 0, 0, 2, 0x08, 0x01 };
+  uint8_t padded[] = { 3, 0, 0, 0, 0, 2, 0x08, 0x02, 0, 0, 0 };
+  uint8_t ping[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+  write_frame(sock, 0x4, 0, NULL, 0);
+  write_frame(sock, 0x4, 0x1, NULL, 0);
+  write_frame(sock, 0x6, 0, ping, sizeof(ping));
+
+  // Names longer than a single byte varint are serving as well
+  if (strcmp(service, "") == 0 || strlen(service) > 127) {
+    write_frame(sock, 0x1, 0x4, response_headers, sizeof(response_headers));
+    write_frame(sock, 0x0, 0, serving, sizeof(serving));
+    write_frame(sock, 0x1, 0x5, ok_trailers, sizeof(ok_trailers));
+  } else if (strcmp(service, "down") == 0) {
+    // Padded DATA, trailers split into CONTINUATION
+    write_frame(sock, 0x1, 0x4, response_headers, sizeof(response_headers));
+    write_frame(sock, 0x0, 0x8, padded, sizeof(padded));
+    write_frame(sock, 0x1, 0x1, ok_trailers_huffman, 5);
+    write_frame(sock,
+                0x9,
+                0x4,
+                ok_trailers_huffman + 5,
+                sizeof(ok_trailers_huffman) - 5);
+  } else {
+    // Trailers-only response of a failed call
+    uint8_t block[sizeof(response_headers) + sizeof(not_found_trailers)];
+
+    memcpy(block, response_headers, sizeof(response_headers));
+    memcpy(block + sizeof(response_headers),
+           not_found_trailers,
+           sizeof(not_found_trailers));
+    write_frame(sock, 0x1, 0x5, block, sizeof(block));
+  }
+}
+
+static void*
+serve(void* data)
+{
+  server_t* server = data;
+  char service[256];
+  const char* http1 = "HTTP/1.1 400 Bad Request\r\n\r\n";
+  uint8_t buf[256];
+
+  for (size_t i = 0; i < server->connections; ++i) {
+    int conn = accept(server->sock, NULL, NULL);
+
+    switch (server->mode) {
+      case SERVER_GRPC: {
+        read_call(conn, service);
+        respond(conn, service);
+        break;
+      }
+      case SERVER_HTTP1: {
+        ck_assert_int_gt(write(conn, http1, strlen(http1)), 0);
+        break;
+      }
+      case SERVER_SILENT: {
+        break;
+      }
+    }
+
+    // Till the client is gone, so nothing it reads is reset
+    while (read(conn, buf, sizeof(buf)) > 0) {
+    }
+
+    close(conn);
+  }
+
+  return NULL;
+}
+
+static void
+server_start(server_t* server, SERVER_MODE mode, size_t connections)
+{
+  server->sock = listen_loopback(&server->port);
+  server->mode = mode;
+  server->connections = connections;
+  ck_assert_int_eq(pthread_create(&server->thread, NULL, serve, server), 0);
+}
+
+static void
+server_stop(server_t* server)
+{
+  pthread_join(server->thread, NULL);
+  close(server->sock);
+}
+
+START_TEST(grpc_test)
+{
+  server_t server;
+  probe_result_t result;
+  char long_name[201];
+
+  server_start(&server, SERVER_GRPC, 4);
+  probe_config(1, 1);
+
+  probe_config_grpc(true, NULL);
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   AVAILABLE);
+  ck_assert(result.grpc.valid);
+  ck_assert_uint_eq(result.grpc.http_status, 200);
+  ck_assert_int_eq(result.grpc.grpc_status, 0);
+  ck_assert_int_eq(result.grpc.serving_status, GRPC_SERVING);
+  ck_assert_uint_gt(result.timings.phase_ns[PHASE_RPC], 0);
+
+  probe_config_grpc(true, "down");
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   NOT_SERVING);
+  ck_assert_int_eq(result.grpc.grpc_status, 0);
+  ck_assert_int_eq(result.grpc.serving_status, GRPC_NOT_SERVING);
+  ck_assert_str_eq(result.grpc.message, "NOT_SERVING");
+
+  probe_config_grpc(true, "missing");
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   NOT_SERVING);
+  ck_assert_int_eq(result.grpc.grpc_status, 5);
+  ck_assert_int_eq(result.grpc.serving_status, -1);
+  ck_assert_str_eq(result.grpc.message, "https://www.example.com");
+
+  memset(long_name, 'x', sizeof(long_name) - 1);
+  long_name[sizeof(long_name) - 1] = '\0';
+  probe_config_grpc(true, long_name);
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   AVAILABLE);
+  ck_assert_int_eq(result.grpc.serving_status, GRPC_SERVING);
+
+  probe_config_grpc(false, NULL);
+  server_stop(&server);
+}
+END_TEST
+
+START_TEST(grpc_failure_test)
+{
+  server_t server;
+  probe_result_t result;
+
+  server_start(&server, SERVER_HTTP1, 1);
+  probe_config(1, 1);
+  probe_config_grpc(true, NULL);
+
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   NOT_SERVING);
+  ck_assert(!result.grpc.valid);
+  ck_assert_str_eq(result.grpc.message, "not an HTTP/2 server");
+
+  server_stop(&server);
+  server_start(&server, SERVER_SILENT, 1);
+
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   NOT_SERVING);
+  ck_assert_str_eq(result.grpc.message, "health check timed out");
+  ck_assert_uint_ge(result.timings.phase_ns[PHASE_RPC], 900 * 1000000ull);
+
+  probe_config_grpc(false, NULL);
+  server_stop(&server);
+}
+END_TEST
+
+START_TEST(grpc_engine_test)
+{
+  server_t up, silent;
+  probe_engine_conf_t conf = { .retry_count = 1,
+                               .connect_timeout_ms = 200,
+                               .grpc = true,
+                               .grpc_service = "down" };
+  probe_engine_t* engine = probe_engine_create(2, &conf);
+  probe_target_t targets[2];
+  char port_str[8];
+
+  server_start(&up, SERVER_GRPC, 1);
+  server_start(&silent, SERVER_SILENT, 1);
+
+  snprintf(port_str, sizeof(port_str), "%u", up.port);
+  probe_target_init(&targets[0], "127.0.0.1", port_str, NULL);
+  snprintf(port_str, sizeof(port_str), "%u", silent.port);
+  probe_target_init(&targets[1], "127.0.0.1", port_str, NULL);
+
+  ck_assert(probe_engine_submit(engine, &targets[0]));
+  ck_assert(probe_engine_submit(engine, &targets[1]));
+
+  while (probe_engine_active(engine) > 0) {
+    probe_engine_run(engine, -1, NULL, NULL);
+  }
+
+  ck_assert_int_eq(targets[0].result.state, NOT_SERVING);
+  ck_assert_int_eq(targets[0].result.grpc.serving_status, GRPC_NOT_SERVING);
+  ck_assert_int_eq(targets[1].result.state, NOT_SERVING);
+  ck_assert_str_eq(targets[1].result.grpc.message, "health check timed out");
+  // The connect timeout covers the call, less the connect itself
+  ck_assert_uint_ge(targets[1].result.timings.phase_ns[PHASE_RPC],
+                    150 * 1000000ull);
+
+  probe_engine_destroy(engine);
+  server_stop(&up);
+  server_stop(&silent);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe gRPC test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, grpc_test);
+  tcase_add_test(t, grpc_failure_test);
+  tcase_add_test(t, grpc_engine_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
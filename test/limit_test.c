@@ -0,0 +1,295 @@
+#include "limit.h"
+#include "test.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NS_IN_S 1000000000ull
+
+typedef struct woken
+{
+  uint32_t ids[16];
+  size_t count;
+} woken_t;
+
+static void
+record(uint32_t id, void* data)
+{
+  woken_t* woken = data;
+
+  woken->ids[woken->count++] = id;
+}
+
+static struct sockaddr_storage
+ipv4(uint32_t ip)
+{
+  struct sockaddr_storage addr;
+  struct sockaddr_in* sin = (struct sockaddr_in*)&addr;
+
+  memset(&addr, 0, sizeof(addr));
+  sin->sin_family = AF_INET;
+  sin->sin_addr.s_addr = htonl(ip);
+
+  return addr;
+}
+
+START_TEST(limit_caps_test)
+{
+  probe_engine_conf_t conf = { .per_host = 2, .per_subnet = 3 };
+  probe_limiter_t* limiter = probe_limiter_create(8, &conf);
+  struct sockaddr_storage a = ipv4(0x0a000001), b = ipv4(0x0a000002),
+                          c = ipv4(0x0a000102);
+  woken_t woken = { 0 };
+  uint64_t retry;
+
+  ck_assert_ptr_nonnull(limiter);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 0, &a, 0, &retry),
+                   LIMIT_PASS);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 1, &a, 0, &retry),
+                   LIMIT_PASS);
+  // Host is full
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 2, &a, 0, &retry),
+                   LIMIT_QUEUED);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 3, &b, 0, &retry),
+                   LIMIT_PASS);
+  // /24 is full, other /24 is not
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 4, &b, 0, &retry),
+                   LIMIT_QUEUED);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 5, &c, 0, &retry),
+                   LIMIT_PASS);
+
+  // Freed slots go to the waiters in order
+  probe_limiter_release(limiter, &a, false, 0, record, &woken);
+  ck_assert_uint_eq(woken.count, 2);
+  ck_assert_uint_eq(woken.ids[0], 2);
+  ck_assert_uint_eq(woken.ids[1], 4);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 4, &b, 0, &retry),
+                   LIMIT_PASS);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 2, &a, 0, &retry),
+                   LIMIT_QUEUED);
+
+  probe_limiter_reset(limiter);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 2, &a, 0, &retry),
+                   LIMIT_PASS);
+
+  probe_limiter_destroy(limiter);
+  ck_assert_ptr_null(probe_limiter_create(8, &(probe_engine_conf_t){ 0 }));
+}
+END_TEST
+
+START_TEST(limit_rate_test)
+{
+  probe_engine_conf_t conf = { .rate = 1000, .burst = 3 };
+  probe_limiter_t* limiter = probe_limiter_create(8, &conf);
+  struct sockaddr_storage a = ipv4(0x0a000001);
+  uint64_t now = 1000000000, retry = 0;
+
+  for (uint32_t i = 0; i < 3; ++i) {
+    ck_assert_int_eq(probe_limiter_acquire(limiter, i, &a, now, &retry),
+                     LIMIT_PASS);
+  }
+
+  // A token per millisecond after the burst
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 3, &a, now, &retry),
+                   LIMIT_PACED);
+  ck_assert_uint_eq(retry, now + 1000000);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 3, &a, retry, &retry),
+                   LIMIT_PASS);
+  ck_assert_int_eq(
+    probe_limiter_acquire(limiter, 4, &a, now + 1500000, &retry),
+    LIMIT_PACED);
+  ck_assert_int_eq(
+    probe_limiter_acquire(limiter, 4, &a, now + 10000000, &retry),
+    LIMIT_PASS);
+
+  probe_limiter_destroy(limiter);
+}
+END_TEST
+
+START_TEST(limit_adaptive_test)
+{
+  probe_engine_conf_t conf = { .per_host = 8, .adaptive = true };
+  probe_limiter_t* limiter = probe_limiter_create(16, &conf);
+  struct sockaddr_storage a = ipv4(0x0a000001);
+  woken_t woken = { 0 };
+  uint64_t retry;
+  uint32_t id = 0;
+
+  for (; id < 8; ++id) {
+    probe_limiter_acquire(limiter, id, &a, 0, &retry);
+  }
+
+  // Two failures leave 6 in flight with the cap of 2
+  probe_limiter_release(limiter, &a, true, 0, record, &woken);
+  probe_limiter_release(limiter, &a, true, 0, record, &woken);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, id++, &a, 0, &retry),
+                   LIMIT_QUEUED);
+
+  // Successes grow the cap back by one each
+  for (size_t i = 0; i < 5; ++i) {
+    probe_limiter_release(limiter, &a, false, 0, record, &woken);
+  }
+
+  ck_assert_uint_eq(woken.count, 1);
+  ck_assert_uint_eq(woken.ids[0], 8);
+
+  probe_limiter_destroy(limiter);
+}
+END_TEST
+
+START_TEST(limit_recovery_test)
+{
+  probe_engine_conf_t conf = { .per_host = 4, .adaptive = true };
+  probe_limiter_t* limiter = probe_limiter_create(8, &conf);
+  struct sockaddr_storage a = ipv4(0x0a000001), other;
+  woken_t woken = { 0 };
+  uint64_t now = NS_IN_S, retry;
+
+  // Fails & goes idle
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 0, &a, now, &retry),
+                   LIMIT_PASS);
+  probe_limiter_release(limiter, &a, true, now, record, &woken);
+
+  // Probed again with the halved cap
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 0, &a, now, &retry),
+                   LIMIT_PASS);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 1, &a, now, &retry),
+                   LIMIT_PASS);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 2, &a, now, &retry),
+                   LIMIT_QUEUED);
+  probe_limiter_release(limiter, &a, true, now, record, &woken);
+  probe_limiter_release(limiter, &a, true, now, record, &woken);
+  ck_assert_uint_eq(woken.count, 1);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 2, &a, now, &retry),
+                   LIMIT_PASS);
+  probe_limiter_release(limiter, &a, true, now, record, &woken);
+
+  // Cap of 1 grows back by one a second while idle
+  now += 2 * NS_IN_S;
+
+  for (uint32_t id = 0; id < 3; ++id) {
+    ck_assert_int_eq(probe_limiter_acquire(limiter, id, &a, now, &retry),
+                     LIMIT_PASS);
+  }
+
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 3, &a, now, &retry),
+                   LIMIT_QUEUED);
+
+  // Failing hosts are forgotten oldest first instead of filling the table
+  for (uint32_t i = 0; i < 1000; ++i) {
+    other = ipv4(0x0b000000 + i);
+    ck_assert_int_eq(probe_limiter_acquire(limiter, 4, &other, now, &retry),
+                     LIMIT_PASS);
+    probe_limiter_release(limiter, &other, true, now, record, &woken);
+  }
+
+  // The last one still has its halved cap
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 4, &other, now, &retry),
+                   LIMIT_PASS);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 5, &other, now, &retry),
+                   LIMIT_PASS);
+  ck_assert_int_eq(probe_limiter_acquire(limiter, 6, &other, now, &retry),
+                   LIMIT_QUEUED);
+
+  probe_limiter_destroy(limiter);
+}
+END_TEST
+
+START_TEST(limit_wake_test)
+{
+  probe_engine_conf_t conf = { .per_host = 8, .adaptive = true };
+  probe_limiter_t* limiter = probe_limiter_create(16, &conf);
+  struct sockaddr_storage a = ipv4(0x0a000001);
+  woken_t woken = { 0 };
+  uint64_t now = NS_IN_S, retry;
+  uint32_t id = 0;
+
+  for (; id < 8; ++id) {
+    probe_limiter_acquire(limiter, id, &a, now, &retry);
+  }
+
+  // Three failures narrow the cap to 1 with 5 in flight, 5 more wait
+  for (size_t i = 0; i < 3; ++i) {
+    probe_limiter_release(limiter, &a, true, now, record, &woken);
+  }
+
+  for (; id < 13; ++id) {
+    ck_assert_int_eq(probe_limiter_acquire(limiter, id, &a, now, &retry),
+                     LIMIT_QUEUED);
+  }
+
+  // Recovered to the full cap, a single release lets in all it can
+  probe_limiter_release(limiter, &a, false, now + 10 * NS_IN_S, record, &woken);
+  ck_assert_uint_eq(woken.count, 4);
+
+  for (size_t i = 0; i < woken.count; ++i) {
+    ck_assert_uint_eq(woken.ids[i], 8 + i);
+  }
+
+  probe_limiter_destroy(limiter);
+}
+END_TEST
+
+START_TEST(limit_churn_test)
+{
+  probe_engine_conf_t conf = { .per_host = 1, .per_subnet = 1 };
+  probe_limiter_t* limiter = probe_limiter_create(64, &conf);
+  struct sockaddr_storage addrs[64];
+  woken_t woken = { 0 };
+  uint64_t retry;
+
+  // Entries come & go without leaking or losing each other
+  for (uint32_t round = 0; round < 100; ++round) {
+    for (uint32_t i = 0; i < 64; ++i) {
+      addrs[i] = ipv4((round * 64 + i) << 8);
+      ck_assert_int_eq(
+        probe_limiter_acquire(limiter, i, &addrs[i], 0, &retry), LIMIT_PASS);
+    }
+
+    for (uint32_t i = 0; i < 64; ++i) {
+      probe_limiter_release(
+        limiter, &addrs[(i * 7) % 64], false, 0, record, &woken);
+    }
+  }
+
+  ck_assert_uint_eq(woken.count, 0);
+
+  probe_limiter_destroy(limiter);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe limiter test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, limit_caps_test);
+  tcase_add_test(t, limit_rate_test);
+  tcase_add_test(t, limit_adaptive_test);
+  tcase_add_test(t, limit_recovery_test);
+  tcase_add_test(t, limit_wake_test);
+  tcase_add_test(t, limit_churn_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
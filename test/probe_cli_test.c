@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #define PROBE_PATH "../app/probe_cli "
 
@@ -23,6 +24,8 @@ START_TEST(probe_cli_args)
   ck_assert_int_ne(
     system(PROBE_PATH "--timeout=1 --retry=1 --service=pmwebapi localhost"), 0);
   ck_assert_int_ne(system(PROBE_PATH "-t 1 -r 1 -s pmwebapi localhost"), 0);
+  ck_assert_int_ne(system(PROBE_PATH "-T -t 1 -r 2 -p 1 127.0.0.1"), 0);
+  ck_assert_int_ne(system(PROBE_PATH "--timings -t 0 -r 1 -p 1 localhost"), 0);
 }
 
 START_TEST(probe_cli_by_ip_port_test)
@@ -80,6 +83,200 @@ START_TEST(probe_cli_config_test)
 }
 END_TEST
 
+START_TEST(probe_cli_quorum_test)
+{
+  char cmd[256];
+  in_port_t up, down;
+  int sock = listen_loopback(&up);
+
+  close(listen_loopback(&down));
+
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "127.0.0.1:%u localhost:%u", up, up);
+  ck_assert_int_eq(system(cmd), 0);
+  // Single targets with ports
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "127.0.0.1:%u", up);
+  ck_assert_int_eq(system(cmd), 0);
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "[::1]:%u", down);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "-r 1 127.0.0.1:%u localhost:%u",
+           up,
+           down);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "-q any 127.0.0.1:%u localhost:%u",
+           down,
+           up);
+  ck_assert_int_eq(system(cmd), 0);
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "--require=2/3 -p %u 127.0.0.1 localhost 127.0.0.1:%u",
+           up,
+           down);
+  ck_assert_int_eq(system(cmd), 0);
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "-q 3/2 127.0.0.1:%u localhost:%u",
+           up,
+           up);
+  ck_assert_int_ne(system(cmd), 0);
+
+  close(sock);
+}
+END_TEST
+
+START_TEST(probe_cli_timings_test)
+{
+  char cmd[256];
+  in_port_t up;
+  int sock = listen_loopback(&up);
+
+  // Phase breakdown of a single target with its own port
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "--timings 127.0.0.1:%u | grep -q '^\tconnect: '",
+           up);
+  ck_assert_int_eq(system(cmd), 0);
+
+  // And of every dependency of a quorum
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "-T 127.0.0.1:%u localhost:%u | grep -c '^Timings:' | "
+                      "grep -qx 2",
+           up,
+           up);
+  ck_assert_int_eq(system(cmd), 0);
+
+  close(sock);
+}
+END_TEST
+
+START_TEST(probe_cli_cache_test)
+{
+  char cmd[256];
+  in_port_t port;
+  int sock = listen_loopback(&port);
+
+  unlink("./probe_cli_cache.bin");
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "--cache=./probe_cli_cache.bin -p %u localhost",
+           port);
+  ck_assert_int_eq(system(cmd), 0);
+  ck_assert_int_eq(system(cmd), 0);
+  ck_assert_int_eq(access("./probe_cli_cache.bin", R_OK), 0);
+
+  unlink("./probe_cli_cache.bin");
+  close(sock);
+}
+END_TEST
+
+START_TEST(probe_cli_sweep_test)
+{
+  char cmd[256];
+  in_port_t up, down;
+  int sock = listen_loopback(&up);
+
+  close(listen_loopback(&down));
+
+  // Only 127.0.0.1 of the subnet is listening
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "-r 1 127.0.0.0/30:%u,%u 2>/dev/null",
+           up,
+           down);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "-r 1 -q any 127.0.0.0/30:%u,%u 2>/dev/null",
+           up,
+           down);
+  ck_assert_int_eq(system(cmd), 0);
+  snprintf(
+    cmd, sizeof(cmd), PROBE_PATH "-r 1 -q any -p %u 127.0.0.0/31", up);
+  ck_assert_int_eq(system(cmd), 0);
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "127.0.0.0/31:%u,0", up);
+  ck_assert_int_ne(system(cmd), 0);
+
+  // Ranges are swept once, repeating modes are refused before the sweep
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "-q any --wait=1000 127.0.0.0/31:%u -- false",
+           up);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(
+    cmd, sizeof(cmd), PROBE_PATH "-q any --interval=100 127.0.0.0/31:%u", up);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "-q any 127.0.0.0/31:%u -- true", up);
+  ck_assert_int_ne(system(cmd), 0);
+
+  close(sock);
+}
+END_TEST
+
+START_TEST(probe_cli_file_test)
+{
+  char cmd[256], path[] = "/tmp/probe_cli_file_XXXXXX";
+  in_port_t up;
+  int sock = listen_loopback(&up);
+  int fd = mkstemp(path);
+  FILE* file = fdopen(fd, "w");
+
+  ck_assert_ptr_nonnull(file);
+  fprintf(file, "# Dependencies\n127.0.0.1:%u\n\nlocalhost:%u\n", up, up);
+  fclose(file);
+
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "--file=%s", path);
+  ck_assert_int_eq(system(cmd), 0);
+
+  // A file is swept once & printed a line per target
+  snprintf(
+    cmd, sizeof(cmd), PROBE_PATH "--file=%s --wait=1000 -- false", path);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "--file=%s --interval=100", path);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "--file=%s -- true", path);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(cmd, sizeof(cmd), PROBE_PATH "--file=%s --timings", path);
+  ck_assert_int_ne(system(cmd), 0);
+
+  unlink(path);
+  close(sock);
+}
+END_TEST
+
+START_TEST(probe_cli_wait_test)
+{
+  char cmd[256];
+  in_port_t up, down;
+  int sock = listen_loopback(&up);
+
+  close(listen_loopback(&down));
+
+  // Every verdict is printed, the command runs once all are available
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "--wait=2000 127.0.0.1:%u -- true",
+           up);
+  ck_assert_int_eq(system(cmd), 0);
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "--wait=2000 127.0.0.1:%u -- false",
+           up);
+  ck_assert_int_ne(system(cmd), 0);
+  snprintf(cmd,
+           sizeof(cmd),
+           PROBE_PATH "--wait=100 127.0.0.1:%u 127.0.0.1:%u 2>/dev/null",
+           up,
+           down);
+  ck_assert_int_ne(system(cmd), 0);
+
+  close(sock);
+}
+END_TEST
+
 int
 main()
 {
@@ -97,6 +294,12 @@ main()
   tcase_add_test(t, probe_cli_by_host_port_test);
   tcase_add_test(t, probe_cli_by_host_service_test);
   tcase_add_test(t, probe_cli_config_test);
+  tcase_add_test(t, probe_cli_quorum_test);
+  tcase_add_test(t, probe_cli_timings_test);
+  tcase_add_test(t, probe_cli_cache_test);
+  tcase_add_test(t, probe_cli_sweep_test);
+  tcase_add_test(t, probe_cli_file_test);
+  tcase_add_test(t, probe_cli_wait_test);
   tcase_set_timeout(t, TEST_CASE_TIMEOUT);
   suite_add_tcase(s, t);
 
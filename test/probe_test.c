@@ -7,6 +7,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+static size_t trace_events[PHASE_COUNT];
+
+static void
+count_trace_event(const probe_trace_event_t* event, void* data)
+{
+  ck_assert_ptr_eq(data, trace_events);
+  trace_events[event->phase]++;
+}
 
 START_TEST(probe_version_test)
 {
@@ -79,6 +89,107 @@ START_TEST(timeout_retry_adjust_test)
 }
 END_TEST
 
+START_TEST(timings_test)
+{
+  probe_result_t result;
+  in_port_t port;
+  int sock = listen_loopback(&port);
+
+  probe_trace(count_trace_event, trace_events);
+
+  ck_assert_int_eq(ipv4_port_probe_r("127.0.0.1", port, NULL, &result),
+                   AVAILABLE);
+  ck_assert_int_eq(result.state, AVAILABLE);
+  ck_assert_uint_eq(result.timings.attempts, 1);
+  ck_assert_uint_eq(result.timings.phase_ns[PHASE_BACKOFF], 0);
+  ck_assert_uint_ge(result.timings.total_ns,
+                    result.timings.phase_ns[PHASE_CONNECT]);
+  ck_assert_uint_eq(trace_events[PHASE_CONNECT], 1);
+  ck_assert_uint_eq(trace_events[PHASE_CLOSE], 1);
+
+  close(sock);
+  probe_config(3, 1);
+  memset(trace_events, 0, sizeof(trace_events));
+
+  ck_assert_int_eq(ipv4_port_probe_r("127.0.0.1", port, NULL, &result),
+                   UNAVAILABLE);
+  ck_assert_uint_eq(result.timings.attempts, 3);
+  ck_assert_uint_ge(result.timings.phase_ns[PHASE_BACKOFF], 2000000000ull);
+  ck_assert_uint_eq(trace_events[PHASE_CONNECT], 3);
+  ck_assert_uint_eq(trace_events[PHASE_BACKOFF], 2);
+
+  probe_trace(NULL, NULL);
+  memset(trace_events, 0, sizeof(trace_events));
+
+  ck_assert_int_eq(ipv4_port_probe_r("127.0.0.1", port, NULL, NULL),
+                   UNAVAILABLE);
+  ck_assert_uint_eq(trace_events[PHASE_CONNECT], 0);
+}
+END_TEST
+
+START_TEST(tcp_info_test)
+{
+  probe_result_t result;
+  in_port_t port;
+  int sock = listen_loopback(&port);
+
+  ck_assert_int_eq(ipv4_port_probe_r("127.0.0.1", port, NULL, &result),
+                   AVAILABLE);
+  ck_assert(!result.tcp_info.valid);
+
+  probe_config_tcp_info(true);
+
+  ck_assert_int_eq(ipv4_port_probe_r("127.0.0.1", port, NULL, &result),
+                   AVAILABLE);
+  ck_assert(result.tcp_info.valid);
+  ck_assert_uint_gt(result.tcp_info.snd_mss, 0);
+  ck_assert_uint_gt(result.tcp_info.pmtu, 0);
+  ck_assert_uint_gt(result.tcp_info.snd_cwnd, 0);
+  ck_assert_uint_eq(result.tcp_info.retransmits, 0);
+
+  close(sock);
+}
+END_TEST
+
+START_TEST(unix_probe_test)
+{
+  probe_result_t result;
+  char path[64], long_path[128];
+  int stream, seqpacket;
+
+  snprintf(path, sizeof(path), "/tmp/probe_test_%d.sock", getpid());
+  stream = listen_unix(path, SOCK_STREAM);
+  seqpacket = listen_unix("@probe_test_seqpacket", SOCK_SEQPACKET);
+  probe_config(1, 1);
+
+  ck_assert_int_eq(unix_probe_r(path, SOCK_STREAM, &result), AVAILABLE);
+  ck_assert_uint_eq(result.timings.attempts, 1);
+  ck_assert_uint_eq(result.timings.phase_ns[PHASE_HOST_RESOLUTION], 0);
+  ck_assert_int_eq(unix_probe("@probe_test_seqpacket", SOCK_SEQPACKET),
+                   AVAILABLE);
+
+  // Socket type has to match the listener
+  ck_assert_int_eq(unix_probe(path, SOCK_SEQPACKET), UNAVAILABLE);
+  ck_assert_int_eq(unix_probe("@probe_test_seqpacket", SOCK_STREAM),
+                   UNAVAILABLE);
+  ck_assert_int_eq(unix_probe("@probe_test_missing", SOCK_STREAM),
+                   UNAVAILABLE);
+  ck_assert_int_eq(unix_probe(path, SOCK_DGRAM), UNKNOWN_PROTOCOL);
+
+  memset(long_path, 'a', sizeof(long_path) - 1);
+  long_path[sizeof(long_path) - 1] = '\0';
+  ck_assert_int_eq(unix_probe(long_path, SOCK_STREAM), INVALID_PATH);
+  ck_assert_int_eq(unix_probe("", SOCK_STREAM), INVALID_PATH);
+  ck_assert_int_eq(unix_probe("@", SOCK_STREAM), INVALID_PATH);
+
+  close(stream);
+  close(seqpacket);
+  unlink(path);
+
+  ck_assert_int_eq(unix_probe(path, SOCK_STREAM), UNAVAILABLE);
+}
+END_TEST
+
 uint32_t
 main()
 {
@@ -96,6 +207,9 @@ main()
   tcase_add_test(t, host_port_probe_test);
   tcase_add_test(t, host_service_probe_test);
   tcase_add_test(t, timeout_retry_adjust_test);
+  tcase_add_test(t, timings_test);
+  tcase_add_test(t, tcp_info_test);
+  tcase_add_test(t, unix_probe_test);
   tcase_set_timeout(t, TEST_CASE_TIMEOUT);
   suite_add_tcase(s, t);
 
@@ -0,0 +1,206 @@
+#include "range.h"
+#include "test.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+START_TEST(range_parse_test)
+{
+  probe_range_t range;
+  struct sockaddr_in* sin = (struct sockaddr_in*)&range.base;
+
+  ck_assert(probe_range_parse(&range, "10.20.30.40/16:80,443,8000-8100", 0, 0));
+  ck_assert_int_eq(sin->sin_family, AF_INET);
+  ck_assert_uint_eq(ntohl(sin->sin_addr.s_addr), 0x0a140000);
+  ck_assert_uint_eq(range.host_bits, 16);
+  ck_assert_uint_eq(range.span_count, 3);
+  ck_assert_uint_eq(range.ports, 103);
+  ck_assert_uint_eq(range.size, 65536 * 103);
+
+  ck_assert(probe_range_parse(&range, "127.0.0.1", 22, 0));
+  ck_assert_uint_eq(range.size, 1);
+  ck_assert_uint_eq(range.spans[0].first, 22);
+
+  ck_assert(probe_range_parse(&range, "[2001:db8::1]/120:443", 0, 0));
+  ck_assert_int_eq(range.base.ss_family, AF_INET6);
+  ck_assert_uint_eq(range.size, 256);
+  ck_assert(probe_range_parse(&range, "[2001:db8::/112]:80-81", 0, 0));
+  ck_assert_uint_eq(range.size, 65536 * 2);
+  ck_assert(probe_range_parse(&range, "[::1]", 80, 0));
+  ck_assert_uint_eq(range.size, 1);
+
+  // No ports, bad ports, bad prefixes & too big ranges
+  ck_assert(!probe_range_parse(&range, "10.0.0.0/8", 0, 0));
+  ck_assert(!probe_range_parse(&range, "10.0.0.0/8:0", 0, 0));
+  ck_assert(!probe_range_parse(&range, "10.0.0.0/8:90-80", 0, 0));
+  ck_assert(!probe_range_parse(&range, "10.0.0.0/8:65536", 0, 0));
+  ck_assert(!probe_range_parse(&range, "10.0.0.0/8:80,", 0, 0));
+  ck_assert(!probe_range_parse(&range, "10.0.0.0/33:80", 0, 0));
+  ck_assert(!probe_range_parse(&range, "10.0.0.0/:80", 0, 0));
+  ck_assert(!probe_range_parse(&range, "example.com/24:80", 0, 0));
+  ck_assert(!probe_range_parse(&range, "[2001:db8::]/32:80", 0, 0));
+  ck_assert(!probe_range_parse(&range, "[2001:db8::]/64:1-65535", 0, 0));
+  ck_assert(!probe_range_parse(&range, "[2001:db8::/64:80", 0, 0));
+}
+END_TEST
+
+START_TEST(range_permutation_test)
+{
+  probe_range_t range;
+  probe_range_iter_t iter;
+  probe_target_t target;
+  uint8_t seen[256 * 3] = { 0 };
+  size_t in_order = 0, count = 0;
+  uint64_t first;
+
+  ck_assert(probe_range_parse(&range, "192.168.1.0/24:22,80-81", 0, 7));
+  probe_range_iter_init(&iter, &range);
+
+  // Every pair exactly once, but not in order
+  while (probe_range_next(&iter, &target)) {
+    struct sockaddr_in* sin = (struct sockaddr_in*)&target.addr;
+    uint32_t host = ntohl(sin->sin_addr.s_addr) & 0xff;
+    in_port_t port = ntohs(sin->sin_port);
+    size_t pair = host * 3 + (port == 22 ? 0 : port - 79);
+
+    ck_assert_int_eq(target.result.state, CANCELLED);
+    ck_assert_uint_eq(target.addrlen, sizeof(struct sockaddr_in));
+    ck_assert_uint_eq(ntohl(sin->sin_addr.s_addr) >> 8, 0xc0a801);
+    ck_assert(port == 22 || port == 80 || port == 81);
+    ck_assert_uint_eq(seen[pair]++, 0);
+    in_order += pair == count++;
+  }
+
+  ck_assert_uint_eq(count, 256 * 3);
+  ck_assert_uint_lt(in_order, 16);
+
+  // Deterministic for the same seed only
+  probe_range_target(&range, 0, &target);
+  first = ((struct sockaddr_in*)&target.addr)->sin_addr.s_addr;
+  ck_assert(probe_range_parse(&range, "192.168.1.0/24:22,80-81", 0, 7));
+  probe_range_target(&range, 0, &target);
+  ck_assert_uint_eq(((struct sockaddr_in*)&target.addr)->sin_addr.s_addr,
+                    first);
+
+  count = 0;
+
+  for (uint64_t seed = 0; seed < 8; ++seed) {
+    ck_assert(probe_range_parse(&range, "192.168.1.0/24:22,80-81", 0, seed));
+    probe_range_target(&range, 0, &target);
+    count += ((struct sockaddr_in*)&target.addr)->sin_addr.s_addr != first;
+  }
+
+  ck_assert_uint_gt(count, 0);
+}
+END_TEST
+
+START_TEST(range_ipv6_test)
+{
+  probe_range_t range;
+  probe_target_t target;
+  uint8_t seen[16] = { 0 };
+
+  ck_assert(probe_range_parse(&range, "[2001:db8::ff00]/124:443", 0, 0));
+
+  for (uint64_t i = 0; i < range.size; ++i) {
+    struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&target.addr;
+
+    probe_range_target(&range, i, &target);
+    ck_assert_int_eq(sin6->sin6_family, AF_INET6);
+    ck_assert_uint_eq(target.addrlen, sizeof(struct sockaddr_in6));
+    ck_assert_uint_eq(ntohs(sin6->sin6_port), 443);
+    ck_assert_uint_eq(sin6->sin6_addr.s6_addr[0], 0x20);
+    ck_assert_uint_eq(sin6->sin6_addr.s6_addr[14], 0xff);
+    ck_assert_uint_eq(sin6->sin6_addr.s6_addr[15] & 0xf0, 0);
+    ck_assert_uint_eq(seen[sin6->sin6_addr.s6_addr[15]]++, 0);
+  }
+
+  // Huge ranges cost nothing until probed
+  ck_assert(probe_range_parse(&range, "[2001:db8::]/80:1-1024", 0, 0));
+  probe_range_target(&range, range.size - 1, &target);
+  ck_assert_int_eq(target.result.state, CANCELLED);
+}
+END_TEST
+
+START_TEST(range_partition_test)
+{
+  probe_range_t range;
+  probe_target_t target;
+  uint8_t seen[1024 * 2] = { 0 };
+  uint8_t owner[4];
+  uint64_t count = 0;
+
+  memset(owner, 0xff, sizeof(owner));
+  ck_assert(probe_range_parse(&range, "10.0.0.0/22:80,443", 0, 3));
+
+  // Every pair exactly once, hosts of a /24 in the same partition
+  for (uint64_t partition = 0; partition < 3; ++partition) {
+    uint64_t size = probe_range_partition_size(&range, true, 3, partition);
+
+    for (uint64_t i = 0; i < size; ++i) {
+      struct sockaddr_in* sin = (struct sockaddr_in*)&target.addr;
+      uint32_t host;
+
+      probe_range_partition_target(&range, true, 3, partition, i, &target);
+      host = ntohl(sin->sin_addr.s_addr) & 0x3ff;
+      ck_assert_int_eq(target.result.state, CANCELLED);
+      ck_assert_uint_eq(seen[host * 2 + (ntohs(sin->sin_port) == 443)]++, 0);
+
+      if (owner[host >> 8] == 0xff) {
+        owner[host >> 8] = (uint8_t)partition;
+      }
+
+      ck_assert_uint_eq(owner[host >> 8], partition);
+    }
+
+    count += size;
+  }
+
+  ck_assert_uint_eq(count, range.size);
+  // Four subnets, a partition more than the others
+  ck_assert_uint_eq(probe_range_partition_size(&range, true, 3, 0), 1024);
+  ck_assert_uint_eq(probe_range_partition_size(&range, true, 8, 5), 0);
+
+  // By host, more partitions than hosts
+  ck_assert(probe_range_parse(&range, "10.0.0.0/30:80", 0, 3));
+  ck_assert_uint_eq(probe_range_partition_size(&range, false, 8, 3), 1);
+  ck_assert_uint_eq(probe_range_partition_size(&range, false, 8, 4), 0);
+  probe_range_partition_target(&range, false, 8, 3, 0, &target);
+  ck_assert_uint_eq(
+    ntohl(((struct sockaddr_in*)&target.addr)->sin_addr.s_addr), 0x0a000003);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe range test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, range_parse_test);
+  tcase_add_test(t, range_permutation_test);
+  tcase_add_test(t, range_ipv6_test);
+  tcase_add_test(t, range_partition_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
@@ -0,0 +1,179 @@
+#include "scheduler.h"
+#include "test.h"
+#include <check.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TARGETS 8
+
+typedef struct checks
+{
+  size_t count[TARGETS];
+  size_t available;
+  int sock;
+  probe_scheduler_t* scheduler;
+} checks_t;
+
+static uint64_t
+now_ms()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void
+count_check(probe_target_t* target, void* data)
+{
+  checks_t* checks = data;
+
+  checks->count[(size_t)target->data]++;
+  int conn;
+
+  // Ids are those of the expanded targets
+  if (checks->scheduler != NULL) {
+    ck_assert_uint_eq(probe_scheduler_id(checks->scheduler, target),
+                      (size_t)target->data);
+  }
+
+  // Keeps the listen backlog from filling up
+  while ((conn = accept(checks->sock, NULL, NULL)) != -1) {
+    close(conn);
+  }
+
+  checks->available += target->result.state == AVAILABLE;
+}
+
+START_TEST(scheduler_test)
+{
+  probe_engine_conf_t conf = { .retry_count = 1,
+                               .connect_timeout_ms = 100,
+                               .backoff_ms = 0 };
+  // Fewer probes at once than targets, the rest has to be queued
+  probe_scheduler_t* scheduler = probe_scheduler_create(TARGETS, 2, &conf);
+  probe_target_t target;
+  checks_t checks = { 0 };
+  in_port_t port;
+  int sock = listen_loopback(&port);
+  char port_str[8];
+  uint64_t start;
+  size_t total = 0;
+
+  ck_assert_ptr_nonnull(scheduler);
+  fcntl(sock, F_SETFL, O_NONBLOCK);
+  checks.sock = sock;
+  checks.scheduler = scheduler;
+  ck_assert_uint_eq(probe_scheduler_run(scheduler, 0, NULL, NULL), 0);
+
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  probe_target_init(&target, "127.0.0.1", port_str, NULL);
+
+  for (size_t i = 0; i < TARGETS; ++i) {
+    target.data = (void*)i;
+    ck_assert(probe_scheduler_add(scheduler, &target, 100, 10));
+  }
+
+  ck_assert(!probe_scheduler_add(scheduler, &target, 100, 10));
+  ck_assert_uint_eq(probe_scheduler_count(scheduler), TARGETS);
+  probe_scheduler_target(scheduler, 3, &target);
+  ck_assert_ptr_eq(target.data, (void*)3);
+  ck_assert_int_eq(target.result.state, CANCELLED);
+
+  start = now_ms();
+
+  while (now_ms() - start < 550) {
+    probe_scheduler_run(scheduler, 50, count_check, &checks);
+  }
+
+  // Every target is probed once per interval: first one within the
+  // interval and then every 100-110 ms
+  for (size_t i = 0; i < TARGETS; ++i) {
+    ck_assert_uint_ge(checks.count[i], 4);
+    ck_assert_uint_le(checks.count[i], 6);
+    total += checks.count[i];
+  }
+
+  ck_assert_uint_eq(checks.available, total);
+  // Last verdicts are packed back
+  probe_scheduler_target(scheduler, 3, &target);
+  ck_assert_int_eq(target.result.state, AVAILABLE);
+  ck_assert_uint_eq(ntohs(((struct sockaddr_in*)&target.addr)->sin_port),
+                    port);
+
+  probe_scheduler_destroy(scheduler);
+  close(sock);
+}
+END_TEST
+
+START_TEST(scheduler_spread_test)
+{
+  probe_engine_conf_t conf = { .retry_count = 1,
+                               .connect_timeout_ms = 100,
+                               .backoff_ms = 0 };
+  probe_scheduler_t* scheduler =
+    probe_scheduler_create(TARGETS, TARGETS, &conf);
+  probe_target_t target;
+  checks_t checks = { 0 };
+  in_port_t port;
+  int sock = listen_loopback(&port);
+  char port_str[8];
+  uint64_t start;
+
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  probe_target_init(&target, "127.0.0.1", port_str, NULL);
+
+  for (size_t i = 0; i < TARGETS; ++i) {
+    target.data = (void*)i;
+    probe_scheduler_add(scheduler, &target, 1000, 0);
+  }
+
+  // First checks are spread over the interval instead of bursting at once
+  start = now_ms();
+
+  while (now_ms() - start < 200) {
+    probe_scheduler_run(scheduler, 50, count_check, &checks);
+  }
+
+  ck_assert_uint_lt(checks.available, TARGETS);
+
+  probe_scheduler_destroy(scheduler);
+  close(sock);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe scheduler test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, scheduler_test);
+  tcase_add_test(t, scheduler_spread_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
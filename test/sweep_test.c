@@ -0,0 +1,240 @@
+#include "sweep.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define TARGETS 2000
+// Stays below the listen backlog, nobody accepts
+#define UP_EVERY 200
+#define SUBNETS 8
+
+typedef struct verdicts
+{
+  size_t available;
+  size_t unavailable;
+  uint8_t seen[TARGETS];
+} verdicts_t;
+
+static void
+count_verdict(probe_target_t* target, void* data)
+{
+  verdicts_t* verdicts = data;
+
+  size_t i = (size_t)target->data;
+
+  __atomic_add_fetch(&verdicts->seen[i], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(target->result.state == AVAILABLE
+                       ? &verdicts->available
+                       : &verdicts->unavailable,
+                     1,
+                     __ATOMIC_RELAXED);
+}
+
+static void
+count_available(probe_target_t* target, void* data)
+{
+  struct sockaddr_in* sin = (struct sockaddr_in*)&target->addr;
+
+  if (target->result.state == AVAILABLE) {
+    ck_assert_uint_eq(ntohl(sin->sin_addr.s_addr), INADDR_LOOPBACK);
+    __atomic_add_fetch((size_t*)data, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Worker of every subnet, the first verdict claims it
+static void
+check_worker(probe_target_t* target, void* data)
+{
+  pthread_t* workers = data;
+  struct sockaddr_in* sin = (struct sockaddr_in*)&target->addr;
+  size_t subnet = ntohl(sin->sin_addr.s_addr) >> 8 & 0xff;
+  pthread_t self = pthread_self(), none = 0;
+
+  if (!__atomic_compare_exchange_n(&workers[subnet],
+                                   &none,
+                                   self,
+                                   false,
+                                   __ATOMIC_RELAXED,
+                                   __ATOMIC_RELAXED)) {
+    ck_assert(pthread_equal(none, self));
+  }
+}
+
+START_TEST(sweep_test)
+{
+  probe_target_t* targets = calloc(TARGETS + 1, sizeof(probe_target_t));
+  verdicts_t verdicts = { 0 };
+  probe_sweep_conf_t conf;
+  in_port_t port;
+  int sock = listen_loopback(&port);
+  char up[8], down[8];
+
+  snprintf(up, sizeof(up), "%u", port);
+  close(listen_loopback(&port));
+  snprintf(down, sizeof(down), "%u", port);
+
+  for (size_t i = 0; i < TARGETS; ++i) {
+    probe_target_init(
+      &targets[i], "127.0.0.1", i % UP_EVERY == 0 ? up : down, NULL);
+    targets[i].data = (void*)i;
+  }
+
+  // Not probed at all
+  probe_target_init(&targets[TARGETS], "4321example1234.", up, NULL);
+
+  probe_sweep_conf_init(&conf);
+  conf.engine.retry_count = 1;
+  conf.workers = 4;
+  conf.max_active = 32;
+  conf.batch = 16;
+
+  ck_assert_uint_eq(
+    probe_sweep(targets, TARGETS + 1, &conf, count_verdict, &verdicts),
+    TARGETS);
+  ck_assert_uint_eq(verdicts.available, TARGETS / UP_EVERY);
+  ck_assert_uint_eq(verdicts.unavailable, TARGETS - TARGETS / UP_EVERY);
+  ck_assert_int_eq(targets[TARGETS].result.state, UNKNOWN_HOST);
+
+  for (size_t i = 0; i < TARGETS; ++i) {
+    ck_assert_uint_eq(verdicts.seen[i], 1);
+    ck_assert_int_eq(targets[i].result.state,
+                     i % UP_EVERY == 0 ? AVAILABLE : UNAVAILABLE);
+  }
+
+  // More workers than batches & a single worker
+  conf.workers = 64;
+  ck_assert_uint_eq(probe_sweep(targets, 40, &conf, NULL, NULL), 40);
+  conf.workers = 1;
+  ck_assert_uint_eq(probe_sweep(targets, 40, &conf, NULL, NULL), 40);
+  ck_assert_uint_eq(probe_sweep(targets, 0, &conf, NULL, NULL), 0);
+
+  free(targets);
+  close(sock);
+}
+END_TEST
+
+START_TEST(sweep_range_test)
+{
+  probe_sweep_conf_t conf;
+  probe_range_t range;
+  in_port_t up, down;
+  int sock = listen_loopback(&up);
+  char spec[64];
+  size_t available = 0;
+
+  close(listen_loopback(&down));
+  // Only 127.0.0.1 is listening
+  snprintf(spec, sizeof(spec), "127.0.0.0/29:%u,%u", up, down);
+  ck_assert(probe_range_parse(&range, spec, 0, 1));
+
+  probe_sweep_conf_init(&conf);
+  conf.engine.retry_count = 1;
+  conf.workers = 3;
+  conf.max_active = 2;
+  conf.batch = 3;
+
+  ck_assert_uint_eq(
+    probe_sweep_range(&range, &conf, count_available, &available), 16);
+  ck_assert_uint_eq(available, 1);
+
+  close(sock);
+}
+END_TEST
+
+START_TEST(sweep_caps_test)
+{
+  probe_target_t* targets = calloc(TARGETS, sizeof(probe_target_t));
+  pthread_t workers[SUBNETS] = { 0 };
+  probe_sweep_conf_t conf;
+  in_port_t port;
+  char host[32], down[8];
+
+  close(listen_loopback(&port));
+  snprintf(down, sizeof(down), "%u", port);
+
+  // Loopback /24s, neighbours of a subnet are spread over all batches
+  for (size_t i = 0; i < TARGETS; ++i) {
+    snprintf(host, sizeof(host), "127.0.%zu.%zu", i % SUBNETS, i / SUBNETS);
+    probe_target_init(&targets[i], host, down, NULL);
+  }
+
+  probe_sweep_conf_init(&conf);
+  conf.engine.retry_count = 1;
+  conf.engine.per_subnet = 2;
+  conf.workers = 4;
+  conf.max_active = 16;
+  conf.batch = 4;
+
+  // A subnet never has the caps of several workers
+  ck_assert_uint_eq(
+    probe_sweep(targets, TARGETS, &conf, check_worker, workers), TARGETS);
+
+  for (size_t i = 0; i < TARGETS; ++i) {
+    ck_assert_int_eq(targets[i].result.state, UNAVAILABLE);
+  }
+
+  free(targets);
+}
+END_TEST
+
+START_TEST(sweep_range_caps_test)
+{
+  pthread_t workers[SUBNETS] = { 0 };
+  probe_sweep_conf_t conf;
+  probe_range_t range;
+  in_port_t port;
+  char spec[64];
+
+  close(listen_loopback(&port));
+  snprintf(spec, sizeof(spec), "127.0.0.0/21:%u", port);
+  ck_assert(probe_range_parse(&range, spec, 0, 1));
+
+  probe_sweep_conf_init(&conf);
+  conf.engine.retry_count = 1;
+  conf.engine.per_subnet = 2;
+  conf.workers = 4;
+  conf.max_active = 16;
+  conf.batch = 4;
+
+  // Partitions are stolen whole, a subnet still has a single worker
+  ck_assert_uint_eq(
+    probe_sweep_range(&range, &conf, check_worker, workers), SUBNETS * 256);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe sweep test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, sweep_test);
+  tcase_add_test(t, sweep_range_test);
+  tcase_add_test(t, sweep_caps_test);
+  tcase_add_test(t, sweep_range_caps_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
@@ -0,0 +1,245 @@
+#include "sweep.h"
+#include "table.h"
+#include "test.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define ROWS 100000
+#define NAMES 1000
+#define SWEEP_ROWS 1000
+// Stays below the listen backlog, nobody accepts
+#define UP_EVERY 100
+
+START_TEST(table_pack_test)
+{
+  probe_table_t* table = probe_table_create(0);
+  probe_target_t target;
+  probe_result_t result = { .state = UNAVAILABLE };
+  char name[64];
+
+  ck_assert_ptr_nonnull(table);
+
+  probe_target_init(&target, "127.0.0.1", "8080", NULL);
+  target.server_name = "db.internal";
+  ck_assert(probe_table_add(table, &target));
+  probe_target_init(&target, "::1", "443", NULL);
+  ck_assert(probe_table_add(table, &target));
+  probe_target_init_unix(&target, "@table_test", SOCK_SEQPACKET);
+  ck_assert(probe_table_add(table, &target));
+  probe_target_init(&target, "127.0.0.1", "0", NULL);
+  ck_assert(probe_table_add(table, &target));
+  ck_assert_uint_eq(probe_table_count(table), 4);
+
+  probe_table_target(table, 0, &target);
+  ck_assert_int_eq(target.addr.ss_family, AF_INET);
+  ck_assert_uint_eq(ntohs(((struct sockaddr_in*)&target.addr)->sin_port),
+                    8080);
+  ck_assert_str_eq(target.server_name, "db.internal");
+  ck_assert_int_eq(target.result.state, CANCELLED);
+  ck_assert(probe_table_format(table, 0, name, sizeof(name)));
+  ck_assert_str_eq(name, "db.internal:8080");
+
+  probe_table_target(table, 1, &target);
+  ck_assert_int_eq(target.addrlen, sizeof(struct sockaddr_in6));
+  ck_assert_ptr_null(target.server_name);
+  ck_assert_ptr_null(probe_table_name(table, 1));
+  ck_assert(probe_table_format(table, 1, name, sizeof(name)));
+  ck_assert_str_eq(name, "[::1]:443");
+
+  probe_table_target(table, 2, &target);
+  ck_assert_int_eq(target.addr.ss_family, AF_UNIX);
+  ck_assert_int_eq(target.type, SOCK_SEQPACKET);
+  ck_assert_ptr_null(target.server_name);
+  ck_assert(probe_table_format(table, 2, name, sizeof(name)));
+  ck_assert_str_eq(name, "unix:@table_test");
+
+  // Failed on init, nothing to probe
+  probe_table_target(table, 3, &target);
+  ck_assert_uint_eq(target.addrlen, 0);
+  ck_assert_int_eq(probe_table_state(table, 3), UNKNOWN_SERVICE);
+  ck_assert(!probe_table_format(table, 3, name, sizeof(name)));
+
+  result.timings.total_ns = 1234567;
+  result.timings.attempts = 3;
+  probe_table_store(table, 0, &result);
+  ck_assert_int_eq(probe_table_state(table, 0), UNAVAILABLE);
+  ck_assert_uint_eq(probe_table_latency_us(table, 0), 1234);
+  ck_assert_uint_eq(probe_table_attempts(table, 0), 3);
+
+  // Packed fields saturate instead of wrapping
+  result.state = AVAILABLE;
+  result.timings.total_ns = 60 * 1000000000ull;
+  result.timings.attempts = 100;
+  probe_table_store(table, 0, &result);
+  ck_assert_int_eq(probe_table_state(table, 0), AVAILABLE);
+  ck_assert_uint_eq(probe_table_latency_us(table, 0), TABLE_LATENCY_MAX_US);
+  ck_assert_uint_eq(probe_table_attempts(table, 0), TABLE_ATTEMPTS_MAX);
+
+  probe_table_destroy(table);
+}
+END_TEST
+
+START_TEST(table_memory_test)
+{
+  probe_table_t* table = probe_table_create(ROWS);
+  probe_target_t target;
+  char name[32];
+
+  probe_target_init(&target, "10.0.0.1", "80", NULL);
+
+  for (size_t i = 0; i < ROWS; ++i) {
+    ((struct sockaddr_in*)&target.addr)->sin_addr.s_addr = htonl(i);
+    snprintf(name, sizeof(name), "host-%zu.example.com", i % NAMES);
+    target.server_name = name;
+    ck_assert(probe_table_add(table, &target));
+  }
+
+  // Names are stored once however many rows share them
+  ck_assert_ptr_eq(probe_table_name(table, 0),
+                   probe_table_name(table, NAMES * 7));
+  ck_assert_str_eq(probe_table_name(table, NAMES + 5),
+                   "host-5.example.com");
+  ck_assert_uint_lt(probe_table_memory(table) / ROWS, 32);
+
+  probe_table_target(table, ROWS - 1, &target);
+  ck_assert_uint_eq(ntohl(((struct sockaddr_in*)&target.addr)->sin_addr.s_addr),
+                    ROWS - 1);
+
+  probe_table_destroy(table);
+}
+END_TEST
+
+static void
+check_row(probe_target_t* target, void* data)
+{
+  size_t* verdicts = data;
+
+  ck_assert_int_ne(target->result.state, CANCELLED);
+  __atomic_add_fetch(verdicts, 1, __ATOMIC_RELAXED);
+}
+
+START_TEST(table_sweep_test)
+{
+  probe_table_t* table = probe_table_create(0);
+  probe_sweep_conf_t conf;
+  probe_target_t target;
+  in_port_t up, down;
+  int sock = listen_loopback(&up);
+  int unix_sock = listen_unix("@table_test_sweep", SOCK_STREAM);
+  char up_str[8], down_str[8];
+  size_t verdicts = 0;
+
+  close(listen_loopback(&down));
+  snprintf(up_str, sizeof(up_str), "%u", up);
+  snprintf(down_str, sizeof(down_str), "%u", down);
+
+  for (size_t i = 0; i < SWEEP_ROWS; ++i) {
+    if (i % UP_EVERY == 0) {
+      probe_target_init(&target, "127.0.0.1", up_str, NULL);
+    } else if (i % UP_EVERY == 1) {
+      probe_target_init_unix(&target, "@table_test_sweep", SOCK_STREAM);
+    } else {
+      probe_target_init(&target, "127.0.0.1", down_str, NULL);
+    }
+
+    ck_assert(probe_table_add(table, &target));
+  }
+
+  probe_target_init(&target, "127.0.0.1", "unknown-service", NULL);
+  ck_assert(probe_table_add(table, &target));
+
+  probe_sweep_conf_init(&conf);
+  conf.engine.retry_count = 1;
+  conf.workers = 2;
+  conf.max_active = 4;
+  conf.batch = 16;
+
+  ck_assert_uint_eq(probe_sweep_table(table, &conf, check_row, &verdicts),
+                    SWEEP_ROWS);
+  ck_assert_uint_eq(verdicts, SWEEP_ROWS);
+
+  // Verdicts are packed back into their own rows
+  for (size_t i = 0; i < SWEEP_ROWS; ++i) {
+    ck_assert_int_eq(probe_table_state(table, i),
+                     i % UP_EVERY <= 1 ? AVAILABLE : UNAVAILABLE);
+    ck_assert_uint_eq(probe_table_attempts(table, i), 1);
+  }
+
+  ck_assert_int_eq(probe_table_state(table, SWEEP_ROWS), UNKNOWN_SERVICE);
+
+  probe_table_destroy(table);
+  close(unix_sock);
+  close(sock);
+}
+END_TEST
+
+START_TEST(table_sweep_failed_test)
+{
+  probe_table_t* table = probe_table_create(0);
+  probe_sweep_conf_t conf;
+  probe_target_t target;
+  in_port_t up;
+  int sock = listen_loopback(&up);
+  char up_str[8];
+  size_t verdicts = 0;
+
+  // Failed rows don't hold the slots of a single worker
+  for (size_t i = 0; i < SWEEP_ROWS; ++i) {
+    probe_target_init_unix(&target, "", SOCK_STREAM);
+    ck_assert(probe_table_add(table, &target));
+  }
+
+  snprintf(up_str, sizeof(up_str), "%u", up);
+  probe_target_init(&target, "127.0.0.1", up_str, NULL);
+  ck_assert(probe_table_add(table, &target));
+
+  probe_sweep_conf_init(&conf);
+  conf.engine.retry_count = 1;
+  conf.workers = 1;
+  conf.max_active = 4;
+
+  ck_assert_uint_eq(probe_sweep_table(table, &conf, check_row, &verdicts), 1);
+  ck_assert_uint_eq(verdicts, 1);
+  ck_assert_int_eq(probe_table_state(table, 0), INVALID_PATH);
+  ck_assert_int_eq(probe_table_state(table, SWEEP_ROWS), AVAILABLE);
+
+  probe_table_destroy(table);
+  close(sock);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe table test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, table_pack_test);
+  tcase_add_test(t, table_memory_test);
+  tcase_add_test(t, table_sweep_test);
+  tcase_add_test(t, table_sweep_failed_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
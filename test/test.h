@@ -1,6 +1,57 @@
 #ifndef TEST_H
 #define TEST_H
 
+#include <arpa/inet.h>
+#include <check.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #define TEST_CASE_TIMEOUT 20
 
+// Listens on an ephemeral loopback port, returns the socket
+static int
+listen_loopback(in_port_t* port)
+{
+  struct sockaddr_in addr = { .sin_family = AF_INET,
+                              .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  socklen_t len = sizeof(addr);
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+  ck_assert_int_ne(sock, -1);
+  ck_assert_int_eq(bind(sock, (struct sockaddr*)&addr, len), 0);
+  ck_assert_int_eq(listen(sock, 16), 0);
+  ck_assert_int_eq(getsockname(sock, (struct sockaddr*)&addr, &len), 0);
+
+  *port = ntohs(addr.sin_port);
+
+  return sock;
+}
+
+// Listens on Unix socket `path` of `type`, `@name` is an abstract one
+static int
+listen_unix(const char* path, int type)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  socklen_t len = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+  int sock = socket(AF_UNIX, type, 0);
+
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  if (path[0] == '@') {
+    addr.sun_path[0] = '\0';
+  } else {
+    unlink(path);
+    len++;
+  }
+
+  ck_assert_int_ne(sock, -1);
+  ck_assert_int_eq(bind(sock, (struct sockaddr*)&addr, len), 0);
+  ck_assert_int_eq(listen(sock, 16), 0);
+
+  return sock;
+}
+
 #endif
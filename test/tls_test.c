@@ -0,0 +1,278 @@
+#include "engine.h"
+#include "test.h"
+#include <check.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct server
+{
+  int sock;
+  in_port_t port;
+  SSL_CTX* ctx;
+  size_t connections;
+  pthread_t thread;
+  char ca_file[32];
+} server_t;
+
+static EVP_PKEY*
+make_key()
+{
+  EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  EVP_PKEY* key = NULL;
+
+  ck_assert_ptr_nonnull(ctx);
+  ck_assert_int_eq(EVP_PKEY_keygen_init(ctx), 1);
+  ck_assert_int_eq(
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1), 1);
+  ck_assert_int_eq(EVP_PKEY_keygen(ctx, &key), 1);
+  EVP_PKEY_CTX_free(ctx);
+
+  return key;
+}
+
+// Self-signed `localhost` certificate valid for `days` more
+static X509*
+make_cert(EVP_PKEY* key, long days)
+{
+  X509* cert = X509_new();
+  X509_NAME* name = X509_get_subject_name(cert);
+  X509V3_CTX v3;
+  X509_EXTENSION* san;
+
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+  X509_gmtime_adj(X509_getm_notAfter(cert), days * 24 * 3600 + 60);
+  X509_NAME_add_entry_by_txt(
+    name, "CN", MBSTRING_ASC, (unsigned char*)"localhost", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+  X509_set_pubkey(cert, key);
+
+  X509V3_set_ctx(&v3, cert, cert, NULL, NULL, 0);
+  san = X509V3_EXT_conf_nid(NULL, &v3, NID_subject_alt_name, "DNS:localhost");
+  ck_assert_ptr_nonnull(san);
+  X509_add_ext(cert, san, -1);
+  X509_EXTENSION_free(san);
+
+  ck_assert_int_ne(X509_sign(cert, key, EVP_sha256()), 0);
+
+  return cert;
+}
+
+// Handshakes the next `connections` clients and holds each till it leaves
+static void*
+serve(void* data)
+{
+  server_t* server = data;
+  char buf[64];
+
+  for (size_t i = 0; i < server->connections; ++i) {
+    int conn = accept(server->sock, NULL, NULL);
+    SSL* ssl = SSL_new(server->ctx);
+
+    SSL_set_fd(ssl, conn);
+
+    if (SSL_accept(ssl) == 1) {
+      while (SSL_read(ssl, buf, sizeof(buf)) > 0) {
+      }
+    }
+
+    SSL_free(ssl);
+    close(conn);
+  }
+
+  return NULL;
+}
+
+// The certificate is also written to `server->ca_file` for the clients
+static void
+server_start(server_t* server, long days, size_t connections)
+{
+  EVP_PKEY* key = make_key();
+  X509* cert = make_cert(key, days);
+  int fd;
+  FILE* file;
+
+  strcpy(server->ca_file, "/tmp/probe_tls_XXXXXX");
+  fd = mkstemp(server->ca_file);
+  ck_assert_int_ne(fd, -1);
+  file = fdopen(fd, "w");
+  ck_assert_int_eq(PEM_write_X509(file, cert), 1);
+  fclose(file);
+
+  server->ctx = SSL_CTX_new(TLS_server_method());
+  ck_assert_int_eq(SSL_CTX_use_certificate(server->ctx, cert), 1);
+  ck_assert_int_eq(SSL_CTX_use_PrivateKey(server->ctx, key), 1);
+  X509_free(cert);
+  EVP_PKEY_free(key);
+
+  server->sock = listen_loopback(&server->port);
+  server->connections = connections;
+  ck_assert_int_eq(pthread_create(&server->thread, NULL, serve, server), 0);
+}
+
+static void
+server_stop(server_t* server)
+{
+  pthread_join(server->thread, NULL);
+  close(server->sock);
+  SSL_CTX_free(server->ctx);
+  unlink(server->ca_file);
+}
+
+START_TEST(tls_test)
+{
+  server_t server;
+  probe_result_t result;
+
+  server_start(&server, 365, 2);
+  ck_assert(probe_config_tls(true, NULL, server.ca_file, 30));
+
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   AVAILABLE);
+  ck_assert(result.tls.valid);
+  ck_assert(!result.tls.resumed);
+  ck_assert_str_eq(result.tls.version, "TLSv1.3");
+  ck_assert_int_ne(strlen(result.tls.cipher), 0);
+  ck_assert_int_eq(result.tls.days_left, 365);
+  ck_assert_int_gt(result.tls.not_after, time(NULL) + 364 * 24 * 3600);
+  ck_assert_uint_gt(result.timings.phase_ns[PHASE_HANDSHAKE], 0);
+
+  // Blocking probes resume sessions as well
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   AVAILABLE);
+  ck_assert(result.tls.valid);
+  ck_assert(result.tls.resumed);
+
+  probe_config_tls(false, NULL, NULL, 0);
+  server_stop(&server);
+}
+END_TEST
+
+START_TEST(tls_expiry_test)
+{
+  server_t server;
+  probe_result_t result;
+
+  server_start(&server, 5, 1);
+  ck_assert(probe_config_tls(true, NULL, server.ca_file, 30));
+
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   CERTIFICATE_EXPIRING);
+  ck_assert(result.tls.valid);
+  ck_assert_int_eq(result.tls.days_left, 5);
+
+  probe_config_tls(false, NULL, NULL, 0);
+  server_stop(&server);
+}
+END_TEST
+
+START_TEST(tls_verify_test)
+{
+  server_t server;
+  probe_result_t result;
+
+  server_start(&server, 365, 2);
+
+  // Not in the system bundle
+  ck_assert(probe_config_tls(true, NULL, NULL, 0));
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   HANDSHAKE_FAILED);
+  ck_assert(!result.tls.valid);
+  ck_assert_ptr_nonnull(strstr(result.tls.error, "self"));
+
+  ck_assert(probe_config_tls(true, "example.com", server.ca_file, 0));
+  ck_assert_int_eq(host_port_probe_r("localhost", server.port, NULL, &result),
+                   HANDSHAKE_FAILED);
+  ck_assert_ptr_nonnull(strstr(result.tls.error, "hostname"));
+
+  probe_config_tls(false, NULL, NULL, 0);
+  server_stop(&server);
+}
+END_TEST
+
+START_TEST(tls_engine_test)
+{
+  server_t server;
+  probe_engine_conf_t conf;
+  probe_engine_t* engine;
+  probe_target_t target;
+  char port_str[8];
+
+  server_start(&server, 365, 2);
+  ck_assert(probe_config_tls(true, NULL, server.ca_file, 30));
+  probe_config(1, 1);
+  probe_engine_conf_init(&conf);
+  ck_assert(conf.tls);
+  engine = probe_engine_create(1, &conf);
+
+  snprintf(port_str, sizeof(port_str), "%u", server.port);
+  ck_assert_int_eq(probe_target_init(&target, "localhost", port_str, NULL),
+                   CANCELLED);
+  ck_assert_str_eq(target.server_name, "localhost");
+
+  // The second probe resumes the session of the first one
+  for (int i = 0; i < 2; ++i) {
+    ck_assert(probe_engine_submit(engine, &target));
+
+    while (probe_engine_active(engine) > 0) {
+      probe_engine_run(engine, -1, NULL, NULL);
+    }
+
+    ck_assert_int_eq(target.result.state, AVAILABLE);
+    ck_assert(target.result.tls.valid);
+    ck_assert(target.result.tls.resumed == (i == 1));
+    ck_assert_int_eq(target.result.tls.days_left, 365);
+  }
+
+  probe_engine_destroy(engine);
+  probe_config_tls(false, NULL, NULL, 0);
+  server_stop(&server);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  // Clients leave without reading the session tickets
+  signal(SIGPIPE, SIG_IGN);
+
+  s = suite_create("Probe TLS test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, tls_test);
+  tcase_add_test(t, tls_expiry_test);
+  tcase_add_test(t, tls_verify_test);
+  tcase_add_test(t, tls_engine_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
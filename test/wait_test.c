@@ -0,0 +1,187 @@
+#include "wait.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Starts listening on `path` or loopback `port` after `delay_ms`
+typedef struct late_listener
+{
+  const char* path;
+  in_port_t port;
+  uint32_t delay_ms;
+  int sock;
+  uint64_t listening_ns;
+  pthread_t thread;
+} late_listener_t;
+
+static uint64_t
+now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void*
+listen_late(void* data)
+{
+  late_listener_t* listener = data;
+  struct sockaddr_in addr = { .sin_family = AF_INET,
+                              .sin_port = htons(listener->port),
+                              .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+
+  usleep(listener->delay_ms * 1000);
+
+  if (listener->path != NULL) {
+    listener->sock = listen_unix(listener->path, SOCK_STREAM);
+  } else {
+    listener->sock = socket(AF_INET, SOCK_STREAM, 0);
+    ck_assert_int_eq(
+      bind(listener->sock, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    ck_assert_int_eq(listen(listener->sock, 16), 0);
+  }
+
+  listener->listening_ns = now_ns();
+
+  return NULL;
+}
+
+static void
+listener_start(late_listener_t* listener,
+               const char* path,
+               in_port_t port,
+               uint32_t delay_ms)
+{
+  listener->path = path;
+  listener->port = port;
+  listener->delay_ms = delay_ms;
+  ck_assert_int_eq(
+    pthread_create(&listener->thread, NULL, listen_late, listener), 0);
+}
+
+static void
+listener_stop(late_listener_t* listener)
+{
+  pthread_join(listener->thread, NULL);
+  close(listener->sock);
+
+  if (listener->path != NULL && listener->path[0] != '@') {
+    unlink(listener->path);
+  }
+}
+
+static void
+record_ready(probe_target_t* target, void* data)
+{
+  uint64_t* ready_ns = data;
+
+  ck_assert_int_eq(target->result.state, AVAILABLE);
+  *ready_ns = now_ns();
+}
+
+START_TEST(wait_unix_test)
+{
+  probe_engine_conf_t conf = { .connect_timeout_ms = 100 };
+  late_listener_t listener;
+  probe_target_t target;
+  uint64_t ready_ns = 0;
+  char path[64];
+
+  snprintf(path, sizeof(path), "/tmp/wait_test_%d.sock", getpid());
+  unlink(path);
+  ck_assert_int_eq(probe_target_init_unix(&target, path, SOCK_STREAM),
+                   CANCELLED);
+  listener_start(&listener, path, 0, 300);
+
+  ck_assert(probe_wait(&target, 1, 2000, &conf, record_ready, &ready_ns));
+  listener_stop(&listener);
+
+  // The socket file wakes the wait up, no capped backoff is waited out
+  ck_assert_uint_ne(ready_ns, 0);
+  ck_assert_uint_lt(ready_ns - listener.listening_ns,
+                    WAIT_BACKOFF_MAX_MS / 2 * 1000000ull);
+}
+END_TEST
+
+START_TEST(wait_polling_test)
+{
+  probe_engine_conf_t conf = { .connect_timeout_ms = 100 };
+  late_listener_t tcp, abstract;
+  probe_target_t targets[2];
+  uint64_t ready_ns = 0;
+  char port_str[8];
+  in_port_t port;
+
+  close(listen_loopback(&port));
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  probe_target_init(&targets[0], "127.0.0.1", port_str, NULL);
+  probe_target_init_unix(&targets[1], "@wait_test_abstract", SOCK_STREAM);
+  listener_start(&tcp, NULL, port, 100);
+  listener_start(&abstract, "@wait_test_abstract", 0, 200);
+
+  ck_assert(probe_wait(targets, 2, 2000, &conf, record_ready, &ready_ns));
+  listener_stop(&tcp);
+  listener_stop(&abstract);
+
+  ck_assert_int_eq(targets[0].result.state, AVAILABLE);
+  ck_assert_int_eq(targets[1].result.state, AVAILABLE);
+  ck_assert_uint_lt(ready_ns - abstract.listening_ns,
+                    (WAIT_BACKOFF_MAX_MS + 20) * 1000000ull);
+}
+END_TEST
+
+START_TEST(wait_timeout_test)
+{
+  probe_engine_conf_t conf = { .connect_timeout_ms = 100 };
+  probe_target_t target;
+  uint64_t ready_ns = 0, start = now_ns();
+
+  probe_target_init_unix(&target, "@wait_test_missing", SOCK_STREAM);
+
+  ck_assert(!probe_wait(&target, 1, 100, &conf, record_ready, &ready_ns));
+  ck_assert_uint_eq(ready_ns, 0);
+  ck_assert_int_eq(target.result.state, UNAVAILABLE);
+  ck_assert_uint_ge(now_ns() - start, 100 * 1000000ull);
+  ck_assert_uint_lt(now_ns() - start, 200 * 1000000ull);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe wait test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, wait_unix_test);
+  tcase_add_test(t, wait_polling_test);
+  tcase_add_test(t, wait_timeout_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}
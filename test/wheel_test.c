@@ -0,0 +1,146 @@
+#include "test.h"
+#include "wheel.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct fired
+{
+  uint32_t ids[16];
+  size_t count;
+  probe_wheel_t* wheel;
+} fired_t;
+
+static void
+record(uint32_t id, void* data)
+{
+  fired_t* fired = data;
+
+  fired->ids[fired->count++] = id;
+}
+
+START_TEST(wheel_test)
+{
+  probe_wheel_t* wheel = probe_wheel_create(4, 1000);
+  fired_t fired = { 0 };
+
+  ck_assert_ptr_nonnull(wheel);
+  ck_assert_int_eq(probe_wheel_next(wheel, 1000), -1);
+
+  probe_wheel_schedule(wheel, 0, 1010);
+  probe_wheel_schedule(wheel, 1, 1005);
+  probe_wheel_schedule(wheel, 2, 1020);
+  ck_assert(probe_wheel_pending(wheel, 0));
+  ck_assert(!probe_wheel_pending(wheel, 3));
+  ck_assert_int_eq(probe_wheel_next(wheel, 1000), 5);
+
+  probe_wheel_cancel(wheel, 2);
+  ck_assert(!probe_wheel_pending(wheel, 2));
+
+  ck_assert_uint_eq(probe_wheel_advance(wheel, 1004, record, &fired), 0);
+  ck_assert_uint_eq(probe_wheel_advance(wheel, 1010, record, &fired), 2);
+  ck_assert_uint_eq(fired.ids[0], 1);
+  ck_assert_uint_eq(fired.ids[1], 0);
+  ck_assert(!probe_wheel_pending(wheel, 0));
+  ck_assert_int_eq(probe_wheel_next(wheel, 1010), -1);
+
+  // Expiry in the past fires on the next tick
+  probe_wheel_schedule(wheel, 3, 1);
+  ck_assert_int_eq(probe_wheel_next(wheel, 1010), 1);
+  ck_assert_uint_eq(probe_wheel_advance(wheel, 1011, record, &fired), 1);
+  ck_assert_uint_eq(fired.ids[2], 3);
+
+  // Rescheduling moves the timer instead of adding one more
+  probe_wheel_schedule(wheel, 0, 1100);
+  probe_wheel_schedule(wheel, 0, 1050);
+  ck_assert_uint_eq(probe_wheel_advance(wheel, 1200, record, &fired), 1);
+  ck_assert_uint_eq(fired.ids[3], 0);
+
+  probe_wheel_destroy(wheel);
+}
+END_TEST
+
+START_TEST(wheel_far_test)
+{
+  probe_wheel_t* wheel = probe_wheel_create(3, 0);
+  fired_t fired = { 0 };
+  // Beyond the lowest & past the whole wheel range
+  uint64_t far = 3 * 64 * 64 + 7, farthest = (1ull << 32) + 5;
+
+  probe_wheel_schedule(wheel, 0, far);
+  probe_wheel_schedule(wheel, 1, farthest);
+  probe_wheel_schedule(wheel, 2, 70);
+
+  ck_assert_uint_eq(probe_wheel_advance(wheel, far - 1, record, &fired), 1);
+  ck_assert_uint_eq(fired.ids[0], 2);
+  ck_assert_int_eq(probe_wheel_next(wheel, far - 1), 1);
+  ck_assert_uint_eq(probe_wheel_advance(wheel, far, record, &fired), 1);
+  ck_assert_uint_eq(fired.ids[1], 0);
+
+  ck_assert_uint_eq(
+    probe_wheel_advance(wheel, farthest - 1, record, &fired), 0);
+  ck_assert(probe_wheel_pending(wheel, 1));
+  ck_assert_uint_eq(probe_wheel_advance(wheel, farthest, record, &fired), 1);
+  ck_assert_uint_eq(fired.ids[2], 1);
+
+  probe_wheel_destroy(wheel);
+}
+END_TEST
+
+static void
+cancel_other(uint32_t id, void* data)
+{
+  fired_t* fired = data;
+
+  fired->ids[fired->count++] = id;
+  probe_wheel_cancel(fired->wheel, id == 0 ? 1 : 0);
+}
+
+START_TEST(wheel_cancel_in_callback_test)
+{
+  probe_wheel_t* wheel = probe_wheel_create(2, 0);
+  fired_t fired = { .wheel = wheel };
+
+  probe_wheel_schedule(wheel, 0, 10);
+  probe_wheel_schedule(wheel, 1, 10);
+
+  ck_assert_uint_eq(probe_wheel_advance(wheel, 10, cancel_other, &fired), 1);
+  ck_assert_uint_eq(fired.count, 1);
+  ck_assert(!probe_wheel_pending(wheel, 0));
+  ck_assert(!probe_wheel_pending(wheel, 1));
+
+  probe_wheel_destroy(wheel);
+}
+END_TEST
+
+int
+main()
+{
+  uint32_t number_failed;
+  SRunner* sr;
+  Suite* s;
+  TCase* t;
+
+  s = suite_create("Probe timing wheel test suite");
+  t = tcase_create("API");
+
+  tcase_add_test(t, wheel_test);
+  tcase_add_test(t, wheel_far_test);
+  tcase_add_test(t, wheel_cancel_in_callback_test);
+  tcase_set_timeout(t, TEST_CASE_TIMEOUT);
+  suite_add_tcase(s, t);
+
+  sr = srunner_create(s);
+
+#ifdef DEBUG
+  srunner_set_fork_status(sr, CK_NOFORK);
+#endif
+
+  srunner_run_all(sr, CK_SUBUNIT);
+
+  number_failed = srunner_ntests_failed(sr);
+
+  srunner_free(sr);
+
+  return number_failed;
+}